@@ -30,6 +30,7 @@ See the LICENSE file provided with the distribution for more information.
 #include <boost/foreach.hpp>
 #include <iostream>
 #include <cstdio>
+#include "MemoryAccountant.h"
 
 using namespace std;
 
@@ -40,9 +41,10 @@ class BumpAllocator
 	unsigned lock;
 	char * chunk;
 	unsigned offset;
+	MemoryAccountant *accountant; //charged for every chunk, may be null
 
 public:
-	BumpAllocator(): lock(0), offset(0)
+	BumpAllocator(): lock(0), offset(0), accountant(NULL)
 	{
 		chunks.reserve(1024); //avoid unnecessary resizing
 		chunk = (char*)malloc(ChunkSize);
@@ -61,10 +63,22 @@ public:
 		{
 			free(ptr);
 		}
+		if(accountant)
+			accountant->release((unsigned long)chunks.size()*ChunkSize);
 		chunks.clear();
 		offset = ChunkSize; //force new allocation
 	}
 
+	//report chunk allocations to acct, including those already made
+	void setAccountant(MemoryAccountant *acct)
+	{
+		if(accountant)
+			accountant->release((unsigned long)chunks.size()*ChunkSize);
+		accountant = acct;
+		if(accountant)
+			accountant->charge((unsigned long)chunks.size()*ChunkSize);
+	}
+
 	unsigned numChunks() const { return chunks.size(); }
 
 	//allocate size bytes and return
@@ -85,6 +99,8 @@ public:
 
 			chunks.push_back(chunk);
 			offset = 0;
+			if(accountant)
+				accountant->charge(ChunkSize);
 		}
 		void *ptr = chunk+offset;
 		offset += size;
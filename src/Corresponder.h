@@ -55,6 +55,7 @@ class Corresponder
 	TripletMatch *tm; //current match being processed
 	vector<double> pointCoords;
 	vector<double> weights;
+	vector<double> radii;
 	vector<double> molCoords; //coordinates of current match
 	vector<double> tmpCoords;
 
@@ -76,6 +77,32 @@ class Corresponder
 		return excluder.isExcluded(mdata.mol, result->rmsd);
 	}
 
+	//every matched point must end up within its query point's radius, and a
+	//rigid transformation preserves distances, so the distance between two
+	//matched points can't differ from the distance between their query points
+	//by more than the sum of the radii; check the points from first on against
+	//all the points before them
+	bool distancesConsistent(unsigned first) const
+	{
+		const double *m = &molCoords[0];
+		const double *q = &pointCoords[0];
+		for (unsigned i = first, n = radii.size(); i < n; i++)
+		{
+			for (unsigned j = 0; j < i; j++)
+			{
+				double mx = m[3 * i] - m[3 * j], my = m[3 * i + 1] - m[3 * j + 1],
+						mz = m[3 * i + 2] - m[3 * j + 2];
+				double qx = q[3 * i] - q[3 * j], qy = q[3 * i + 1] - q[3 * j + 1],
+						qz = q[3 * i + 2] - q[3 * j + 2];
+				double diff = sqrt(mx * mx + my * my + mz * mz)
+						- sqrt(qx * qx + qy * qy + qz * qz);
+				if (fabs(diff) > radii[i] + radii[j] + 1e-6)
+					return false;
+			}
+		}
+		return true;
+	}
+
 	//recursively generate all possible legal correspondences
 	//return true if should keep going
 	bool generate(int pos, int128_t alreadyMatched)
@@ -91,9 +118,9 @@ class Corresponder
 			if (UnWeightedRMSD)
 				tmpresult->rmsd = calculateRMSD(&pointCoords[0], &molCoords[0],
 						n);
-			else
+			else //bail out early if the rmsd is too big, skipping the transform
 				tmpresult->rmsd = calculateRMSD(&pointCoords[0], &molCoords[0],
-						&weights[0], n);
+						&weights[0], n, 1.0);
 			if (UnWeightedRMSD || tmpresult->rmsd.value() <= 1.0)
 			{
 				//rmsd is weighted so the max legal value is 1.0
@@ -217,6 +244,7 @@ class Corresponder
 				{
 					//set cor
 					int128_t newmatches = 0;
+					unsigned firstnew = weights.size();
 					for (unsigned p = 0; p < 3; p++)
 					{
 						if (newqpoints[p] >= 0)
@@ -239,10 +267,13 @@ class Corresponder
 
 							weights.push_back(
 									trip.getPoints()[p].point->radiusWeight());
+							radii.push_back(trip.getPoints()[p].point->radius);
 							newmatches |= (one << newmpoints[p]);
 						}
 					}
-					if (!generate(pos - 1, alreadyMatched | newmatches))
+					//prune partial correspondences that can't possibly align
+					if (distancesConsistent(firstnew)
+							&& !generate(pos - 1, alreadyMatched | newmatches))
 					{
 						return false;
 					}
@@ -257,6 +288,7 @@ class Corresponder
 							molCoords.resize(molCoords.size() - 3);
 							pointCoords.resize(pointCoords.size() - 3);
 							weights.pop_back();
+							radii.pop_back();
 						}
 					}
 				}
@@ -281,6 +313,7 @@ public:
 		pointCoords.reserve(points.size() * 3);
 		molCoords.reserve(points.size() * 3);
 		weights.reserve(points.size());
+		radii.reserve(points.size());
 	}
 
 	virtual ~Corresponder()
@@ -307,6 +340,7 @@ public:
 				pointCoords.clear();
 				molCoords.clear();
 				weights.clear();
+				radii.clear();
 			}
 			if (thisConfCnt > 0)
 				matchedCnt++;
@@ -0,0 +1,808 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * FCGIEventServer.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "FCGIEventServer.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <boost/bind.hpp>
+
+using namespace std;
+
+//FastCGI protocol constants
+#define FCGI_VERSION_1 1
+#define FCGI_HEADER_LEN 8
+#define FCGI_MAX_CONTENT 65535
+
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_ABORT_REQUEST 2
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_GET_VALUES 9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_UNKNOWN_TYPE 11
+
+#define FCGI_KEEP_CONN 1
+#define FCGI_RESPONDER 1
+
+#define FCGI_REQUEST_COMPLETE 0
+#define FCGI_UNKNOWN_ROLE 3
+
+//epoll ids for the non-connection file descriptors
+#define LISTEN_ID 0
+#define WAKE_ID 1
+
+#define MAXEVENTS 256
+#define READSIZE (64*1024)
+#define MAX_BUFFERED (4*1024*1024) //unsent bytes kept in memory per connection
+#define SPOOL_CHUNK (256*1024) //read back from a spool file at a time
+
+//append a record header for type/id/len to out
+static void appendHeader(string& out, unsigned char type, unsigned short id,
+		unsigned len)
+{
+	char h[FCGI_HEADER_LEN];
+	h[0] = FCGI_VERSION_1;
+	h[1] = type;
+	h[2] = (id >> 8) & 0xff;
+	h[3] = id & 0xff;
+	h[4] = (len >> 8) & 0xff;
+	h[5] = len & 0xff;
+	h[6] = 0; //no padding
+	h[7] = 0;
+	out.append(h, FCGI_HEADER_LEN);
+}
+
+//append a name-value pair length
+static void appendLength(string& out, unsigned len)
+{
+	if (len < 128)
+	{
+		out += (char) len;
+	}
+	else
+	{
+		out += (char) (((len >> 24) & 0x7f) | 0x80);
+		out += (char) ((len >> 16) & 0xff);
+		out += (char) ((len >> 8) & 0xff);
+		out += (char) (len & 0xff);
+	}
+}
+
+//read a name-value pair length from data at pos, return false if truncated
+static bool readLength(const string& data, unsigned& pos, unsigned& len)
+{
+	if (pos >= data.size())
+		return false;
+	unsigned char b = data[pos];
+	if (b & 0x80)
+	{
+		if (pos + 4 > data.size())
+			return false;
+		len = ((b & 0x7f) << 24) | ((unsigned char) data[pos + 1] << 16)
+				| ((unsigned char) data[pos + 2] << 8)
+				| (unsigned char) data[pos + 3];
+		pos += 4;
+	}
+	else
+	{
+		len = b;
+		pos++;
+	}
+	return true;
+}
+
+//decode name-value pairs, values with no name are ignored
+static void parseNameValues(const string& data, map<string, string>& nv)
+{
+	unsigned pos = 0;
+	while (pos < data.size())
+	{
+		unsigned nlen = 0, vlen = 0;
+		if (!readLength(data, pos, nlen) || !readLength(data, pos, vlen))
+			return;
+		if (pos + nlen + vlen > data.size())
+			return;
+		nv[data.substr(pos, nlen)] = data.substr(pos + nlen, vlen);
+		pos += nlen + vlen;
+	}
+}
+
+//look for name in an &-separated list of name=value pairs
+static bool findFormValue(const string& qs, const string& name, string& val)
+{
+	size_t pos = 0;
+	while (pos < qs.size())
+	{
+		size_t end = qs.find('&', pos);
+		if (end == string::npos)
+			end = qs.size();
+		size_t eq = qs.find('=', pos);
+		if (eq != string::npos && eq < end && eq - pos == name.size()
+				&& qs.compare(pos, name.size(), name) == 0)
+		{
+			val = qs.substr(eq + 1, end - eq - 1);
+			return true;
+		}
+		pos = end + 1;
+	}
+	return false;
+}
+
+string FCGIRequest::getFormValue(const string& name) const
+{
+	string val;
+	map<string, string>::const_iterator qs = env.find("QUERY_STRING");
+	if (qs != env.end() && findFormValue(qs->second, name, val))
+		return val;
+
+	map<string, string>::const_iterator ct = env.find("CONTENT_TYPE");
+	if (ct != env.end()
+			&& ct->second.find("application/x-www-form-urlencoded")
+					!= string::npos)
+		findFormValue(in, name, val);
+	return val;
+}
+
+FCGIEventServer::FCGIEventServer(int lfd, unsigned nworkers, Handler h,
+		Classifier c) :
+		listenfd(lfd), epollfd(-1), wakefd(-1), nextConnID(WAKE_ID + 1), handler(
+				h), classifier(c), stopping(false)
+{
+	int flags = fcntl(listenfd, F_GETFL, 0);
+	fcntl(listenfd, F_SETFL, flags | O_NONBLOCK);
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epollfd < 0 || wakefd < 0)
+	{
+		cerr << "Could not initialize event server: " << strerror(errno)
+				<< "\n";
+		exit(-1);
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = LISTEN_ID;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &ev);
+	ev.data.u64 = WAKE_ID;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+	for (unsigned i = 0; i < nworkers; i++)
+		workers.create_thread(boost::bind(thread_worker, this));
+}
+
+FCGIEventServer::~FCGIEventServer()
+{
+	{
+		boost::unique_lock<boost::mutex> lock(qmutex);
+		stopping = true;
+	}
+	qcond.notify_all();
+	workers.join_all();
+
+	for (boost::unordered_map<unsigned long, Connection*>::iterator itr =
+			connections.begin(); itr != connections.end(); ++itr)
+	{
+		Connection *conn = itr->second;
+		for (map<unsigned short, FCGIRequest*>::iterator r =
+				conn->requests.begin(); r != conn->requests.end(); ++r)
+			delete r->second;
+		close(conn->fd);
+		delete conn;
+	}
+	for (unsigned i = 0, n = priorityQ.size(); i < n; i++)
+		delete priorityQ[i];
+	for (unsigned i = 0, n = normalQ.size(); i < n; i++)
+		delete normalQ[i];
+
+	close(epollfd);
+	close(wakefd);
+}
+
+void FCGIEventServer::run()
+{
+	struct epoll_event events[MAXEVENTS];
+	while (true)
+	{
+		int n = epoll_wait(epollfd, events, MAXEVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			cerr << "epoll_wait: " << strerror(errno) << "\n";
+			return;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			unsigned long id = events[i].data.u64;
+			if (id == LISTEN_ID)
+			{
+				acceptConnections();
+			}
+			else if (id == WAKE_ID)
+			{
+				uint64_t cnt;
+				while (read(wakefd, &cnt, sizeof(cnt)) > 0)
+					;
+				drainPending();
+			}
+			else
+			{
+				//connection may have been closed earlier in this batch
+				boost::unordered_map<unsigned long, Connection*>::iterator itr =
+						connections.find(id);
+				if (itr == connections.end())
+					continue;
+				Connection *conn = itr->second;
+
+				if (events[i].events & (EPOLLERR | EPOLLHUP))
+				{
+					closeConnection(id, conn);
+					continue;
+				}
+				if (events[i].events & EPOLLOUT)
+				{
+					writeConnection(id, conn);
+					if (connections.count(id) == 0)
+						continue;
+				}
+				if (events[i].events & EPOLLIN)
+					readConnection(id, conn);
+			}
+		}
+	}
+}
+
+void FCGIEventServer::acceptConnections()
+{
+	while (true)
+	{
+		int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				cerr << "accept: " << strerror(errno) << "\n";
+			return;
+		}
+
+		unsigned long id = nextConnID++;
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = id;
+		if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			close(fd);
+			continue;
+		}
+		connections[id] = new Connection(fd);
+	}
+}
+
+void FCGIEventServer::readConnection(unsigned long connid, Connection *conn)
+{
+	char buf[READSIZE];
+	while (true)
+	{
+		ssize_t n = read(conn->fd, buf, READSIZE);
+		if (n > 0)
+		{
+			conn->inbuf.append(buf, n);
+		}
+		else if (n == 0)
+		{
+			//web server went away, any output still being generated
+			//will be dropped when it is posted
+			closeConnection(connid, conn);
+			return;
+		}
+		else if (errno == EINTR)
+		{
+			continue;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			break;
+		}
+		else
+		{
+			closeConnection(connid, conn);
+			return;
+		}
+	}
+
+	if (processRecords(connid, conn))
+		writeConnection(connid, conn);
+}
+
+//parse all complete records in the connection's input, return false if the
+//connection was closed
+bool FCGIEventServer::processRecords(unsigned long connid, Connection *conn)
+{
+	unsigned pos = 0;
+	const string& data = conn->inbuf;
+	while (data.size() - pos >= FCGI_HEADER_LEN)
+	{
+		const unsigned char *h = (const unsigned char*) data.data() + pos;
+		unsigned char type = h[1];
+		unsigned short id = (h[2] << 8) | h[3];
+		unsigned clen = (h[4] << 8) | h[5];
+		unsigned plen = h[6];
+		if (h[0] != FCGI_VERSION_1)
+		{
+			closeConnection(connid, conn);
+			return false;
+		}
+		if (data.size() - pos < FCGI_HEADER_LEN + clen + plen)
+			break; //incomplete
+
+		const char *content = data.data() + pos + FCGI_HEADER_LEN;
+		pos += FCGI_HEADER_LEN + clen + plen;
+
+		if (id == 0)
+		{
+			//management record
+			if (type == FCGI_GET_VALUES)
+			{
+				map<string, string> names;
+				parseNameValues(string(content, clen), names);
+				string body;
+				for (map<string, string>::iterator itr = names.begin();
+						itr != names.end(); ++itr)
+				{
+					string val;
+					if (itr->first == "FCGI_MPXS_CONNS")
+						val = "1";
+					else
+						continue;
+					appendLength(body, itr->first.size());
+					appendLength(body, val.size());
+					body += itr->first;
+					body += val;
+				}
+				string rec;
+				appendHeader(rec, FCGI_GET_VALUES_RESULT, 0, body.size());
+				rec += body;
+				queueOutput(conn, rec);
+			}
+			else
+			{
+				string rec;
+				appendHeader(rec, FCGI_UNKNOWN_TYPE, 0, 8);
+				rec += (char) type;
+				rec.append(7, '\0');
+				queueOutput(conn, rec);
+			}
+			continue;
+		}
+
+		map<unsigned short, FCGIRequest*>::iterator ritr = conn->requests.find(
+				id);
+		FCGIRequest *req = ritr == conn->requests.end() ? NULL : ritr->second;
+
+		switch (type)
+		{
+		case FCGI_BEGIN_REQUEST:
+		{
+			if (clen < 8 || req != NULL)
+				break;
+			unsigned role = ((unsigned char) content[0] << 8)
+					| (unsigned char) content[1];
+			bool keep = content[2] & FCGI_KEEP_CONN;
+			if (role != FCGI_RESPONDER)
+			{
+				endRequest(conn, id, FCGI_UNKNOWN_ROLE);
+				if (!keep)
+					conn->closeWhenDone = true;
+				break;
+			}
+			req = new FCGIRequest();
+			req->connid = connid;
+			req->id = id;
+			req->keepConn = keep;
+			conn->requests[id] = req;
+		}
+			break;
+		case FCGI_ABORT_REQUEST:
+			//only requests that haven't reached a worker can be abandoned
+			if (req)
+			{
+				conn->requests.erase(ritr);
+				endRequest(conn, id, FCGI_REQUEST_COMPLETE);
+				if (!req->keepConn)
+					conn->closeWhenDone = true;
+				delete req;
+			}
+			break;
+		case FCGI_PARAMS:
+			if (req)
+			{
+				if (clen > 0)
+					req->params.append(content, clen);
+				else
+				{
+					parseNameValues(req->params, req->env);
+					req->params.clear();
+				}
+			}
+			break;
+		case FCGI_STDIN:
+			if (req)
+			{
+				if (clen > 0)
+					req->in.append(content, clen);
+				else
+				{
+					//request fully read
+					conn->requests.erase(ritr);
+					conn->active++;
+					dispatch(req);
+				}
+			}
+			break;
+		default:
+			break; //ignore
+		}
+	}
+
+	conn->inbuf.erase(0, pos);
+	return true;
+}
+
+//append an end request record for id
+void FCGIEventServer::endRequest(Connection *conn, unsigned short id,
+		unsigned char protocolStatus)
+{
+	string rec;
+	appendHeader(rec, FCGI_END_REQUEST, id, 8);
+	rec.append(4, '\0'); //app status
+	rec += (char) protocolStatus;
+	rec.append(3, '\0');
+	queueOutput(conn, rec);
+}
+
+//take ownership of data and append it to the output of conn; once a client
+//falls too far behind its output goes to a spool file until it catches up
+void FCGIEventServer::queueOutput(Connection *conn, string& data)
+{
+	if (conn->spoolFailed)
+		return;
+	if (conn->spool == NULL && conn->outbytes + data.size() <= MAX_BUFFERED)
+	{
+		conn->outbytes += data.size();
+		conn->outbuf.push_back(string());
+		conn->outbuf.back().swap(data);
+		return;
+	}
+
+	if (conn->spool == NULL)
+	{
+		conn->spool = tmpfile();
+		conn->spoolWritten = conn->spoolRead = 0;
+	}
+	unsigned pos = 0;
+	while (conn->spool && pos < data.size())
+	{
+		ssize_t n = pwrite(fileno(conn->spool), data.data() + pos,
+				data.size() - pos, conn->spoolWritten);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		pos += n;
+		conn->spoolWritten += n;
+	}
+	if (conn->spool == NULL || pos < data.size())
+	{
+		cerr << "Could not spool output: " << strerror(errno) << "\n";
+		conn->spoolFailed = true;
+	}
+	data.clear();
+}
+
+//move the next chunk of spooled output into memory, return false if there
+//was nothing to move
+bool FCGIEventServer::refillFromSpool(Connection *conn)
+{
+	if (conn->spool == NULL || conn->spoolFailed)
+		return false;
+
+	unsigned long len = min(conn->spoolWritten - conn->spoolRead,
+			(unsigned long) SPOOL_CHUNK);
+	string chunk(len, '\0');
+	unsigned long pos = 0;
+	while (pos < len)
+	{
+		ssize_t n = pread(fileno(conn->spool), &chunk[pos], len - pos,
+				conn->spoolRead + pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			cerr << "Could not read spooled output: " << strerror(errno)
+					<< "\n";
+			conn->spoolFailed = true;
+			return false;
+		}
+		pos += n;
+	}
+	conn->spoolRead += len;
+
+	if (conn->spoolRead == conn->spoolWritten)
+	{
+		//caught up, later output can go straight to memory again
+		fclose(conn->spool);
+		conn->spool = NULL;
+	}
+	conn->outbytes += chunk.size();
+	conn->outbuf.push_back(string());
+	conn->outbuf.back().swap(chunk);
+	return true;
+}
+
+//send as much buffered output as the socket will take
+void FCGIEventServer::writeConnection(unsigned long connid, Connection *conn)
+{
+	if (conn->spoolFailed)
+	{
+		closeConnection(connid, conn);
+		return;
+	}
+	while (!conn->outbuf.empty() || refillFromSpool(conn))
+	{
+		const string& front = conn->outbuf.front();
+		ssize_t n = send(conn->fd, front.data() + conn->outpos,
+				front.size() - conn->outpos, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				setWriting(connid, conn, true);
+				return;
+			}
+			closeConnection(connid, conn);
+			return;
+		}
+		conn->outpos += n;
+		conn->outbytes -= n;
+		if (conn->outpos == front.size())
+		{
+			conn->outbuf.pop_front();
+			conn->outpos = 0;
+		}
+	}
+
+	if (conn->spoolFailed)
+	{
+		closeConnection(connid, conn);
+		return;
+	}
+	setWriting(connid, conn, false);
+	if (conn->closeWhenDone && conn->active == 0 && conn->requests.empty())
+		closeConnection(connid, conn);
+}
+
+void FCGIEventServer::setWriting(unsigned long connid, Connection *conn,
+		bool w)
+{
+	if (conn->writing == w)
+		return;
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = w ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+	ev.data.u64 = connid;
+	epoll_ctl(epollfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	conn->writing = w;
+}
+
+void FCGIEventServer::closeConnection(unsigned long connid, Connection *conn)
+{
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	for (map<unsigned short, FCGIRequest*>::iterator r = conn->requests.begin();
+			r != conn->requests.end(); ++r)
+		delete r->second;
+	connections.erase(connid);
+	delete conn;
+}
+
+//move worker output onto connections
+void FCGIEventServer::drainPending()
+{
+	vector<PendingOutput> out;
+	{
+		boost::unique_lock<boost::mutex> lock(pmutex);
+		out.swap(pending);
+	}
+
+	boost::unordered_map<unsigned long, Connection*> touched;
+	for (unsigned i = 0, n = out.size(); i < n; i++)
+	{
+		PendingOutput& p = out[i];
+		boost::unordered_map<unsigned long, Connection*>::iterator itr =
+				connections.find(p.connid);
+		if (itr == connections.end())
+			continue; //client is gone
+		Connection *conn = itr->second;
+		if (p.data.size() > 0)
+			queueOutput(conn, p.data);
+		if (p.done)
+		{
+			conn->active--;
+			if (!p.keepConn)
+				conn->closeWhenDone = true;
+		}
+		touched[p.connid] = conn;
+	}
+
+	for (boost::unordered_map<unsigned long, Connection*>::iterator itr =
+			touched.begin(); itr != touched.end(); ++itr)
+	{
+		writeConnection(itr->first, itr->second);
+	}
+}
+
+//queue a fully read request for the workers
+void FCGIEventServer::dispatch(FCGIRequest *req)
+{
+	if (classifier)
+		req->priority = classifier(*req);
+
+	{
+		boost::unique_lock<boost::mutex> lock(qmutex);
+		if (req->priority)
+			priorityQ.push_back(req);
+		else
+			normalQ.push_back(req);
+	}
+	qcond.notify_one();
+}
+
+void FCGIEventServer::postOutput(unsigned long connid, unsigned short reqid,
+		const char *data, unsigned len, bool done, bool keepConn)
+{
+	PendingOutput p;
+	p.connid = connid;
+	p.done = done;
+	p.keepConn = keepConn;
+	p.data.reserve(len + FCGI_HEADER_LEN * (len / FCGI_MAX_CONTENT + 3) + 8);
+
+	//frame as stdout records
+	while (len > 0)
+	{
+		unsigned n = min(len, (unsigned) FCGI_MAX_CONTENT);
+		appendHeader(p.data, FCGI_STDOUT, reqid, n);
+		p.data.append(data, n);
+		data += n;
+		len -= n;
+	}
+
+	if (done)
+	{
+		appendHeader(p.data, FCGI_STDOUT, reqid, 0);
+		appendHeader(p.data, FCGI_END_REQUEST, reqid, 8);
+		p.data.append(4, '\0');
+		p.data += (char) FCGI_REQUEST_COMPLETE;
+		p.data.append(3, '\0');
+	}
+
+	{
+		//never waits on the client, the event thread spools what it can't send
+		boost::unique_lock<boost::mutex> lock(pmutex);
+		pending.push_back(PendingOutput());
+		PendingOutput& back = pending.back();
+		back.connid = p.connid;
+		back.done = p.done;
+		back.keepConn = p.keepConn;
+		back.data.swap(p.data);
+	}
+
+	uint64_t one = 1;
+	ssize_t ret = write(wakefd, &one, sizeof(one));
+	(void) ret; //fails only if the counter is saturated, still woken
+}
+
+void FCGIEventServer::thread_worker(FCGIEventServer *server)
+{
+	while (true)
+	{
+		FCGIRequest *req = NULL;
+		{
+			boost::unique_lock<boost::mutex> lock(server->qmutex);
+			while (!server->stopping && server->priorityQ.empty()
+					&& server->normalQ.empty())
+				server->qcond.wait(lock);
+			if (server->stopping)
+				return;
+			if (!server->priorityQ.empty())
+			{
+				req = server->priorityQ.front();
+				server->priorityQ.pop_front();
+			}
+			else
+			{
+				req = server->normalQ.front();
+				server->normalQ.pop_front();
+			}
+		}
+
+		{
+			FCGIResponseBuf buf(*server, *req);
+			ostream out(&buf);
+			try
+			{
+				server->handler(*req, out);
+			}
+			catch (const std::exception& e)
+			{
+				cout << "Exception thrown " << e.what();
+			}
+			buf.finish();
+		}
+		delete req;
+	}
+}
+
+void FCGIResponseBuf::post(bool done)
+{
+	server.postOutput(request.connid, request.id, pbase(), pptr() - pbase(),
+			done, request.keepConn);
+	setp(buffer, buffer + BUFSIZE);
+}
+
+int FCGIResponseBuf::overflow(int c)
+{
+	post(false);
+	if (c != EOF)
+	{
+		*pptr() = c;
+		pbump(1);
+	}
+	return c == EOF ? 0 : c;
+}
+
+int FCGIResponseBuf::sync()
+{
+	if (pptr() > pbase())
+		post(false);
+	return 0;
+}
+
+void FCGIResponseBuf::finish()
+{
+	post(true);
+}
@@ -0,0 +1,188 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * FCGIEventServer.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *  Event driven FastCGI server.  A single thread multiplexes all the
+ *  web server connections with epoll, parses FastCGI records, and hands
+ *  complete requests to a fixed pool of worker threads.  Workers hand their
+ *  response to the event thread, which trickles it out to the client and
+ *  spools what a slow client hasn't taken to a temporary file, so a slow
+ *  download never holds onto a worker or a large amount of memory.
+ */
+
+#ifndef PHARMITSERVER_FCGIEVENTSERVER_H_
+#define PHARMITSERVER_FCGIEVENTSERVER_H_
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <streambuf>
+#include <ostream>
+#include <cstdio>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+
+//a single FastCGI request, completely read in before being given to a worker
+struct FCGIRequest
+{
+	unsigned long connid; //connection the request arrived on
+	unsigned short id; //FastCGI request id
+	bool keepConn; //web server wants to reuse the connection
+	bool priority; //serviced before normal requests
+	std::map<std::string, std::string> env;
+	std::string params; //encoded params, until all have arrived
+	std::string in; //stdin
+
+	FCGIRequest() :
+			connid(0), id(0), keepConn(false), priority(false)
+	{
+	}
+
+	//return the value of name from either the query string or a url encoded
+	//post body (not decoded); empty if not present
+	std::string getFormValue(const std::string& name) const;
+};
+
+class FCGIEventServer
+{
+public:
+	//write the response to the request to out
+	typedef boost::function<void(const FCGIRequest&, std::ostream&)> Handler;
+	//return true if the request should jump ahead of the worker queue
+	typedef boost::function<bool(const FCGIRequest&)> Classifier;
+
+private:
+	struct Connection
+	{
+		int fd;
+		std::string inbuf;
+		std::deque<std::string> outbuf;
+		unsigned outpos; //position in front of outbuf
+		unsigned long outbytes; //unsent bytes in outbuf
+		FILE *spool; //output past the memory limit, follows outbuf; null if none
+		unsigned long spoolWritten; //bytes written to spool
+		unsigned long spoolRead; //bytes moved from spool to outbuf
+		bool spoolFailed; //output was lost, the connection must be closed
+		std::map<unsigned short, FCGIRequest*> requests; //being read in
+		unsigned active; //requests with a worker
+		bool closeWhenDone; //web server did not ask to keep the connection
+		bool peerClosed;
+		bool writing; //registered for EPOLLOUT
+
+		Connection(int f) :
+				fd(f), outpos(0), outbytes(0), spool(NULL), spoolWritten(0), spoolRead(
+						0), spoolFailed(false), active(0), closeWhenDone(false), peerClosed(
+						false), writing(false)
+		{
+		}
+
+		~Connection()
+		{
+			if (spool)
+				fclose(spool);
+		}
+	};
+
+	//output produced by a worker, waiting for the event thread
+	struct PendingOutput
+	{
+		unsigned long connid;
+		std::string data;
+		bool done; //request is finished
+		bool keepConn;
+	};
+
+	int listenfd;
+	int epollfd;
+	int wakefd; //eventfd workers use to wake up the event thread
+	unsigned long nextConnID;
+	boost::unordered_map<unsigned long, Connection*> connections;
+
+	Handler handler;
+	Classifier classifier;
+
+	//worker queue, priority requests are always taken first
+	boost::mutex qmutex;
+	boost::condition_variable qcond;
+	std::deque<FCGIRequest*> priorityQ;
+	std::deque<FCGIRequest*> normalQ;
+	boost::thread_group workers;
+	volatile bool stopping;
+
+	boost::mutex pmutex;
+	std::vector<PendingOutput> pending;
+
+	void acceptConnections();
+	void readConnection(unsigned long connid, Connection *conn);
+	bool processRecords(unsigned long connid, Connection *conn);
+	void writeConnection(unsigned long connid, Connection *conn);
+	void closeConnection(unsigned long connid, Connection *conn);
+	void setWriting(unsigned long connid, Connection *conn, bool w);
+	void queueOutput(Connection *conn, std::string& data);
+	bool refillFromSpool(Connection *conn);
+	void drainPending();
+	void dispatch(FCGIRequest *req);
+	void endRequest(Connection *conn, unsigned short id,
+			unsigned char protocolStatus);
+
+	static void thread_worker(FCGIEventServer *server);
+
+public:
+	FCGIEventServer(int lfd, unsigned nworkers, Handler h, Classifier c =
+			Classifier());
+	~FCGIEventServer();
+
+	//process events forever
+	void run();
+
+	//called from worker threads, queue response data for a request
+	void postOutput(unsigned long connid, unsigned short reqid,
+			const char *data, unsigned len, bool done, bool keepConn);
+};
+
+//streambuf that buffers a worker's response and posts it to the event
+//thread in chunks
+class FCGIResponseBuf: public std::streambuf
+{
+	static const unsigned BUFSIZE = 32 * 1024;
+	FCGIEventServer& server;
+	const FCGIRequest& request;
+	char buffer[BUFSIZE];
+
+	void post(bool done);
+
+protected:
+	virtual int overflow(int c);
+	virtual int sync();
+
+public:
+	FCGIResponseBuf(FCGIEventServer& s, const FCGIRequest& r) :
+			server(s), request(r)
+	{
+		setp(buffer, buffer + BUFSIZE);
+	}
+
+	//flush everything and end the request
+	void finish();
+};
+
+#endif /* PHARMITSERVER_FCGIEVENTSERVER_H_ */
@@ -0,0 +1,100 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * LRUCache.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      A thread safe, fixed capacity, least recently used cache.
+ *      Values are stored by shared pointer so a value can still be
+ *      used after it has been evicted.
+ */
+
+#ifndef PHARMITSERVER_LRUCACHE_H_
+#define PHARMITSERVER_LRUCACHE_H_
+
+#include <list>
+#include <memory>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+template<class Key, class Value>
+class LRUCache
+{
+public:
+	typedef std::shared_ptr<const Value> ValuePtr;
+private:
+	typedef std::list<std::pair<Key, ValuePtr> > List;
+	List entries; //most recently used first
+	boost::unordered_map<Key, typename List::iterator> index;
+	boost::mutex lock;
+
+public:
+	LRUCache() {}
+
+	//return the value for key (and make it most recent), null if not present
+	ValuePtr get(const Key& key)
+	{
+		boost::unique_lock<boost::mutex> L(lock);
+		typename boost::unordered_map<Key, typename List::iterator>::iterator itr =
+				index.find(key);
+		if (itr == index.end())
+			return ValuePtr();
+		entries.splice(entries.begin(), entries, itr->second);
+		return itr->second->second;
+	}
+
+	//add or replace the value for key, evicting the least recently used
+	//entries so there are no more than capacity
+	void put(const Key& key, const ValuePtr& val, unsigned capacity)
+	{
+		boost::unique_lock<boost::mutex> L(lock);
+		typename boost::unordered_map<Key, typename List::iterator>::iterator itr =
+				index.find(key);
+		if (itr != index.end())
+		{
+			itr->second->second = val;
+			entries.splice(entries.begin(), entries, itr->second);
+		}
+		else
+		{
+			entries.push_front(std::make_pair(key, val));
+			index[key] = entries.begin();
+		}
+
+		while (entries.size() > capacity)
+		{
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+
+	unsigned size()
+	{
+		boost::unique_lock<boost::mutex> L(lock);
+		return entries.size();
+	}
+
+	void clear()
+	{
+		boost::unique_lock<boost::mutex> L(lock);
+		entries.clear();
+		index.clear();
+	}
+};
+
+#endif /* PHARMITSERVER_LRUCACHE_H_ */
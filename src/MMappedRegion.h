@@ -30,6 +30,7 @@ See the LICENSE file provided with the distribution for more information.
 #include <unistd.h>
 #include <boost/filesystem.hpp>
 #include <string>
+#include "shapedb/ResidentMemory.h"
 
 
 //a memory mapped file viewed as an array of T
@@ -38,6 +39,19 @@ class MMappedRegion
 {
 	T *data;
 	unsigned long long size;
+	std::string name;
+	unsigned long resident; //length of a resident copy, 0 if mapped from the file
+
+	void unmap()
+	{
+		if (data == nullptr)
+			return;
+		if (resident)
+			ResidentMemory::release(name, data, resident);
+		else
+			munmap(data, size);
+		resident = 0;
+	}
 
 	//sorry, can't copy these
 	MMappedRegion(const MMappedRegion& rhs)
@@ -46,11 +60,12 @@ class MMappedRegion
 	}
 public:
 	MMappedRegion() :
-		data(nullptr), size(0)
+		data(nullptr), size(0), resident(0)
 	{
 	}
 
-	MMappedRegion(const std::string& fname, bool readOnly)
+	MMappedRegion(const std::string& fname, bool readOnly) :
+		data(nullptr), size(0), resident(0)
 	{
 		map(fname, readOnly);
 	}
@@ -58,24 +73,36 @@ public:
 	~MMappedRegion()
 	{
 		//free and sync back to disk
-		munmap(data, size);
+		unmap();
 	}
 
 	void clear()
 	{
-		if(data != nullptr)
-			munmap(data, size);
+		unmap();
 		data = nullptr;
 		size = 0;
 	}
 
+	//replace a read only mapping with a huge page backed copy, if the
+	//resident memory budget allows, otherwise keep the file mapping
+	void makeResident()
+	{
+		if (data == nullptr || resident)
+			return;
+		void *mem = ResidentMemory::copy(name, data, size, resident);
+		if (mem == NULL)
+			return;
+		munmap(data, size);
+		data = (T*) mem;
+	}
+
 	//creating mapping to filename fname
 	//readOnly should be set if only for reading
 	void map(const std::string& fname, bool readOnly, bool sequential=true, bool populate=false, bool readonce=false)
 	{
 		using namespace boost;
-		if (data != NULL)
-			munmap(data, size);
+		clear();
+		name = fname;
 		unsigned flags = readOnly ? O_RDONLY : O_RDWR;
 		int fd = open(fname.c_str(), flags);
 		if(fd < 0)
@@ -135,6 +162,15 @@ public:
 	{
 		return data + length();
 	}
+	//fault in every page from the calling thread so that first touch
+	//places them according to its memory policy
+	void touch() const
+	{
+		const volatile char *p = (const char*) data;
+		long pagesz = sysconf(_SC_PAGESIZE);
+		for (unsigned long long i = 0; i < size; i += pagesz)
+			(void) p[i];
+	}
 	void sync() //flush back to disk
 	{
 		msync(data, size, MS_SYNC);
@@ -0,0 +1,87 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * MemoryAccountant.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      Tracks the memory held by all the allocators of a single query so it
+ *      can be reported and limited.  Allocators charge whole chunks as they
+ *      are malloced and release them when they are freed.  Crossing the soft
+ *      limit marks the query as over quota so it can wind down gracefully,
+ *      crossing the hard limit also raises the provided stop flag.
+ */
+
+#ifndef PHARMITSERVER_MEMORYACCOUNTANT_H_
+#define PHARMITSERVER_MEMORYACCOUNTANT_H_
+
+#include <cstddef>
+
+class MemoryAccountant
+{
+	volatile unsigned long current; //bytes currently charged
+	volatile unsigned long peak; //high water mark
+	unsigned long softLimit; //0 for no limit
+	unsigned long hardLimit; //0 for no limit
+	volatile bool overQuota; //sticky, set once soft limit is crossed
+	bool *halt; //set when the hard limit is crossed, may be null
+
+public:
+	MemoryAccountant(): current(0), peak(0), softLimit(0), hardLimit(0), overQuota(false), halt(NULL)
+	{
+	}
+
+	void setLimits(unsigned long soft, unsigned long hard, bool *stop = NULL)
+	{
+		softLimit = soft;
+		hardLimit = hard;
+		halt = stop;
+	}
+
+	//thread-safe
+	void charge(unsigned long bytes)
+	{
+		unsigned long now = __sync_add_and_fetch(&current, bytes);
+		unsigned long p = peak;
+		while (now > p && !__sync_bool_compare_and_swap(&peak, p, now))
+			p = peak;
+
+		if (softLimit > 0 && now > softLimit)
+			overQuota = true;
+		if (hardLimit > 0 && now > hardLimit)
+		{
+			overQuota = true;
+			if (halt)
+				*halt = true;
+		}
+	}
+
+	void release(unsigned long bytes)
+	{
+		__sync_sub_and_fetch(&current, bytes);
+	}
+
+	unsigned long used() const { return current; }
+	unsigned long maxUsed() const { return peak; }
+
+	//true if the soft (or hard) limit has ever been crossed
+	bool exceeded() const { return overQuota; }
+	//true if currently beyond the hard limit
+	bool overHardLimit() const { return hardLimit > 0 && current > hardLimit; }
+};
+
+#endif /* PHARMITSERVER_MEMORYACCOUNTANT_H_ */
@@ -0,0 +1,175 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+
+/*
+ * NumaTopology.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "NumaTopology.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <boost/filesystem.hpp>
+#include "CommandLine2/CommandLine.h"
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+cl::opt<bool> NumaAffinity("numa-affinity",
+		cl::desc("[server] Place each stripe's memory and search threads on a single NUMA node"),
+		cl::init(false));
+cl::opt<unsigned> NumaNodes("numa-nodes",
+		cl::desc("[server] Override the number of NUMA nodes, splitting the cpus evenly among them"),
+		cl::init(0));
+
+//parse a kernel cpu list (e.g., 0-3,8,10-11)
+static void parseCPUList(const string& list, vector<unsigned>& cpus)
+{
+	stringstream str(list);
+	string range;
+	while (getline(str, range, ','))
+	{
+		unsigned lo = 0, hi = 0;
+		char dash = 0;
+		stringstream r(range);
+		if (!(r >> lo))
+			continue;
+		if (r >> dash >> hi && dash == '-')
+		{
+			for (unsigned c = lo; c <= hi; c++)
+				cpus.push_back(c);
+		}
+		else
+			cpus.push_back(lo);
+	}
+}
+
+NumaTopology::NumaTopology()
+{
+	//actual nodes, in id order
+	vector<vector<unsigned> > real;
+	vector<int> realids;
+	boost::filesystem::path sysnodes("/sys/devices/system/node");
+	vector<int> ids;
+	if (boost::filesystem::is_directory(sysnodes))
+	{
+		for (boost::filesystem::directory_iterator itr(sysnodes), end;
+				itr != end; ++itr)
+		{
+			string name = itr->path().filename().string();
+			if (name.compare(0, 4, "node") == 0 && name.size() > 4
+					&& isdigit(name[4]))
+				ids.push_back(atoi(name.c_str() + 4));
+		}
+	}
+	sort(ids.begin(), ids.end());
+	for (unsigned i = 0, n = ids.size(); i < n; i++)
+	{
+		stringstream name;
+		name << "/sys/devices/system/node/node" << ids[i] << "/cpulist";
+		ifstream in(name.str().c_str());
+		string list;
+		getline(in, list);
+		vector<unsigned> ncpus;
+		parseCPUList(list, ncpus);
+		if (ncpus.size() > 0) //memory only nodes have no cpus
+		{
+			real.push_back(ncpus);
+			realids.push_back(ids[i]);
+		}
+	}
+
+	if (real.size() == 0)
+	{
+		//no numa information, one node with everything
+		vector<unsigned> all;
+		for (unsigned c = 0, nc = sysconf(_SC_NPROCESSORS_ONLN); c < nc; c++)
+			all.push_back(c);
+		real.push_back(all);
+		realids.push_back(-1);
+	}
+
+	if (NumaNodes == 0 || NumaNodes == real.size())
+	{
+		cpus = real;
+		memnode = realids;
+		return;
+	}
+
+	//split the cpus, in node order, evenly among the requested nodes
+	vector<unsigned> all;
+	vector<int> owner;
+	for (unsigned r = 0, nr = real.size(); r < nr; r++)
+	{
+		all.insert(all.end(), real[r].begin(), real[r].end());
+		owner.insert(owner.end(), real[r].size(), realids[r]);
+	}
+	unsigned N = NumaNodes;
+	if (N > all.size())
+		N = all.size();
+	cpus.resize(N);
+	memnode.resize(N);
+	for (unsigned v = 0; v < N; v++)
+	{
+		unsigned start = v * all.size() / N;
+		unsigned end = (v + 1) * all.size() / N;
+		cpus[v].assign(all.begin() + start, all.begin() + end);
+		memnode[v] = owner[start];
+	}
+}
+
+const NumaTopology& NumaTopology::get()
+{
+	static NumaTopology topology;
+	return topology;
+}
+
+bool NumaTopology::enabled()
+{
+	return NumaAffinity;
+}
+
+void NumaTopology::runOn(unsigned node) const
+{
+	if (node >= cpus.size())
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned i = 0, n = cpus[node].size(); i < n; i++)
+		CPU_SET(cpus[node][i], &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+//memory policy is set with the raw system call so we don't need libnuma
+void NumaTopology::bindThread(unsigned node) const
+{
+	runOn(node);
+	if (node >= memnode.size() || memnode[node] < 0)
+		return;
+
+	unsigned long mask[16] = { 0 }; //up to 1024 nodes
+	unsigned m = memnode[node];
+	mask[m / 64] |= 1UL << (m % 64);
+	syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8);
+}
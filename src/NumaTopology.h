@@ -0,0 +1,71 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+
+/*
+ * NumaTopology.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      Which cpus and memory make up each NUMA node, so that each stripe of
+ *      a database can be assigned a node and have its memory placed and its
+ *      searches run there instead of crossing the socket interconnect.
+ *      The number of nodes can be overridden (splitting the cpus evenly) so
+ *      the placement logic can be exercised on a single node machine.
+ */
+
+#ifndef PHARMITSERVER_NUMATOPOLOGY_H_
+#define PHARMITSERVER_NUMATOPOLOGY_H_
+
+#include <sched.h>
+#include <vector>
+
+using namespace std;
+
+class NumaTopology
+{
+	vector<vector<unsigned> > cpus; //cpus of each node
+	vector<int> memnode; //actual node to allocate memory from for each node
+
+	NumaTopology();
+
+public:
+	//process wide topology, detected on first use
+	static const NumaTopology& get();
+
+	//true if stripes should be placed on nodes
+	static bool enabled();
+
+	unsigned numNodes() const
+	{
+		return cpus.size();
+	}
+
+	//stripes are dealt out to nodes in order
+	unsigned nodeForStripe(unsigned i) const
+	{
+		return cpus.size() > 0 ? i % cpus.size() : 0;
+	}
+
+	//restrict the calling thread to the cpus of node and prefer allocating
+	//its memory there
+	void bindThread(unsigned node) const;
+
+	//just restrict the calling thread to the cpus of node
+	void runOn(unsigned node) const;
+};
+
+#endif /* PHARMITSERVER_NUMATOPOLOGY_H_ */
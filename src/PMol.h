@@ -181,6 +181,10 @@ class PMol
 	void getCoords(vector<FloatCoord>& coords, const RMSDResult& rms);
 	void getCoords(vector<Eigen::Vector3f>& coords, const Eigen::Transform<double, 3, Eigen::Affine>& transform);
 
+	//untransformed heavy atom coordinates
+	const FloatCoord* getCoords() const { return header.coords; }
+	unsigned numAtoms() const { return header.nAtoms; }
+
 	//write sdf with associated meta data
 	//rotate/translate points if requested
 	void writeSDF(ostream& out, const vector<ASDDataItem>& sddata,
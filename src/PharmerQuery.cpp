@@ -24,18 +24,29 @@ See the LICENSE file provided with the distribution for more information.
 #include <gperftools/malloc_extension.h>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/assign/list_of.hpp>
 #include "PharmerQuery.h"
 #include "Corresponder.h"
 #include "queryparsers.h"
 #include "Timer.h"
 #include "ShapeResults.h"
+#include "NumaTopology.h"
 
 using namespace std;
 using namespace boost;
 using namespace Eigen;
 using namespace OpenBabel;
 
+extern cl::opt<bool> LowMemoryMatching;
+
+cl::opt<unsigned> QuerySoftMemory("query-soft-memory",
+		cl::desc("Memory (MB) a query may use before it stops searching new databases, 0 for no limit"),
+		cl::init(0));
+cl::opt<unsigned> QueryHardMemory("query-hard-memory",
+		cl::desc("Memory (MB) at which a query is stopped immediately, 0 for no limit"),
+		cl::init(0));
+
 static TextQueryParser textParser;
 static JSonQueryParser jsonParser;
 static PH4Parser ph4Parser;
@@ -78,17 +89,39 @@ void PharmerQuery::initializeTriplets()
 		}
 	}
 
+	//databases with selectivity stats rank using the fingerprints; set them
+	//here since triplets is shared by the per-database search threads
+	for (unsigned d = 0, nd = databases.size(); d < nd; d++)
+	{
+		if (databases[d]->hasSelectivityStats())
+		{
+			for (unsigned i = 0, nt = triplets.size(); i < nt; i++)
+				triplets[i].setFingerPrints(*this);
+			break;
+		}
+	}
+
 	valid = true;
 }
 
+//have every allocator of the query report to the accountant
+void PharmerQuery::initializeMemory()
+{
+	memory.setLimits((unsigned long) QuerySoftMemory * 1024 * 1024,
+			(unsigned long) QueryHardMemory * 1024 * 1024, &stopSearch);
+	coralloc.setAccountant(&memory);
+	resalloc.setAccountant(&memory);
+}
+
 PharmerQuery::PharmerQuery(
 		const vector< std::shared_ptr<PharmerDatabaseSearcher> >& dbs,
 		istream& in, const string& ext, const QueryParameters& qp, unsigned nth) :
-		databases(dbs), params(qp), valid(false), stopQuery(false), tripletMatchThread(
+		databases(dbs), params(qp), valid(false), stopQuery(false), stopSearch(false), queued(false), executing(false), truncated(false), tripletMatchThread(
 		NULL), shapeMatchThread(NULL), lastAccessed(time(NULL)), corrsQs(dbs.size()), currsort(
 				SortType::Undefined), currrev(false), nthreads(nth), dbcnt(0), inUseCnt(0), numactives(0),
 				totalmols(0), sminaid(0)
 {
+	initializeMemory();
 	if (dbs.size() == 0)
 	{
 		errorStr = "No databases provided.";
@@ -126,13 +159,15 @@ PharmerQuery::PharmerQuery(
 PharmerQuery::PharmerQuery(
 		const vector< std::shared_ptr<PharmerDatabaseSearcher> >& dbs,
 		const vector<PharmaPoint>& pts, const QueryParameters& qp,
-		const ShapeConstraints& ex, unsigned nth) :
-		databases(dbs), points(pts), params(qp), excluder(ex), valid(false), stopQuery(
-				false), tripletMatchThread(NULL), shapeMatchThread(NULL), lastAccessed(time(NULL)), corrsQs(
-				dbs.size()), currsort(SortType::Undefined), currrev(false), nthreads(nth), dbcnt(
+		const ShapeConstraints& ex, unsigned nth,
+		const vector< std::shared_ptr<RemoteShard> >& sh, const string& sq) :
+		databases(dbs), shards(sh), shardQuery(sq), points(pts), params(qp), excluder(ex), valid(false), stopQuery(
+				false), stopSearch(false), queued(false), executing(false), truncated(false), tripletMatchThread(NULL), shapeMatchThread(NULL), lastAccessed(time(NULL)), corrsQs(
+				dbs.size() + sh.size()), currsort(SortType::Undefined), currrev(false), nthreads(nth), dbcnt(
 				0), inUseCnt(0), numactives(0), totalmols(0), sminaid(0)
 {
-	if (dbs.size() == 0)
+	initializeMemory();
+	if (dbs.size() == 0 && sh.size() == 0)
 	{
 		errorStr = "No databases provided.";
 		return;
@@ -245,10 +280,12 @@ void PharmerQuery::generateQueryTriplets(PharmerDatabaseSearcher& pharmdb,
 								&& kindex != jindex)
 						{
 							unsigned tindex = tripIndex[iindex][jindex][kindex];
-							if (ranking[tindex] < minval)
+							double cost = pharmdb.chainCost(prev,
+									triplets[tindex], ranking[tindex]);
+							if (cost < minval)
 							{
 								mintrip = tindex;
-								minval = ranking[tindex];
+								minval = cost;
 								bestj = j;
 								bestkindex = kindex;
 							}
@@ -301,7 +338,8 @@ void PharmerQuery::checkThreads()
 				double gb = round(10000.0 * mem / (1024.0 * 1024 * 1024))
 						/ 10000.0;
 				cout << "CORALLOC NUMCHUNKS " << coralloc.numChunks() << "\t"
-						<< gb << "GB\n";
+						<< gb << "GB\tQUERY " << memory.maxUsed() / (1024 * 1024)
+						<< "MB\n";
 			}
 		}
 	}
@@ -327,7 +365,14 @@ void PharmerQuery::thread_tripletMatches(PharmerQuery *query)
 	{
 		tmthreads.add_thread(new boost::thread(thread_tripletMatch, query));
 	}
+	for (unsigned s = 0, ns = query->shards.size(); s < ns; s++)
+	{
+		tmthreads.add_thread(new boost::thread(thread_remoteMatch, query, s));
+	}
 	tmthreads.join_all();
+	query->executing = false;
+	if (query->onDone)
+		query->onDone();
 }
 
 //launch Nthreads to match shapes
@@ -340,7 +385,14 @@ void PharmerQuery::thread_shapeMatches(PharmerQuery *query)
 	{
 		shthreads.add_thread(new boost::thread(thread_shapeMatch, query));
 	}
+	for (unsigned s = 0, ns = query->shards.size(); s < ns; s++)
+	{
+		shthreads.add_thread(new boost::thread(thread_remoteMatch, query, s));
+	}
 	shthreads.join_all();
+	query->executing = false;
+	if (query->onDone)
+		query->onDone();
 }
 
 //match all the triplets in a database
@@ -349,22 +401,32 @@ void PharmerQuery::thread_tripletMatch(PharmerQuery *query)
 	unsigned db = 0;
 	while (query->dbSearchQ.pop(db))
 	{
-		if (query->stopQuery)
+		//over the soft quota, keep what we have but don't start more work
+		if (query->stopSearch || query->memory.exceeded())
+		{
+			query->noteEarlyStop();
 			break;
+		}
 
 		PharmerDatabaseSearcher& pharmdb = *query->databases[db];
+		if (NumaTopology::enabled()) //search next to the stripe's memory
+			NumaTopology::get().runOn(pharmdb.getNumaNode());
 		vector<vector<QueryTriplet> > trips;
 		query->generateQueryTriplets(pharmdb, trips);
-		TripletMatchAllocator tmalloc(trips.size());
-		TripletMatches matches(tmalloc, query->params, trips.size(), 1);
+		TripletMatchAllocator tmalloc(trips.size(), &query->memory);
+		TripletMatches matches(tmalloc, query->params, trips.size(), 1,
+				LowMemoryMatching);
 
 		Timer t;
 		pharmdb.generateTripletMatches(trips, matches,
-				query->stopQuery);
+				query->stopSearch);
 		if (!Quiet)
 			cout << "PMTime " << t.elapsed() << "\n";
-		if (query->stopQuery)
+		if (query->stopSearch)
+		{
+			query->noteEarlyStop();
 			break;
+		}
 
 		if (!Quiet)
 		{
@@ -375,13 +437,15 @@ void PharmerQuery::thread_tripletMatch(PharmerQuery *query)
 
 		Timer ct;
 		Corresponder sponder(query->databases[db],
-				db, query->databases.size(),
+				db, query->numSources(),
 				query->points, trips, matches, query->coralloc, 0,
 				query->corrsQs[db], query->params, query->excluder,
-				query->stopQuery);
+				query->stopSearch);
 		sponder();
 		if (!Quiet)
 			cout << "CTime " << ct.elapsed() << "\n";
+		if (query->stopSearch)
+			query->noteEarlyStop();
 
 	}
 }
@@ -393,23 +457,50 @@ void PharmerQuery::thread_shapeMatch(PharmerQuery *query)
 	unsigned db = 0;
 	while (query->dbSearchQ.pop(db))
 	{
-		if (query->stopQuery)
+		if (query->stopSearch || query->memory.exceeded())
+		{
+			query->noteEarlyStop();
 			break;
+		}
 
 		PharmerDatabaseSearcher& pharmdb = *query->databases[db];
+		if (NumaTopology::enabled())
+			NumaTopology::get().runOn(pharmdb.getNumaNode());
 		MTQueue<CorrespondenceResult*>& corrQ =	query->corrsQs[db];
 		corrQ.addProducer();
 
-		ShapeResults shapes(query->databases[db], query->points, corrQ, query->coralloc, query->params, query->excluder, db, query->databases.size(), query->stopQuery);
-		pharmdb.generateShapeMatches(query->excluder, shapes);
+		ShapeResults shapes(query->databases[db], query->points, corrQ, query->coralloc, query->params, query->excluder, db, query->numSources(), query->stopSearch);
+		pharmdb.generateShapeMatches(*query->shapeTrees, shapes);
 		corrQ.removeProducer();
+		if (query->stopSearch)
+			query->noteEarlyStop();
 	}
 }
 
 
+//search a remote shard, its results go in the queue after the local databases
+//if the shard fails we keep whatever it sent
+void PharmerQuery::thread_remoteMatch(PharmerQuery *query, unsigned s)
+{
+	unsigned db = query->databases.size() + s;
+	MTQueue<CorrespondenceResult*>& corrQ = query->corrsQs[db];
+	corrQ.addProducer();
+	Timer t;
+	bool ok = query->shards[s]->search(query->shardQuery,
+			query->numQueryPoints(), query->coralloc, corrQ, db,
+			query->numSources(), query->stopSearch);
+	if (query->stopSearch)
+		query->noteEarlyStop();
+	if (!Quiet)
+		cout << query->shards[s]->getName() << (ok ? " RTime " : " failed ")
+				<< t.elapsed() << "\n";
+	corrQ.removeProducer();
+}
+
 //execute the query, if block is true then perform synchronously
 void PharmerQuery::execute(bool block)
 {
+	executing = true;
 	for (unsigned d = 0, nd = databases.size(); d < nd; d++)
 	{
 		if(databases[d]->isValid()) //fault tolerance
@@ -419,6 +510,8 @@ void PharmerQuery::execute(bool block)
 	if(params.isshape)
 	{
 		coralloc.setSize(0); //no actuall correspondances
+		if(!shapeTrees)
+			shapeTrees = excluder.getSearchTrees();
 		assert(shapeMatchThread == NULL);
 		shapeMatchThread = new boost::thread(thread_shapeMatches, this);
 
@@ -443,6 +536,35 @@ void PharmerQuery::execute(bool block)
 	}
 }
 
+//estimate the cost of executing this query, for pharmacophore queries
+//this is the expected number of triplet matches for the most selective triplet,
+//for shape queries the expected number of conformers passing the shape filter
+double PharmerQuery::estimateCost()
+{
+	double cost = 0;
+	for (unsigned d = 0, nd = databases.size(); d < nd; d++)
+	{
+		if(!databases[d]->isValid())
+			continue;
+		if(params.isshape)
+			cost += databases[d]->numConformations() * excluder.estimateSelectivity();
+		else
+			cost += databases[d]->estimateTripletCost(triplets);
+	}
+
+	//shards don't share their statistics, assume they are like the local stripes
+	unsigned long localconfs = 0, remoteconfs = 0;
+	for (unsigned d = 0, nd = databases.size(); d < nd; d++)
+		localconfs += databases[d]->numConformations();
+	for (unsigned s = 0, ns = shards.size(); s < ns; s++)
+		remoteconfs += shards[s]->numConformations();
+	if (params.isshape)
+		cost += remoteconfs * excluder.estimateSelectivity();
+	else if (localconfs > 0)
+		cost *= (localconfs + remoteconfs) / (double) localconfs;
+	return cost;
+}
+
 PharmerQuery::~PharmerQuery()
 {
 	checkThreads();
@@ -455,6 +577,7 @@ PharmerQuery::~PharmerQuery()
 void PharmerQuery::cancel()
 {
 	stopQuery = true;
+	stopSearch = true;
 	cancelSmina();
 }
 
@@ -469,6 +592,8 @@ void PharmerQuery::cancelSmina()
 
 bool PharmerQuery::threadsDone()
 {
+	if (queued)
+		return false; //hasn't even started
 	checkThreads();
 	return tripletMatchThread == NULL && shapeMatchThread == NULL;
 }
@@ -564,6 +689,11 @@ void PharmerQuery::reduceResults()
 			{
 				newr.push_back(results[i]);
 			}
+			else
+			{
+				results[i]->dropped = true;
+				removed.push_back(results[i]->seq);
+			}
 		}
 		swap(results, newr);
 	}
@@ -588,24 +718,51 @@ bool PharmerQuery::loadResults()
 		{
 			CorrespondenceResult *c = corrs[j];
 			currsort = SortType::Undefined;
-			results.push_back(
-					new (resalloc.alloc(sizeof(QueryResult))) QueryResult(c));
+			QueryResult *r = new (resalloc.alloc(sizeof(QueryResult))) QueryResult(
+					c, arrivals.size());
+			results.push_back(r);
+			arrivals.push_back(r);
 			newcnt++;
 		}
 	}
 
-	//filter and sort if we've seen something new
+	//filter and sort if we've seen something new, otherwise results are
+	//already reduced and truncated and there is nothing to do
+	if (newcnt == 0)
+		return moretoread;
+
 	sortResults(params.sort, params.reverseSort);
 	reduceResults();
 
 	if (params.maxHits != 0 && results.size() > params.maxHits)
 	{
+		for (unsigned i = params.maxHits, n = results.size(); i < n; i++)
+		{
+			results[i]->dropped = true;
+			removed.push_back(results[i]->seq);
+		}
 		results.resize(params.maxHits);
 	}
 
 	return moretoread;
 }
 
+bool PharmerQuery::drainResults(vector<CorrespondenceResult*>& out)
+{
+	access();
+	SpinLock lock(mutex);
+	checkThreads();
+	bool moretoread = !threadsDone();
+	out.clear();
+	for (unsigned i = 0, n = corrsQs.size(); i < n; i++)
+	{
+		vector<CorrespondenceResult*> corrs;
+		moretoread |= corrsQs[i].popAll(corrs);
+		out.insert(out.end(), corrs.begin(), corrs.end());
+	}
+	return moretoread;
+}
+
 //return all current results subject to data parameters
 //return true if results are still being produced
 bool PharmerQuery::getResults(const DataParameters& dp,
@@ -625,27 +782,52 @@ bool PharmerQuery::getResults(const DataParameters& dp,
 	unsigned end = dp.num == 0 ? results.size() : dp.num + dp.start;
 	for (unsigned i = dp.start, n = results.size(); i < n && i < end; i++)
 	{
-		if (dp.extraInfo)
-			setExtraInfo(*results[i]);
 		out.push_back(results[i]);
 	}
+	lock.release(); //names may have to be fetched from remote shards
+
+	if (dp.extraInfo)
+		setExtraInfo(out);
 
 	return notdone;
 }
 
-//if necessary, load extra info into r
-void PharmerQuery::setExtraInfo(QueryResult& r)
+//if necessary, load extra info into rs, fetching all the missing ones at once
+//must be called without the results lock, which is only held to find and
+//store the names, not while reading records (possibly from remote shards)
+//a name is never changed once it is set
+void PharmerQuery::setExtraInfo(const vector<QueryResult*>& rs)
 {
-	if (!r.name[0])
+	vector<QueryResult*> missing;
+	SpinLock lock(mutex);
+	for (unsigned i = 0, n = rs.size(); i < n; i++)
 	{
-		std::shared_ptr<PharmerDatabaseSearcher> db;
-		unsigned long loc = getLocation(&r, db);
+		if (!rs[i]->name[0])
+			missing.push_back(rs[i]);
+	}
+	lock.release();
+	if (missing.size() == 0)
+		return;
+
+	vector<MolSpan> spans;
+	vector<string> buffers;
+	getMolRecords(missing, spans, buffers);
 
-		//TODO: make this more efficient (don't need to unpack full mol)
-		MolData mdata;
-		PMolReaderSingleAlloc pread;
-		db->getMolData(loc, mdata, pread);
-		r.name = mdata.mol->getTitle();
+	//TODO: make this more efficient (don't need to unpack full mol)
+	MolData mdata;
+	PMolReaderSingleAlloc pread;
+	vector<string> names(missing.size());
+	for (unsigned i = 0, n = missing.size(); i < n; i++)
+	{
+		if (mdata.read(spans[i], pread))
+			names[i] = mdata.mol->getTitle();
+	}
+
+	lock.acquire();
+	for (unsigned i = 0, n = missing.size(); i < n; i++)
+	{
+		if (!missing[i]->name[0]) //another poller may have beaten us
+			missing[i]->name.swap(names[i]);
 	}
 }
 
@@ -738,6 +920,8 @@ void PharmerQuery::setDataJSON(const DataParameters& dp, Json::Value& data)
 	data["recordsTotal"] = (unsigned) results.size();
 	data["recordsFiltered"] = (unsigned) results.size();
 	data["finished"] = !notdone;
+	if (truncated) //a search thread stopped early for memory
+		data["truncated"] = true;
 	data["data"].resize(0); //make empty array
 
 	if(!notdone && numactives > 0)
@@ -766,20 +950,160 @@ void PharmerQuery::setDataJSON(const DataParameters& dp, Json::Value& data)
 	}
 }
 
+//incremental alternative to setDataJSON for polling clients
+//cursor is "added.removed", the number of arrivals and removals the client
+//has already seen; only results that arrived since then and are still
+//present, and the seqs removed since then, are returned, in columns
+//an unchanged result set costs no more than checking the queues
+//values are never modified once a result arrives, so the client can rank
+//the columns itself with the same sort keys
+void PharmerQuery::setDeltaJSON(const string& cursor, Json::Value& data)
+{
+	unsigned long sinceAdded = 0, sinceRemoved = 0;
+	sscanf(cursor.c_str(), "%lu.%lu", &sinceAdded, &sinceRemoved);
+
+	bool notdone = loadResults();
+
+	SpinLock lock(mutex);
+	unsigned long nadded = arrivals.size();
+	unsigned long nremoved = removed.size();
+
+	data["cursor"] = lexical_cast<string>(nadded) + "."
+			+ lexical_cast<string>(nremoved);
+	data["finished"] = !notdone;
+	data["total"] = (unsigned) results.size();
+	if (truncated) //a search thread stopped early for memory
+		data["truncated"] = true;
+
+	if (sinceAdded == nadded && sinceRemoved == nremoved)
+	{
+		data["unchanged"] = true;
+		lock.release();
+		if (!notdone && numactives > 0)
+			setBenchmarkJSON(data);
+		return;
+	}
+
+	if (sinceAdded > nadded || sinceRemoved > nremoved)
+	{
+		//not a cursor for this query, resend everything
+		data["reset"] = true;
+		sinceAdded = sinceRemoved = 0;
+	}
+
+	vector<QueryResult*> fresh;
+	fresh.reserve(nadded - sinceAdded);
+	for (unsigned long i = sinceAdded; i < nadded; i++)
+	{
+		if (!arrivals[i]->dropped)
+			fresh.push_back(arrivals[i]);
+	}
+	lock.release();
+	setExtraInfo(fresh);
+	lock.acquire();
+
+	Json::Value& ids = data["ids"];
+	Json::Value& names = data["names"];
+	Json::Value& vals = data["vals"];
+	Json::Value& weights = data["weights"];
+	Json::Value& rbnds = data["rbnds"];
+	ids.resize(fresh.size());
+	names.resize(fresh.size());
+	vals.resize(fresh.size());
+	weights.resize(fresh.size());
+	rbnds.resize(fresh.size());
+	for (unsigned i = 0, n = fresh.size(); i < n; i++)
+	{
+		ids[i] = fresh[i]->seq;
+		names[i] = fresh[i]->name;
+		vals[i] = fresh[i]->c->val;
+		weights[i] = fresh[i]->c->weight;
+		rbnds[i] = fresh[i]->c->nRBnds;
+	}
+
+	//removals of results the client never saw are not interesting
+	Json::Value& gone = data["removed"];
+	gone.resize(0);
+	for (unsigned long i = sinceRemoved; i < nremoved; i++)
+	{
+		if (removed[i] < sinceAdded)
+			gone.append(removed[i]);
+	}
+	lock.release();
+
+	if (!notdone && numactives > 0)
+		setBenchmarkJSON(data);
+}
+
+//benchmark statistics over all results, which needs every name
+void PharmerQuery::setBenchmarkJSON(Json::Value& data)
+{
+	vector<QueryResult*> all;
+	DataParameters allparam;
+	allparam.extraInfo = true;
+	getResults(allparam, all);
+	computeBenchmarkStats(all, data["benchmark"]);
+}
+
 static bool locationCompare(const QueryResult* lhs, const QueryResult* rhs)
 {
 	return lhs->c->location < rhs->c->location;
 }
 
-unsigned long PharmerQuery::getLocation(const QueryResult* r,
-		std::shared_ptr<PharmerDatabaseSearcher>& db)
+//read the molecule of r from its database or shard
+bool PharmerQuery::getMolData(const QueryResult* r, MolData& mdata,
+		PMolReader& reader)
 {
-	unsigned dbid = r->c->location % databases.size();
-	unsigned long loc = r->c->location / databases.size();
-	db = databases[dbid];
-	return loc;
+	unsigned dbid = r->c->location % numSources();
+	unsigned long loc = r->c->location / numSources();
+	if (dbid < databases.size())
+		return databases[dbid]->getMolData(loc, mdata, reader);
+
+	vector<unsigned char> record;
+	if (!shards[dbid - databases.size()]->getMolRecord(loc, record))
+		return false;
+	return mdata.read(&record[0], 0, reader);
 }
 
+//spans of the records of rs, grouped by source so each database is read in
+//location order and each shard is asked once; remote records are kept in buffers
+void PharmerQuery::getMolRecords(const vector<QueryResult*>& rs,
+		vector<MolSpan>& spans, vector<string>& buffers)
+{
+	unsigned nsrc = numSources();
+	vector<vector<pair<unsigned long, unsigned> > > bysrc(nsrc);
+	for (unsigned i = 0, n = rs.size(); i < n; i++)
+	{
+		unsigned long location = rs[i]->c->location;
+		bysrc[location % nsrc].push_back(make_pair(location / nsrc, i));
+	}
+
+	spans.assign(rs.size(), MolSpan());
+	buffers.resize(shards.size());
+	vector<unsigned long> locs;
+	vector<MolSpan> srcspans;
+	for (unsigned d = 0; d < nsrc; d++)
+	{
+		if (bysrc[d].size() == 0)
+			continue;
+		sort(bysrc[d].begin(), bysrc[d].end());
+		locs.resize(bysrc[d].size());
+		for (unsigned i = 0, n = locs.size(); i < n; i++)
+			locs[i] = bysrc[d][i].first;
+
+		if (d < databases.size())
+			databases[d]->getMolRecords(locs, srcspans);
+		else
+			shards[d - databases.size()]->getMolRecords(locs, srcspans,
+					buffers[d - databases.size()]);
+
+		for (unsigned i = 0, n = locs.size(); i < n; i++)
+			spans[bysrc[d][i].second] = srcspans[i];
+	}
+}
+
+#define OUTPUT_BATCH (1024) //results fetched at once when writing everything
+
 //write out all results in sdf format - NOT sorted
 void PharmerQuery::outputMols(ostream& out)
 {
@@ -796,18 +1120,25 @@ void PharmerQuery::outputMols(ostream& out)
 	const char* dataname = "rmsd";
 	if(params.isshape) dataname = "sim";
 
-	for (unsigned i = 0, n = myres.size(); i < n && out; i++)
+	vector<QueryResult*> batch;
+	vector<MolSpan> spans;
+	vector<string> buffers;
+	for (unsigned start = 0, n = myres.size(); start < n && out; start += OUTPUT_BATCH)
 	{
 		access();
-		std::shared_ptr<PharmerDatabaseSearcher> db;
-		unsigned long loc = getLocation(myres[i], db);
+		batch.assign(myres.begin() + start,
+				myres.begin() + min(n, start + OUTPUT_BATCH));
+		getMolRecords(batch, spans, buffers);
 
-		sddata.clear();
-		sddata.push_back(
-				ASDDataItem(dataname, lexical_cast<string>(myres[i]->c->val)));
+		for (unsigned i = 0, nb = batch.size(); i < nb && out; i++)
+		{
+			sddata.clear();
+			sddata.push_back(
+					ASDDataItem(dataname, lexical_cast<string>(batch[i]->c->val)));
 
-		db->getMolData(loc, mdata, pread);
-		mdata.mol->writeSDF(out, sddata, myres[i]->c->rmsd);
+			if (mdata.read(spans[i], pread))
+				mdata.mol->writeSDF(out, sddata, batch[i]->c->rmsd);
+		}
 	}
 }
 
@@ -823,10 +1154,8 @@ void PharmerQuery::outputMol(const QueryResult* mol, ostream& out,
 	if(params.isshape) dataname = "sim";
 	sddata.push_back(ASDDataItem(dataname, lexical_cast<string>(mol->c->val)));
 
-	std::shared_ptr<PharmerDatabaseSearcher> db;
-	unsigned long loc = getLocation(mol, db);
-
-	db->getMolData(loc, mdata, pread);
+	if (!getMolData(mol, mdata, pread))
+		return;
 
 //TODO: minimization if requested - openbabel isn't quite where I want it yet..
 	mdata.mol->writeSDF(out, sddata, mol->c->rmsd);
@@ -848,6 +1177,19 @@ void PharmerQuery::outputMol(unsigned index, ostream& out, bool jsonHeader,
 	outputMol(m, out, minimize);
 }
 
+//output single mol in sdf format, identified by its arrival seq
+void PharmerQuery::outputMolBySeq(unsigned seq, ostream& out, bool minimize)
+{
+	access();
+	SpinLock lock(mutex);
+	if (seq >= arrivals.size())
+		return;
+	QueryResult *m = arrivals[seq];
+	lock.release();
+
+	outputMol(m, out, minimize);
+}
+
 void PharmerQuery::print(ostream& out) const
 		{
 	Json::Value root;
@@ -921,8 +1263,118 @@ bool PharmerQuery::inRange(unsigned i, unsigned j, unsigned p, double minip,
 	return trip.inRange(box);
 }
 
-//send smina data, for now do this single threaded - if its a bottleneck
-//we can multithread
+#define SMINA_BATCH_SIZE (256)
+#define SMINA_MAX_INFLIGHT (32)
+
+//a batch of consecutive results ready to be sent to the minimization server
+struct SminaBatch
+{
+	string transforms; //gzipped transforms, concatenated
+	vector<unsigned> ends; //end of each transform within transforms
+	bool ready;
+
+	SminaBatch(): ready(false) {}
+};
+
+//shared state of the smina sending pipeline, everything below batches
+//is protected by lock and changes are signaled on changed
+struct SminaSender
+{
+	const vector<QueryResult*>& results;
+	vector<SminaBatch> batches;
+	boost::mutex lock;
+	boost::condition_variable changed;
+	unsigned nextBatch; //next batch to compress
+	unsigned written; //number of batches sent
+	bool abort;
+
+	SminaSender(const vector<QueryResult*>& r) :
+			results(r),
+					batches((r.size() + SMINA_BATCH_SIZE - 1) / SMINA_BATCH_SIZE),
+					nextBatch(0), written(0), abort(false)
+	{
+	}
+
+	void stop()
+	{
+		boost::unique_lock<boost::mutex> L(lock);
+		abort = true;
+		changed.notify_all();
+	}
+};
+
+//make sure the compressors are stopped and joined before the sender they
+//reference goes away, even if writing throws
+struct SminaCompressorsGuard
+{
+	SminaSender& sender;
+	thread_group& compressors;
+
+	SminaCompressorsGuard(SminaSender& s, thread_group& c) :
+			sender(s), compressors(c)
+	{
+	}
+
+	~SminaCompressorsGuard()
+	{
+		sender.stop();
+		compressors.join_all();
+	}
+};
+
+//gzip the transformation of r onto the end of out
+static void compressSminaTransform(const QueryResult *r, string& out)
+{
+	iostreams::filtering_stream<iostreams::output> filter;
+	filter.push(iostreams::gzip_compressor());
+	filter.push(iostreams::back_inserter(out));
+	Matrix3d rotmat = r->c->rmsd.rotationMatrix().cast<double>();
+	Vector3d trans = r->c->rmsd.translationVector().cast<double>();
+
+	//smina expects things in row major order..
+	rotmat.transposeInPlace();
+
+	filter.write((char*) rotmat.data(), sizeof(double) * 9);
+	filter.write((char*) trans.data(), sizeof(double) * 3);
+	filter.reset(); //closing the chain writes the gzip footer
+}
+
+//compress transforms a batch at a time, but never get too far ahead of
+//the writer so memory stays bounded on huge result sets
+static void thread_compressSmina(SminaSender *sender)
+{
+	unsigned nb = sender->batches.size();
+	while (true)
+	{
+		unsigned b = 0;
+		{
+			boost::unique_lock<boost::mutex> L(sender->lock);
+			b = sender->nextBatch++;
+			while (b < nb && b >= sender->written + SMINA_MAX_INFLIGHT
+					&& !sender->abort)
+				sender->changed.wait(L);
+			if (b >= nb || sender->abort)
+				break;
+		}
+
+		SminaBatch& batch = sender->batches[b];
+		for (unsigned i = b * SMINA_BATCH_SIZE, n = min(
+				(unsigned) sender->results.size(), i + SMINA_BATCH_SIZE);
+				i < n; i++)
+		{
+			compressSminaTransform(sender->results[i], batch.transforms);
+			batch.ends.push_back(batch.transforms.size());
+		}
+
+		boost::unique_lock<boost::mutex> L(sender->lock);
+		batch.ready = true;
+		sender->changed.notify_all();
+	}
+}
+
+//send smina data in three stages: bulk lookup of the smina locations,
+//parallel compression of the transforms, and a single writer that sends
+//everything in order as soon as it is available
 void PharmerQuery::thread_sendSmina(PharmerQuery *query, stream_ptr out,
 		unsigned max)
 {
@@ -934,6 +1386,21 @@ void PharmerQuery::thread_sendSmina(PharmerQuery *query, stream_ptr out,
 	try
 	{
 
+		//smina data of remote shards isn't available, only minimize local hits
+		unsigned ndb = query->databases.size();
+		unsigned nsrc = query->numSources();
+		if (nsrc > ndb)
+		{
+			vector<QueryResult*> local;
+			local.reserve(rescopy.size());
+			for (unsigned i = 0, n = rescopy.size(); i < n; i++)
+			{
+				if (rescopy[i]->c->location % nsrc < ndb)
+					local.push_back(rescopy[i]);
+			}
+			rescopy.swap(local);
+		}
+
 		//limit number of results
 		if (max > 0 && rescopy.size() > max)
 			rescopy.resize(max);
@@ -941,37 +1408,70 @@ void PharmerQuery::thread_sendSmina(PharmerQuery *query, stream_ptr out,
 		//sort by location for sequential access
 		sort(rescopy.begin(), rescopy.end(), locationCompare);
 
-		PMolReaderSingleAlloc pread;
-		MolData mdata;
+		//bulk lookup of smina data, the sort means each database's
+		//locations are also sorted
+		vector<vector<unsigned long> > mollocs(ndb);
+		vector<vector<unsigned> > resindex(ndb);
+		for (unsigned i = 0, n = rescopy.size(); i < n; i++)
+		{
+			unsigned dbid = rescopy[i]->c->location % nsrc;
+			mollocs[dbid].push_back(rescopy[i]->c->location / nsrc);
+			resindex[dbid].push_back(i);
+		}
+
+		vector<MolSpan> sminaspans(rescopy.size());
+		vector<MolSpan> dbspans;
+		for (unsigned d = 0; d < ndb; d++)
+		{
+			if (mollocs[d].size() == 0)
+				continue;
+			query->databases[d]->getSminaRecords(mollocs[d], dbspans);
+			for (unsigned i = 0, n = dbspans.size(); i < n; i++)
+				sminaspans[resindex[d][i]] = dbspans[i];
+		}
+
+		SminaSender sender(rescopy);
+		thread_group compressors;
+		SminaCompressorsGuard guard(sender, compressors);
+		unsigned nthreads = std::max(1u,
+				std::min(boost::thread::hardware_concurrency(),
+						(unsigned) sender.batches.size()));
+		for (unsigned t = 0; t < nthreads; t++)
+		{
+			compressors.add_thread(
+					new boost::thread(thread_compressSmina, &sender));
+		}
 
-		for (unsigned i = 0, n = rescopy.size(); i < n && *out; i++)
+		for (unsigned b = 0, nb = sender.batches.size(); b < nb && *out;
+				b++)
 		{
+			SminaBatch& batch = sender.batches[b];
+			{
+				boost::unique_lock<boost::mutex> L(sender.lock);
+				while (!batch.ready)
+					sender.changed.wait(L);
+			}
+
 			query->access();
-			QueryResult *r = rescopy[i];
-			std::shared_ptr<PharmerDatabaseSearcher> db;
-			unsigned long loc = query->getLocation(r, db);
-
-			//extract and zip rmsd transform
-			stringstream str; //need to gzip rotation info
-			iostreams::filtering_stream<iostreams::output> filter;
-			filter.push(iostreams::gzip_compressor());
-			filter.push(str);
-			Matrix3d rotmat = r->c->rmsd.rotationMatrix().cast<double>();
-			Vector3d trans = r->c->rmsd.translationVector().cast<double>();
-
-			//smina expects things in row major order..
-			rotmat.transposeInPlace();
-
-			filter.write((char*) rotmat.data(), sizeof(double) * 9);
-			filter.write((char*) trans.data(), sizeof(double) * 3);
-			filter.flush();
-			filter.pop();
-			filter.pop();
-
-			out->write(str.str().c_str(), str.str().length());
-			db->getSminaData(loc, *out);
+			unsigned start = 0;
+			for (unsigned i = 0, n = batch.ends.size(); i < n && *out; i++)
+			{
+				unsigned r = b * SMINA_BATCH_SIZE + i;
+				out->write(batch.transforms.data() + start,
+						batch.ends[i] - start);
+				start = batch.ends[i];
+
+				out->write((const char*) sminaspans[r].data, sminaspans[r].size);
+			}
+			//free memory before letting compressors move ahead
+			string().swap(batch.transforms);
+			vector<unsigned>().swap(batch.ends);
 
+			boost::unique_lock<boost::mutex> L(sender.lock);
+			sender.written = b + 1;
+			sender.changed.notify_all();
 		}
+		//guard stops the compressors in case the writer stopped early
 	} catch (...) //don't let exceptions mess up usecnt or crash server
 	{
 	  std::cerr << "Exception in sendsmina\n";
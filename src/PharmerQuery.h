@@ -28,10 +28,13 @@ See the LICENSE file provided with the distribution for more information.
 #define PHARMITSERVER_PHARMERQUERY_H_
 
 #include "cors.h"
+#include "MemoryAccountant.h"
 #include <iostream>
 #include <ctime>
 #include <vector>
+#include <atomic>
 #include <boost/thread.hpp>
+#include <boost/function.hpp>
 #include <boost/asio.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <boost/unordered_set.hpp>
@@ -55,11 +58,14 @@ struct QueryResult
 	//extras; optional
 	string name;
 
-	QueryResult() : c(NULL)
+	unsigned seq; //order of arrival, a stable id for incremental delivery
+	bool dropped; //removed from results by reduction or max hits
+
+	QueryResult() : c(NULL), seq(0), dropped(false)
 	{
 	}
 
-	QueryResult(const CorrespondenceResult *c): c(c)
+	QueryResult(const CorrespondenceResult *c, unsigned s): c(c), seq(s), dropped(false)
 	{
 	}
 };
@@ -71,15 +77,23 @@ class PharmerQuery
 {
 	string errorStr;
 	vector< std::shared_ptr<PharmerDatabaseSearcher> > databases;
+	vector< std::shared_ptr<RemoteShard> > shards; //searched after databases
+	string shardQuery; //json query sent to shards
 
 	vector<PharmaPoint> points;
 	vector<QueryTriplet> triplets; //all n^3 triangles
 	boost::multi_array<unsigned, 3> tripIndex; //for any (i,j,k), the index of the corresponding triplet
 	QueryParameters params;
 	ShapeConstraints excluder;
+	std::shared_ptr<const ShapeSearchTrees> shapeTrees; //built once, shared by all stripes
 
 	bool valid;
 	bool stopQuery;
+	bool stopSearch; //search threads should wrap up: cancelled or out of memory
+	std::atomic<bool> queued; //waiting for admission, not yet executed
+	std::atomic<bool> executing; //search threads are running
+	std::atomic<bool> truncated; //a search thread gave up work because of the memory quota
+	boost::function<void()> onDone; //called by the search thread when it stops executing
 
 	boost::thread *tripletMatchThread; //performs triplet matching
 	boost::thread *shapeMatchThread; //performs shape matching
@@ -87,10 +101,13 @@ class PharmerQuery
 
 	MTQueue<unsigned> dbSearchQ;
 
+	MemoryAccountant memory; //must outlive the allocators that report to it
 	CorAllocator coralloc;
 	vector<MTQueue<CorrespondenceResult*> > corrsQs;
 	BumpAllocator<1024*1024> resalloc;
 	vector<QueryResult*> results;
+	vector<QueryResult*> arrivals; //every result ever loaded, indexed by seq
+	vector<unsigned> removed; //seqs dropped from results, in order of removal
 	SortTyp currsort;
 	bool currrev;
 
@@ -113,25 +130,34 @@ class PharmerQuery
 
 	static void thread_shapeMatches(PharmerQuery *query);
 	static void thread_shapeMatch(PharmerQuery *query);
+	static void thread_remoteMatch(PharmerQuery *query, unsigned s);
 
 	void generateQueryTriplets(PharmerDatabaseSearcher& pharmdb, vector<vector<
 			QueryTriplet> >& trips);
 	bool loadResults();
+	//record that a search thread stopped early, cancellation isn't truncation
+	void noteEarlyStop() { if (!stopQuery) truncated = true; }
 	void checkThreads();
 	bool threadsDone();
 
-	void setExtraInfo(QueryResult& r);
+	void setExtraInfo(const vector<QueryResult*>& rs);
 
 	void initializeTriplets();
+	void initializeMemory();
 
 	void sortResults(SortTyp srt, bool reverse);
 	void reduceResults();
 
-	unsigned long getLocation(const QueryResult* r,std::shared_ptr<PharmerDatabaseSearcher>& db);
+	//databases and shards; locations are interleaved across all of them
+	unsigned numSources() const { return databases.size() + shards.size(); }
+	bool getMolData(const QueryResult* r, MolData& mdata, PMolReader& reader);
+	void getMolRecords(const vector<QueryResult*>& rs, vector<MolSpan>& spans,
+			vector<string>& buffers);
 
 	static void thread_sendSmina(PharmerQuery *query, stream_ptr out, unsigned max);
 
 	void computeBenchmarkStats(const vector<QueryResult*>& r, Json::Value& stat);
+	void setBenchmarkJSON(Json::Value& data);
 public:
 	//input stream and format specified as extension
 	PharmerQuery(const vector< std::shared_ptr<PharmerDatabaseSearcher> > & dbs,
@@ -139,9 +165,12 @@ public:
 					QueryParameters(), unsigned nth =
 					boost::thread::hardware_concurrency());
 
+	//remote shards are searched with sq, the json form of the query
 	PharmerQuery(const vector< std::shared_ptr<PharmerDatabaseSearcher> > & dbs,
 			const vector<PharmaPoint>& pts, const QueryParameters& qp =
-					QueryParameters(), const ShapeConstraints& ex = ShapeConstraints(), unsigned nth = 1);
+					QueryParameters(), const ShapeConstraints& ex = ShapeConstraints(), unsigned nth = 1,
+					const vector< std::shared_ptr<RemoteShard> >& sh =
+							vector< std::shared_ptr<RemoteShard> >(), const string& sq = "");
 
 	virtual ~PharmerQuery();
 
@@ -153,10 +182,22 @@ public:
 
 	void execute(bool block = true);
 
+	//estimate the work execute will do from the databases' statistics
+	double estimateCost();
+
+	void setQueued(bool q) { queued = q; }
+	bool isQueued() const { return queued; }
+	bool isExecuting() const { return executing; }
+	void setDoneCallback(const boost::function<void()>& f) { onDone = f; }
+
 	//all of the result/output functions can be called while an asynchronous
 	//query is running
 
 	unsigned numResults() { loadResults(); return results.size(); }
+	//move all new raw correspondences into out without filtering them into
+	//results (for shard servers), return true if more are expected
+	bool drainResults(vector<CorrespondenceResult*>& out);
+	unsigned numQueryPoints() const { return params.isshape ? 0 : points.size(); }
 	//return all current results
 	bool getResults(const DataParameters& dp, vector<QueryResult*>& out);
 	//output text result of query (correspondences)
@@ -164,11 +205,13 @@ public:
 			false);
 	//output data in datatables json format
 	void setDataJSON(const DataParameters& dp, Json::Value& data);
+	void setDeltaJSON(const string& cursor, Json::Value& data);
 	//write out all results in sdf format - NOT sorted
 	void outputMols(ostream& out);
 	//output single mol in sdf format
 	void outputMol(const QueryResult* mol, ostream& out, bool minimize = false);
 	void outputMol(unsigned index, ostream& out, bool jsonHeader, bool minimize = false);
+	void outputMolBySeq(unsigned seq, ostream& out, bool minimize = false);
 
 	void cancelSmina(); //cancel just min
 	//attempt to cancel, non-blocking, query neest time to wrap up
@@ -179,7 +222,13 @@ public:
 	{
 		lastAccessed = time(NULL);
 		stopQuery = false;
+		stopSearch = memory.overHardLimit();
 	}
+
+	//bytes currently held by the query's allocators
+	unsigned long memoryUsed() const { return memory.used(); }
+	//true if results were truncated because of the memory quota
+	bool overMemoryQuota() const { return truncated; }
 	const time_t idle()
 	{
 		return time(NULL) - lastAccessed;
@@ -26,6 +26,7 @@ See the LICENSE file provided with the distribution for more information.
 #include <cgicc/CgiEnvironment.h>
 
 #include "cgi.h"
+#include "FCGIEventServer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -49,6 +50,7 @@ See the LICENSE file provided with the distribution for more information.
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
 #include <algorithm>
 #include <json/json.h>
 #include <boost/date_time.hpp>
@@ -88,6 +90,20 @@ static boost::unordered_map<string, QueryParser*> parsers = assign::map_list_of
 		(".ph4", (QueryParser*) &ph4Parser)
 		(".pml", (QueryParser*) &pmlParser);
 
+//admission control; costs are estimated numbers of triplet (or conformer)
+//matches that will have to be examined
+cl::opt<double> MaxQueryCost("max-query-cost",
+		cl::desc("Total estimated cost of concurrently executing queries before new queries are queued"),
+		cl::init(2e9));
+cl::opt<double> InteractiveQueryCost("interactive-query-cost",
+		cl::desc("Queries estimated to cost less than this are always executed immediately"),
+		cl::init(1e7));
+cl::opt<double> MaxQueryMemory("max-query-memory",
+		cl::desc("Allocated memory (GB) above which expensive queries are queued, 0 for no limit"),
+		cl::init(0));
+
+#define QUEUE_AGING (30.0) //seconds of waiting that halve the priority cost of a queued query
+
 /*
  * open_listenfd - open and return a listening socket on port
  *     Returns -1 and sets errno on Unix error.
@@ -124,52 +140,58 @@ int open_listenfd(int port)
 }
 
 
-static void server_thread(unsigned listenfd, boost::unordered_map<string, std::shared_ptr<Command> >& commands)
+//respond to a single request that has been completely read in by the event server
+static void handle_request(const FCGIRequest& req, ostream& out,
+		boost::unordered_map<string, std::shared_ptr<Command> >& commands)
 {
-	FCGX_Request request;
-	FCGX_InitRequest(&request, listenfd, 0);
-
-	while (FCGX_Accept_r(&request) == 0)
+	try
 	{
-		try
+		Timer time;
+		FastCgiIO IO(out.rdbuf(), req.env, req.in);
+
+		Cgicc CGI(&IO);
+		//handle the cmd
+		string cmdname = cgiGetString(CGI, "cmd");
+		transform(cmdname.begin(), cmdname.end(), cmdname.begin(), ::tolower);
+		if (commands.count(cmdname) == 0)
 		{
-			Timer time;
-			FastCgiIO IO(request);
-
-			Cgicc CGI(&IO);
-			//handle the cmd
-			string cmdname = cgiGetString(CGI, "cmd");
-			transform(cmdname.begin(), cmdname.end(), cmdname.begin(), ::tolower);
-			if (commands.count(cmdname) == 0)
-			{
-				IO << HTTPResponseHeader("HTTP/1.1", 433,
-						"Invalid query syntax.  Invalid command.");
-			}
-			else
-			{
-				commands[cmdname]->execute(CGI, IO);
-
-				if (!Quiet && !commands[cmdname]->isFrequent())
-				{
-					cout << "Finished processing query: " << cgiGetString(CGI,
-							"cmd") << " in " << time.elapsed() << "s ("
-							<< time.elapsedUser() << "s) ";
-					posix_time::ptime now(
-							posix_time::second_clock::local_time());
-					cout << " at " << posix_time::to_simple_string(now) << "\n";
-				}
-			}
+			IO << HTTPResponseHeader("HTTP/1.1", 433,
+					"Invalid query syntax.  Invalid command.");
 		}
-		catch (const std::exception& e)
+		else
 		{
-			// handle error condition
-			cout << "Exception thrown " << e.what();
-		}
+			commands[cmdname]->execute(CGI, IO);
 
-		FCGX_Finish_r(&request);
+			if (!Quiet && !commands[cmdname]->isFrequent())
+			{
+				cout << "Finished processing query: " << cgiGetString(CGI,
+						"cmd") << " in " << time.elapsed() << "s ("
+						<< time.elapsedUser() << "s) ";
+				posix_time::ptime now(
+						posix_time::second_clock::local_time());
+				cout << " at " << posix_time::to_simple_string(now) << "\n";
+			}
+		}
+		IO.flush();
+	}
+	catch (const std::exception& e)
+	{
+		// handle error condition
+		cout << "Exception thrown " << e.what();
 	}
 }
 
+//frequent, cheap commands (status polls) are serviced ahead of everything else
+static bool is_priority_request(const FCGIRequest& req,
+		boost::unordered_map<string, std::shared_ptr<Command> >& commands)
+{
+	string cmdname = req.getFormValue("cmd");
+	transform(cmdname.begin(), cmdname.end(), cmdname.begin(), ::tolower);
+	boost::unordered_map<string, std::shared_ptr<Command> >::iterator itr =
+			commands.find(cmdname);
+	return itr != commands.end() && itr->second->isFrequent();
+}
+
 
 static WebQueryManager *queriesptr = NULL;
 static void signalhandler(int sig)
@@ -205,7 +227,30 @@ void pharmer_server(unsigned port, const vector<boost::filesystem::path>& prefix
 		exit(-1);
 	}
 	//these all better be the same...
-	const Pharmas *pharmas = &databases.begin()->second.stripes.back()->getPharmas();
+	static Pharmas defaultPharmas(defaultPharmaVec);
+	const Pharmas *pharmas = NULL;
+	for (boost::unordered_map<string, StripedSearchers>::iterator itr = databases.begin(); itr != databases.end(); ++itr)
+	{
+		if (itr->second.stripes.size() > 0)
+		{
+			pharmas = &itr->second.stripes.back()->getPharmas();
+			break;
+		}
+	}
+	//only have remote shards, parse queries with their features
+	for (boost::unordered_map<string, StripedSearchers>::iterator itr = databases.begin(); itr != databases.end() && pharmas == NULL; ++itr)
+	{
+		for (unsigned s = 0, ns = itr->second.shards.size(); s < ns; s++)
+		{
+			if (itr->second.shards[s]->getPharmas())
+			{
+				pharmas = itr->second.shards[s]->getPharmas();
+				break;
+			}
+		}
+	}
+	if (pharmas == NULL) //shards too old to say
+		pharmas = &defaultPharmas;
 
 	logdirpath = filesystem::path(logdir);
 	OBConversion conv; //load plugins
@@ -222,8 +267,6 @@ void pharmer_server(unsigned port, const vector<boost::filesystem::path>& prefix
 	WebQueryManager queries(databases, prefixpaths);
 	queriesptr = &queries; //for signal handler
 
-	FCGX_Init();
-
 	int listenfd = open_listenfd(port);
 	if (listenfd < 0)
 	{
@@ -255,10 +298,12 @@ void pharmer_server(unsigned port, const vector<boost::filesystem::path>& prefix
 					("savesmina", std::shared_ptr<Command>(new SaveSmina(LOG, logmutex, queries, minServer, minPort)));
 
 
-	for (unsigned i = 0; i < SERVERTHREADS; i++)
-	{
-		boost::thread server(server_thread, listenfd, boost::ref(commands));
-	}
+	//a single event thread handles all the connections, command execution
+	//is done by a fixed pool of workers
+	FCGIEventServer eventserver(listenfd, SERVERTHREADS,
+			boost::bind(handle_request, boost::placeholders::_1, boost::placeholders::_2, boost::ref(commands)),
+			boost::bind(is_priority_request, boost::placeholders::_1, boost::ref(commands)));
+	boost::thread server(boost::bind(&FCGIEventServer::run, &eventserver));
 
 	{
 		//startup message
@@ -378,6 +423,19 @@ unsigned WebQueryManager::add(const Pharmas& pharmas, Json::Value& data,
 	totalMols = searchers->totalMols;
 	totalConfs = searchers->totalConfs;
 
+	//shards are sent the query as the client gave it
+	string shardquery;
+	if(searchers->shards.size() > 0)
+	{
+		Json::FastWriter writer;
+		shardquery = writer.write(data);
+	}
+
+	//construct and cost the query before taking the global lock
+	PharmerQuery *query = new PharmerQuery(dbs, queryPoints, qp, excluder, numslices, searchers->shards, shardquery);
+	bool valid = query->isValid(msg);
+	double cost = valid ? query->estimateCost() : 0;
+
 	boost::unique_lock<boost::mutex> L(lock);
 
 	if (oldqid > 0 && queries.count(oldqid) > 0)
@@ -392,14 +450,160 @@ unsigned WebQueryManager::add(const Pharmas& pharmas, Json::Value& data,
 		}
 	}
 	unsigned id = nextID++;
-	queries[id] = new PharmerQuery(dbs, queryPoints, qp, excluder, numslices);
-	if(!queries[id]->isValid(msg)) return 0;
-	L.unlock();
+	queries[id] = query;
+	if(!valid) return 0;
 
-	queries[id]->execute(false); //don't wait for result
+	//decide whether to run now or wait for resources
+	schedule();
+	if(canAdmit(cost))
+	{
+		admit(id, cost);
+	}
+	else
+	{
+		query->setQueued(true);
+		queued.push_back(QueuedQuery(id, cost));
+		if(!Quiet)
+			cout << "Queued query " << id << " cost " << cost << " position " << queuePosition(id, time(NULL)) << "\n";
+	}
 	return id;
 }
 
+//return true if a query of the provided cost can run now, lock must be held
+bool WebQueryManager::canAdmit(double cost) const
+{
+	if(running.size() == 0) //always make progress
+		return true;
+	if(cost <= InteractiveQueryCost) //keep small queries interactive
+		return true;
+	if(MaxQueryMemory > 0)
+	{
+		size_t mem = 0;
+		MallocExtension::instance()->GetNumericProperty(
+				"generic.current_allocated_bytes", &mem);
+		if(mem > MaxQueryMemory * 1024.0 * 1024 * 1024)
+			return false;
+	}
+	return runningCost + cost <= MaxQueryCost;
+}
+
+//start executing qid, lock must be held
+void WebQueryManager::admit(unsigned qid, double cost)
+{
+	PharmerQuery *q = queries[qid];
+	q->setQueued(false);
+	running[qid] = cost;
+	runningCost += cost;
+	//free up the budget as soon as the search finishes, not when next polled
+	q->setDoneCallback(boost::bind(&WebQueryManager::queryDone, this));
+	q->execute(false); //don't wait for result
+}
+
+//called from a query's search thread when it finishes or is cancelled
+void WebQueryManager::queryDone()
+{
+	boost::unique_lock<boost::mutex> L(lock);
+	schedule();
+}
+
+//cheapest first, but age queries so expensive ones aren't starved
+double WebQueryManager::QueuedQuery::priority(time_t now) const
+{
+	return cost / (1.0 + (now - queuedAt) / QUEUE_AGING);
+}
+
+//retire finished queries and start queued queries that now fit in the budget
+//lock must be held
+void WebQueryManager::schedule()
+{
+	for (boost::unordered_map<unsigned, double>::iterator itr = running.begin(); itr != running.end(); )
+	{
+		if(queries.count(itr->first) == 0 || !queries[itr->first]->isExecuting())
+		{
+			runningCost -= itr->second;
+			itr = running.erase(itr);
+		}
+		else
+			++itr;
+	}
+	if(running.size() == 0)
+		runningCost = 0; //don't accumulate rounding error
+
+	//cancelled queries never get to run
+	vector<QueuedQuery> waiting;
+	waiting.reserve(queued.size());
+	for(unsigned i = 0, n = queued.size(); i < n; i++)
+	{
+		if(queries.count(queued[i].qid) == 0)
+			continue;
+		PharmerQuery *q = queries[queued[i].qid];
+		if(q->cancelled())
+			q->setQueued(false);
+		else
+			waiting.push_back(queued[i]);
+	}
+	queued.swap(waiting);
+
+	time_t now = time(NULL);
+	while(queued.size() > 0)
+	{
+		unsigned best = 0;
+		double bestval = HUGE_VAL;
+		for(unsigned i = 0, n = queued.size(); i < n; i++)
+		{
+			double val = queued[i].priority(now);
+			if(val < bestval)
+			{
+				bestval = val;
+				best = i;
+			}
+		}
+
+		if(!canAdmit(queued[best].cost))
+			break;
+		admit(queued[best].qid, queued[best].cost);
+		queued.erase(queued.begin() + best);
+	}
+}
+
+//position of qid in admission order, the order schedule picks queries in
+//lock must be held
+unsigned WebQueryManager::queuePosition(unsigned qid, time_t now) const
+{
+	unsigned target = queued.size();
+	for(unsigned i = 0, n = queued.size(); i < n; i++)
+	{
+		if(queued[i].qid == qid)
+			target = i;
+	}
+	if(target == queued.size())
+		return 0;
+
+	//ties go to the earlier arrival, as in schedule
+	double val = queued[target].priority(now);
+	unsigned pos = 1;
+	for(unsigned i = 0, n = queued.size(); i < n; i++)
+	{
+		double other = queued[i].priority(now);
+		if(other < val || (other == val && i < target))
+			pos++;
+	}
+	return pos;
+}
+
+unsigned WebQueryManager::queuePosition(unsigned qid)
+{
+	boost::unique_lock<boost::mutex> L(lock);
+	schedule();
+	return queuePosition(qid, time(NULL));
+}
+
+unsigned WebQueryManager::numQueued()
+{
+	boost::unique_lock<boost::mutex> L(lock);
+	return queued.size();
+}
+
 //order json's
 static bool jsonInfoSorter(const Json::Value& a, const Json::Value& b)
 {
@@ -481,6 +685,8 @@ WebQueryHandle WebQueryManager::get(unsigned qid)
 {
 	boost::unique_lock<boost::mutex> m(lock);
 
+	schedule(); //clients polling for results keep the admission queue moving
+
 	if (queries.count(qid) == 0)
 		return WebQueryHandle(NULL);
 	PharmerQuery *q = queries[qid];
@@ -521,6 +727,7 @@ unsigned WebQueryManager::purgeOldQueries()
 	{
 		queries.erase(qid);
 	}
+	schedule();
 
 	return toErase.size();
 }
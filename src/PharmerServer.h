@@ -87,10 +87,36 @@ class WebQueryManager
 	Json::Value json;
 	Json::Value privatejson;
 
+	//admission control, queries whose estimated cost would exceed the budget
+	//wait in queued until enough running queries finish
+	struct QueuedQuery
+	{
+		unsigned qid;
+		double cost;
+		time_t queuedAt;
+
+		QueuedQuery(unsigned q, double c) :
+				qid(q), cost(c), queuedAt(time(NULL))
+		{
+		}
+
+		//admission priority, lower is admitted first
+		double priority(time_t now) const;
+	};
+	vector<QueuedQuery> queued; //in arrival order
+	boost::unordered_map<unsigned, double> running; //admitted query costs
+	double runningCost;
+
+	bool canAdmit(double cost) const;
+	void admit(unsigned qid, double cost);
+	void schedule();
+	void queryDone();
+	unsigned queuePosition(unsigned qid, time_t now) const;
+
 	boost::mutex lock;
 public:
 	WebQueryManager(boost::unordered_map<string, StripedSearchers>& dbs,
-			const vector<boost::filesystem::path>& prefixes): nextID(1), databases(dbs)
+			const vector<boost::filesystem::path>& prefixes): nextID(1), databases(dbs), runningCost(0)
 	{
 		//setup private and public prefixes, which should be subdirs of the
 		//standard library prefixes
@@ -120,6 +146,9 @@ public:
 	unsigned purgeOldQueries();
 
 	void getCounts(unsigned& active, unsigned& inactive, unsigned& defunct);
+	//return the 1-based position of qid in the admission queue, 0 if not queued
+	unsigned queuePosition(unsigned qid);
+	unsigned numQueued();
 	unsigned processedQueries() const { return nextID-1; }
 
 	void setupJSONInfo();
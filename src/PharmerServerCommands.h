@@ -31,6 +31,7 @@ See the LICENSE file provided with the distribution for more information.
 #include "PharmerQuery.h"
 #include "PharmerServer.h"
 #include "pharmarec.h"
+#include "shapedb/ResidentMemory.h"
 #include <string>
 #include <cstdio>
 #include <gperftools/malloc_extension.h>
@@ -406,16 +407,18 @@ public:
 					ShapeConstraints excluder;
 					excluder.readJSONExclusion(root);
 					Json::Value mesh;
+					bool typed = cgiTagExists(CGI, "encoding")
+							&& cgiGetString(CGI, "encoding") == "base64";
 
 					if(cgiGetString(CGI, "type") == "exclusive")
 					{
 						mesh["tolerance"] = root["extolerance"];
-						excluder.getExclusiveMesh(mesh);
+						excluder.getExclusiveMesh(mesh, typed);
 					}
 					else if(cgiGetString(CGI, "type") == "inclusive")
 					{
 						mesh["tolerance"] = root["intolerance"];
-						excluder.getInclusiveMesh(mesh);
+						excluder.getInclusiveMesh(mesh, typed);
 					}
 
 					IO << HTTPPlainHeader();
@@ -515,10 +518,18 @@ public:
 		if (query)
 		{
 			IO << HTTPPlainHeader();
-			DataParameters params;
-			initDataParams(CGI, params);
 			Json::Value val;
-			query->setDataJSON(params, val);
+			if (cgiTagExists(CGI, "cursor"))
+			{
+				//incremental polling, only what changed since the cursor
+				query->setDeltaJSON(cgiGetString(CGI, "cursor"), val);
+			}
+			else
+			{
+				DataParameters params;
+				initDataParams(CGI, params);
+				query->setDataJSON(params, val);
+			}
 			IO << val;
 		}
 	}
@@ -666,8 +677,14 @@ public:
 		if (query)
 		{
 			IO << HTTPPlainHeader();
-			unsigned index = cgiGetInt(CGI, "loc");
-			query->outputMol(index, IO, false, cgiTagExists(CGI, "minimize"));
+			if (cgiTagExists(CGI, "seq")) //id from an incremental getdata
+				query->outputMolBySeq(cgiGetInt(CGI, "seq"), IO,
+						cgiTagExists(CGI, "minimize"));
+			else
+			{
+				unsigned index = cgiGetInt(CGI, "loc");
+				query->outputMol(index, IO, false, cgiTagExists(CGI, "minimize"));
+			}
 		}
 	}
 };
@@ -800,9 +817,30 @@ public:
 				/ 100.0;
 		IO << "{\"msg\": \"Active: " << active << " Inactive: "
 				<< inactive << " Defunct: " << defunct
+				<< " Queued: " << queries.numQueued()
 				<< " Memory: " << gb << "GB"
 						" Load: " << load << " TotalQ: "
-				<< queries.processedQueries() << "\"}\n";
+				<< queries.processedQueries() << "\"";
+		//page size backing each index file copied into resident memory
+		if (ResidentMemory::enabled())
+			IO << ", \"resident\": " << ResidentMemory::status();
+
+		//if asked about a specific query, report where it is in the admission queue
+		unsigned qid = cgiGetInt(CGI, "qid");
+		if (qid > 0)
+		{
+			IO << ", \"position\": " << queries.queuePosition(qid);
+			WebQueryHandle query = queries.get(qid);
+			if (query)
+			{
+				IO << ", \"memory\": "
+						<< round(100.0 * query->memoryUsed() / (1024.0 * 1024))
+								/ 100.0;
+				if (query->overMemoryQuota())
+					IO << ", \"truncated\": true";
+			}
+		}
+		IO << "}\n";
 	}
 
 	virtual bool isFrequent()
@@ -28,6 +28,9 @@ See the LICENSE file provided with the distribution for more information.
 #include "Triplet.h"
 #include "BitSetTree.h"
 #include "basis.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 using namespace OpenBabel;
 
@@ -620,8 +623,81 @@ void QueryTripletFingerprint::set(unsigned i, unsigned j, unsigned k,
 		}
 		cout << "\n";
 	}
+
+	flatten();
+}
+
+//copy the fingerprints into contiguous arrays so isValid is a linear scan
+void QueryTripletFingerprint::flatten()
+{
+	pointRanges.clear();
+	smallRanges.clear();
+	flatBig.clear();
+	flatSmall.clear();
+
+	for (unsigned p = 0, np = bigqfingers.size(); p < np; p++)
+	{
+		if (bigqfingers[p].size() == 0)
+			continue;
+		unsigned start = flatBig.size();
+		for (unsigned i = 0, n = bigqfingers[p].size(); i < n; i++)
+		{
+			flatBig.push_back(bigqfingers[p][i]);
+			unsigned sstart = flatSmall.size();
+			flatSmall.insert(flatSmall.end(), smallqfingers[p][i].begin(),
+					smallqfingers[p][i].end());
+			smallRanges.push_back(FingerRange(sstart, flatSmall.size()));
+		}
+		pointRanges.push_back(FingerRange(start, flatBig.size()));
+	}
+
+	bigqfingers.clear();
+	smallqfingers.clear();
 }
 
+//return the first fingerprint in [q,end) whose bits are all set in f
+static const TripletFingerprint* findContainedScalar(const TripletFingerprint& f,
+		const TripletFingerprint *q, const TripletFingerprint *end)
+{
+	for (; q != end; q++)
+	{
+		if (f.contains(*q))
+			return q;
+	}
+	return end;
+}
+
+#if defined(__x86_64__)
+//a fingerprint is exactly 256 bits, so containment is a single vptest
+__attribute__((target("avx2")))
+static const TripletFingerprint* findContainedAVX2(const TripletFingerprint& f,
+		const TripletFingerprint *q, const TripletFingerprint *end)
+{
+	__m256i fv = _mm256_loadu_si256((const __m256i*) &f);
+	for (; q != end; q++)
+	{
+		__m256i qv = _mm256_loadu_si256((const __m256i*) q);
+		if (_mm256_testc_si256(fv, qv)) //(~f & q) == 0
+			return q;
+	}
+	return end;
+}
+#endif
+
+typedef const TripletFingerprint* (*findContainedFn)(const TripletFingerprint&,
+		const TripletFingerprint*, const TripletFingerprint*);
+
+static findContainedFn chooseFindContained()
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2"))
+		return findContainedAVX2;
+#endif
+	return findContainedScalar;
+}
+
+static const findContainedFn findContained = chooseFindContained();
+
 bool QueryTripletFingerprint::isValid(const TripletFingerprint& f) const
 {
 	if(SkipFingers)
@@ -629,35 +705,58 @@ bool QueryTripletFingerprint::isValid(const TripletFingerprint& f) const
 
 	//there must be a hit in every one of the points
 	//unfortunately, more clever methods (bitsettree) aren't actually faster
-	for(unsigned p = 0, np = bigqfingers.size(); p < np; p++)
+	const TripletFingerprint *big = flatBig.data();
+	const TripletFingerprint *small = flatSmall.data();
+	for(unsigned p = 0, np = pointRanges.size(); p < np; p++)
 	{
-		if(bigqfingers[p].size() > 0)
+		const TripletFingerprint *end = big + pointRanges[p].end;
+		const TripletFingerprint *q = findContained(f, big + pointRanges[p].start, end);
+		for(; q != end; q = findContained(f, q + 1, end))
 		{
-			unsigned i;
-			unsigned n = bigqfingers[p].size();
-			for(i = 0; i < n; i++)
-			{
-				if(f.contains(bigqfingers[p][i]))
-				{
-					//check small
-					unsigned j;
-					unsigned m = smallqfingers[p][i].size();
-					for(j = 0; j < m; j++)
-					{
-						if(f.contains(smallqfingers[p][i][j]))
-							break;
-					}
-					if(j != m)
-						break; //small fingers were also a match, otherwise keep going
-				}
-			}
-			if(i == n)
-			{
-				return false;
-			}
+			//check small
+			const FingerRange& r = smallRanges[q - big];
+			if(findContained(f, small + r.start, small + r.end) != small + r.end)
+				break; //small fingers were also a match, otherwise keep going
 		}
+		if(q == end)
+			return false;
 	}
 
 	return true;
 }
 
+//probability every bit of q is set
+static double containProb(const TripletFingerprint& q, const double *bitfreq)
+{
+	double p = 1;
+	for (unsigned b = 0; b < 256 && p > 0; b++)
+	{
+		if (q.getBit(b))
+			p *= bitfreq[b];
+	}
+	return p;
+}
+
+//mirrors isValid: every point needs a big finger contained and, for that
+//big finger, at least one of its small fingers contained
+double QueryTripletFingerprint::passFraction(const double *bitfreq) const
+{
+	if(SkipFingers)
+		return 1;
+
+	double ret = 1;
+	for(unsigned p = 0, np = pointRanges.size(); p < np; p++)
+	{
+		double miss = 1; //no big finger of this point matches
+		for(unsigned q = pointRanges[p].start; q < pointRanges[p].end; q++)
+		{
+			const FingerRange& r = smallRanges[q];
+			double smiss = 1;
+			for(unsigned s = r.start; s < r.end; s++)
+				smiss *= 1 - containProb(flatSmall[s], bitfreq);
+			miss *= 1 - containProb(flatBig[q], bitfreq) * (1 - smiss);
+		}
+		ret *= 1 - miss;
+	}
+	return ret;
+}
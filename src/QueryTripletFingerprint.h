@@ -37,6 +37,20 @@ class QueryTripletFingerprint
 	//check corresponding smallqfingers (second DISTPACE)
 	vector< vector<TripletFingerprint> > bigqfingers; //all possible fingerprints of each query point not part of this triplet
 	vector< vector< vector<TripletFingerprint> > > smallqfingers;
+
+	//the above are only used while building, isValid scans these contiguous copies
+	struct FingerRange
+	{
+		unsigned start;
+		unsigned end;
+		FingerRange(unsigned s = 0, unsigned e = 0): start(s), end(e) {}
+	};
+	vector<FingerRange> pointRanges; //range of flatBig for each point with fingers
+	vector<FingerRange> smallRanges; //range of flatSmall for each entry of flatBig
+	vector<TripletFingerprint> flatBig;
+	vector<TripletFingerprint> flatSmall;
+
+	void flatten();
 public:
 	QueryTripletFingerprint() { assert(TripletFingerprint::NUMDISTSPACES <= 2);}
 
@@ -47,6 +61,10 @@ public:
 
 	 bool isValid(const TripletFingerprint& f) const;
 
+	 //estimate the fraction of fingerprints that are valid given how often
+	 //each of the 256 bits is set, assuming bits are independent
+	 double passFraction(const double *bitfreq) const;
+
 };
 
 #endif /* PHARMITSERVER_QUERYTRIPLETFINGERPRINT_H_ */
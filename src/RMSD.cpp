@@ -131,9 +131,67 @@ RMSDResult calculateRMSD(const double *ref, const double *fit, unsigned n)
 
 
 
+//evaluate the characteristic polynomial (coefficients highest degree first)
+//of a 4x4 matrix and its derivative at x
+static inline void evalQuartic(const double *c, double x, double& p, double& dp)
+{
+	p = (((x - c[0]) * x + c[1]) * x - c[2]) * x + c[3];
+	dp = ((4 * x - 3 * c[0]) * x + 2 * c[1]) * x - c[2];
+}
+
+//return true if the rmsd derived from the largest eigenvalue of the
+//symmetric matrix A must exceed cutoff
+//Newton's method started from a Gershgorin bound descends monotonically
+//onto the largest root of the characteristic polynomial, so every iterate
+//gives a lower bound on the rmsd and we can stop as soon as it is too big
+static bool rmsdExceeds(const Mat4x4& A, double constant, unsigned n, double cutoff)
+{
+	double lambda = -HUGE_VAL;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		double r = A(i, i);
+		for (unsigned j = 0; j < 4; j++)
+			if (j != i)
+				r += fabs(A(i, j));
+		lambda = max(lambda, r);
+	}
+
+	//characteristic polynomial from the traces of powers of A (Newton's identities)
+	Mat4x4 A2 = A * A;
+	double p1 = A.trace();
+	double p2 = A2.trace();
+	double p3 = (A2 * A).trace();
+	double p4 = (A2 * A2).trace();
+	double c[4];
+	c[0] = p1;
+	c[1] = (c[0] * p1 - p2) / 2;
+	c[2] = (c[1] * p1 - c[0] * p2 + p3) / 3;
+	c[3] = (c[2] * p1 - c[1] * p2 + c[0] * p3 - p4) / 4;
+
+	//allow for a little floating point slop; borderline cases get the full solve
+	double limit = cutoff * cutoff * n / 4.0 + 1e-6;
+	for (unsigned iter = 0; iter < 50; iter++)
+	{
+		if (constant - lambda > limit)
+			return true;
+
+		double p = 0, dp = 0;
+		evalQuartic(c, lambda, p, dp);
+		if (dp <= 0)
+			break;
+		double delta = p / dp;
+		lambda -= delta;
+		if (fabs(delta) < 1e-10 * max(1.0, fabs(lambda)))
+			break;
+	}
+	return false;
+}
+
 //calculate weighted rmsd of passed n points
 //use dual number quaternions (Walker, Shao, and Volz, Estimating 3-D Location Parameters Using Dual Number Quaternions, 1991
-RMSDResult calculateRMSD(const double *ref, const double *fit, const double *weights, unsigned n)
+//if the rmsd is guaranteed to be greater than cutoff, return HUGE_VAL
+//without computing the transformation
+RMSDResult calculateRMSD(const double *ref, const double *fit, const double *weights, unsigned n, double cutoff)
 {
 	Mat4x4 C1 = Mat4x4::Zero();
 	Mat4x4 C3 = Mat4x4::Zero();
@@ -181,6 +239,14 @@ RMSDResult calculateRMSD(const double *ref, const double *fit, const double *wei
 	C3 *= 2;
 	//now compute A
 	Mat4x4 A = 0.5*(C3.transpose()*c2mult*C3) + C1 + C1.transpose();
+
+	if (cutoff < HUGE_VAL && rmsdExceeds(A, constant, n, cutoff))
+	{
+		RMSDResult res;
+		res.setValue(HUGE_VAL);
+		return res;
+	}
+
 	SelfAdjointEigenSolver<Mat4x4> esolver(A);
 
 	const Vec4& evals = esolver.eigenvalues();
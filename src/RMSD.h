@@ -27,6 +27,7 @@ See the LICENSE file provided with the distribution for more information.
 #include <eigen3/Eigen/Core>
 #include <eigen3/Eigen/Eigenvalues>
 #include <iostream>
+#include <cmath>
 #include <openbabel/mol.h>
 
 using namespace std;
@@ -130,7 +131,7 @@ public:
 };
 
 RMSDResult calculateRMSD(const double *ref, const double *fit, unsigned n);
-RMSDResult calculateRMSD(const double *ref, const double *fit, const double *weights, unsigned n);
+RMSDResult calculateRMSD(const double *ref, const double *fit, const double *weights, unsigned n, double cutoff = HUGE_VAL);
 
 
 
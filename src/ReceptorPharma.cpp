@@ -0,0 +1,206 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+
+/*
+ * ReceptorPharma.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ReceptorPharma.h"
+#include "LRUCache.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace OpenBabel;
+
+cl::opt<unsigned> ReceptorPharmaCacheSize("receptor-pharma-cache",
+		cl::desc("Number of receptor pharmacophore feature sets to cache"),
+		cl::init(32));
+
+static LRUCache<string, ReceptorPharma> receptorCache;
+
+ReceptorPharma::ReceptorPharma(OBMol& rec): receptor(rec)
+{
+	atoms.reserve(rec.NumAtoms());
+	FOR_ATOMS_OF_MOL(a, rec)
+	{
+		atoms.push_back(Eigen::Vector3d(a->x(), a->y(), a->z()));
+	}
+}
+
+//prune atoms from rec that are more than dist from ligand
+//this is approximate since I'm just using the bounding box
+static OBMol getPrunedReceptor(const OBMol& rec, OBMol& ligand, double dist)
+{
+	if(ligand.NumAtoms() == 0) return rec;
+
+	double min[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL};
+	double max[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+
+	//get bounding box of ligand
+	FOR_ATOMS_OF_MOL(a, ligand)
+	{
+		vector3 pt = a->GetVector();
+		for(unsigned i = 0; i < 3; i++) {
+			if(pt[i] > max[i]) max[i] = pt[i];
+			if(pt[i] < min[i]) min[i] = pt[i];
+		}
+	}
+
+	//now expand by dist
+	for(unsigned i = 0; i < 3; i++)
+	{
+		max[i] += dist;
+		min[i] -= dist;
+	}
+
+	//identify receptor atoms outside of box
+	vector<OBAtom*> toremove;
+	OBMol ret = rec;
+	FOR_ATOMS_OF_MOL(a, ret)
+	{
+		vector3 pt = a->GetVector();
+		if(pt[0] > max[0] || pt[1] > max[1] || pt[2] > max[2] ||
+				pt[0] < min[0] || pt[1] < min[1] || pt[2] < min[2])
+		{
+			toremove.push_back(&(*a));
+		}
+	}
+
+	ret.BeginModify();
+	for(unsigned i = 0, n = toremove.size(); i < n; i++)
+	{
+		ret.DeleteAtom(toremove[i],true);
+	}
+	ret.EndModify();
+	return ret;
+}
+
+void ReceptorPharma::featuresNear(OBMol& ligand,
+		vector<PharmaPoint>& points) const
+{
+	OBMol prunedrec = getPrunedReceptor(receptor, ligand, 10); //prune receptor
+	getPharmaPoints(proteinPharmas, prunedrec, points);
+}
+
+PharmaGrid::PharmaGrid(const vector<PharmaPoint>& pts, double csize) :
+		points(pts), cellSize(csize)
+{
+	min[0] = min[1] = min[2] = HUGE_VAL;
+	double max[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+	for (unsigned i = 0, n = points.size(); i < n; i++)
+	{
+		const PharmaPoint& p = points[i];
+		double c[3] = { p.x, p.y, p.z };
+		for (unsigned d = 0; d < 3; d++)
+		{
+			if (c[d] < min[d]) min[d] = c[d];
+			if (c[d] > max[d]) max[d] = c[d];
+		}
+	}
+
+	for (unsigned d = 0; d < 3; d++)
+	{
+		dims[d] = points.size() > 0 ? cellCoord(max[d], d) + 1 : 0;
+	}
+
+	//bucket the point indices by cell, keeping them in order within a cell
+	unsigned ncells = dims[0] * dims[1] * dims[2];
+	vector<unsigned> cellOf(points.size());
+	cellStart.assign(ncells + 1, 0);
+	for (unsigned i = 0, n = points.size(); i < n; i++)
+	{
+		const PharmaPoint& p = points[i];
+		unsigned c = (cellCoord(p.z, 2) * dims[1] + cellCoord(p.y, 1)) * dims[0]
+				+ cellCoord(p.x, 0);
+		cellOf[i] = c;
+		cellStart[c + 1]++;
+	}
+	for (unsigned c = 0; c < ncells; c++)
+		cellStart[c + 1] += cellStart[c];
+
+	cellPoints.resize(points.size());
+	vector<unsigned> fill(cellStart.begin(), cellStart.end() - 1);
+	for (unsigned i = 0, n = points.size(); i < n; i++)
+	{
+		cellPoints[fill[cellOf[i]]++] = i;
+	}
+}
+
+int PharmaGrid::cellCoord(double v, unsigned d) const
+{
+	return floor((v - min[d]) / cellSize);
+}
+
+void PharmaGrid::pointsNear(double x, double y, double z, double dist,
+		vector<unsigned>& indices) const
+{
+	indices.clear();
+	if (points.size() == 0)
+		return;
+
+	double c[3] = { x, y, z };
+	int lo[3], hi[3];
+	for (unsigned d = 0; d < 3; d++)
+	{
+		lo[d] = std::max(cellCoord(c[d] - dist, d), 0);
+		hi[d] = std::min(cellCoord(c[d] + dist, d), dims[d] - 1);
+		if (lo[d] > hi[d])
+			return;
+	}
+
+	double distSq = dist * dist;
+	for (int k = lo[2]; k <= hi[2]; k++)
+	{
+		for (int j = lo[1]; j <= hi[1]; j++)
+		{
+			unsigned row = (k * dims[1] + j) * dims[0];
+			for (unsigned pos = cellStart[row + lo[0]],
+					end = cellStart[row + hi[0] + 1]; pos < end; pos++)
+			{
+				const PharmaPoint& p = points[cellPoints[pos]];
+				double dx = p.x - x, dy = p.y - y, dz = p.z - z;
+				if (dx * dx + dy * dy + dz * dz <= distSq)
+					indices.push_back(cellPoints[pos]);
+			}
+		}
+	}
+	sort(indices.begin(), indices.end());
+}
+
+std::shared_ptr<const ReceptorPharma> ReceptorPharma::get(const string& data,
+		OBFormat *format)
+{
+	//key on the full contents so different receptors can never collide
+	string key((const char*) &format, sizeof(format));
+	key += data;
+
+	std::shared_ptr<const ReceptorPharma> ret = receptorCache.get(key);
+	if (ret)
+		return ret;
+
+	OBConversion conv;
+	conv.SetInFormat(format);
+	OBMol rec;
+	if (!conv.ReadString(&rec, data))
+		return ret;
+
+	ret = std::make_shared<const ReceptorPharma>(rec);
+	receptorCache.put(key, ret, ReceptorPharmaCacheSize);
+	return ret;
+}
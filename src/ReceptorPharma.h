@@ -0,0 +1,84 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+
+/*
+ * ReceptorPharma.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      A parsed receptor for computing interaction pharmacophores.  Users
+ *      drop many ligands onto the same receptor, so these are cached by
+ *      receptor contents.  Features are still perceived on the receptor
+ *      pruned around each ligand, as they always have been, and are bucketed
+ *      in a uniform grid so each ligand point only looks at the features
+ *      near it.
+ */
+
+#ifndef PHARMITSERVER_RECEPTORPHARMA_H_
+#define PHARMITSERVER_RECEPTORPHARMA_H_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <eigen3/Eigen/Core>
+#include <openbabel/mol.h>
+#include <openbabel/obconversion.h>
+#include "pharmarec.h"
+
+//pharma points bucketed in a uniform grid
+class PharmaGrid
+{
+	const vector<PharmaPoint>& points;
+
+	//cellStart[c]..cellStart[c+1] index cellPoints
+	double cellSize;
+	double min[3];
+	int dims[3];
+	vector<unsigned> cellStart;
+	vector<unsigned> cellPoints;
+
+	int cellCoord(double v, unsigned d) const;
+public:
+	//points must outlive the grid
+	PharmaGrid(const vector<PharmaPoint>& pts, double csize = 6.0);
+
+	//set indices to the (sorted) indices of all points within dist of x,y,z
+	void pointsNear(double x, double y, double z, double dist,
+			vector<unsigned>& indices) const;
+};
+
+class ReceptorPharma
+{
+	OpenBabel::OBMol receptor;
+	vector<Eigen::Vector3d> atoms; //receptor atom coordinates
+
+public:
+	ReceptorPharma(OpenBabel::OBMol& rec);
+
+	const vector<Eigen::Vector3d>& atomCoords() const { return atoms; }
+
+	//protein pharma points of the receptor within 10A of ligand's bounding
+	//box, perceived on just that part of the receptor
+	void featuresNear(OpenBabel::OBMol& ligand,
+			vector<PharmaPoint>& points) const;
+
+	//return the (possibly cached) receptor in data, null if it can't be parsed
+	static std::shared_ptr<const ReceptorPharma> get(const string& data,
+			OpenBabel::OBFormat *format);
+};
+
+#endif /* PHARMITSERVER_RECEPTORPHARMA_H_ */
@@ -0,0 +1,289 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * RemoteShard.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "RemoteShard.h"
+#include "ShardProtocol.h"
+#include "cors.h"
+#include "pharmarec.h"
+#include "CommandLine2/CommandLine.h"
+
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+cl::opt<unsigned> ShardTimeout("shard-timeout",
+		cl::desc("Seconds to wait on an unresponsive shard server before giving up on it"),
+		cl::init(60));
+
+RemoteShard::RemoteShard(const string& h, const string& p, const string& s,
+		const Json::Value& info) :
+		host(h), port(p), subset(s), dbinfo(info["info"]), numMols(
+				info["numMols"].asUInt64()), numConfs(
+				info["numConfs"].asUInt64()), molIDs(
+				info["molIDs"].asUInt64()), shape(info["hasShape"].asBool())
+{
+	if (info.isMember("pharmas"))
+	{
+		stringstream str(info["pharmas"].asString());
+		pharmas = std::shared_ptr<Pharmas>(new Pharmas());
+		if (pharmas->read(str))
+			pharmas->setDefaultSearchRadius(1.0); //as in the searcher
+		else
+		{
+			cerr << "Invalid pharmas from shard " << getName() << "\n";
+			pharmas.reset();
+		}
+	}
+}
+
+static bool connectShard(io_service& io, tcp::socket& sock,
+		const string& host, const string& port)
+{
+	boost::system::error_code ec;
+	tcp::resolver resolver(io);
+	tcp::resolver::iterator itr = resolver.resolve(tcp::resolver::query(host, port), ec);
+	if (ec)
+		return false;
+	boost::asio::connect(sock, itr, ec);
+	if (ec)
+		return false;
+	sock.set_option(tcp::no_delay(true), ec);
+	return true;
+}
+
+//wait for the next message, checking stop between heartbeats
+//return false on timeout or if stop is set
+static bool awaitFrame(tcp::socket& sock, const bool& stop)
+{
+	unsigned waited = 0;
+	while (!shardReadable(sock, SHARD_HEARTBEAT_MS))
+	{
+		waited += SHARD_HEARTBEAT_MS;
+		if (stop || waited >= ShardTimeout * 1000)
+			return false;
+	}
+	return true;
+}
+
+bool RemoteShard::discover(const string& address,
+		vector<std::shared_ptr<RemoteShard> >& shards)
+{
+	size_t colon = address.rfind(':');
+	if (colon == string::npos)
+	{
+		cerr << "Shard address " << address << " is not host:port\n";
+		return false;
+	}
+	string h = address.substr(0, colon);
+	string p = address.substr(colon + 1);
+
+	io_service io;
+	tcp::socket sock(io);
+	ShardFrame frame;
+	vector<char> data;
+	bool stop = false;
+	if (!connectShard(io, sock, h, p) || !writeShardFrame(sock, ShardOp::Info)
+			|| !awaitFrame(sock, stop) || !readShardFrame(sock, frame, data)
+			|| frame.op != ShardOp::Info)
+	{
+		cerr << "Could not get info from shard server " << address << "\n";
+		return false;
+	}
+
+	Json::Value root;
+	Json::Reader reader;
+	if (!reader.parse(string(data.begin(), data.end()), root))
+	{
+		cerr << "Invalid info from shard server " << address << "\n";
+		return false;
+	}
+
+	vector<string> names = root.getMemberNames();
+	for (unsigned i = 0, n = names.size(); i < n; i++)
+	{
+		shards.push_back(std::shared_ptr<RemoteShard>(
+				new RemoteShard(h, p, names[i], root[names[i]])));
+	}
+	return true;
+}
+
+bool RemoteShard::search(const string& query, unsigned qsize,
+		CorAllocator& alloc, MTQueue<CorrespondenceResult*>& Q, unsigned db,
+		unsigned numdb, bool& stop)
+{
+	io_service io;
+	tcp::socket sock(io);
+	if (!connectShard(io, sock, host, port))
+	{
+		cerr << "Could not connect to shard " << getName() << "\n";
+		return false;
+	}
+
+	string payload = subset;
+	payload += '\0';
+	payload += query;
+	if (!writeShardFrame(sock, ShardOp::Search, payload))
+		return false;
+
+	unsigned rsize = sizeof(CorrespondenceResult) + qsize * sizeof(matchType);
+	bool started = false;
+	ShardFrame frame;
+	vector<char> data;
+	while (true)
+	{
+		if (!awaitFrame(sock, stop) || !readShardFrame(sock, frame, data)
+				|| stop)
+		{
+			if (stop)
+			{ //let the shard stop working on our behalf
+				writeShardFrame(sock, ShardOp::Cancel);
+				return true;
+			}
+			cerr << "Lost connection to shard " << getName() << "\n";
+			return false;
+		}
+
+		switch (frame.op)
+		{
+		case ShardOp::Header:
+		{
+			uint32_t sz = 0;
+			if (data.size() == sizeof(sz))
+				memcpy(&sz, &data[0], sizeof(sz));
+			if (sz != rsize)
+			{
+				cerr << "Shard " << getName() << " result size " << sz
+						<< " does not match " << rsize << "\n";
+				return false;
+			}
+			started = true;
+			break;
+		}
+		case ShardOp::Results:
+			if (!started || data.size() % rsize != 0)
+				return false;
+			for (unsigned off = 0, n = data.size(); off < n; off += rsize)
+			{
+				CorrespondenceResult *c = alloc.newCorResult();
+				memcpy((void*) c, &data[off], rsize);
+				//the shard encodes its own stripes, wrap that in our databases
+				c->location = c->location * numdb + db;
+				c->molid = c->molid * numdb + db;
+				Q.push(c);
+			}
+			break;
+		case ShardOp::End:
+			return true;
+		case ShardOp::Error:
+			cerr << "Shard " << getName() << ": "
+					<< string(data.begin(), data.end()) << "\n";
+			return false;
+		default:
+			return false;
+		}
+	}
+	return false;
+}
+
+bool RemoteShard::getMolRecords(const vector<unsigned long>& locations,
+		vector<MolSpan>& spans, string& buffer)
+{
+	spans.assign(locations.size(), MolSpan());
+	buffer.clear();
+	if (locations.size() == 0)
+		return true;
+
+	io_service io;
+	tcp::socket sock(io);
+	if (!connectShard(io, sock, host, port))
+	{
+		cerr << "Could not connect to shard " << getName() << "\n";
+		return false;
+	}
+
+	string payload = subset;
+	payload += '\0';
+	for (unsigned i = 0, n = locations.size(); i < n; i++)
+	{
+		uint64_t loc = locations[i];
+		payload.append((const char*) &loc, sizeof(loc));
+	}
+	if (!writeShardFrame(sock, ShardOp::GetMol, payload))
+		return false;
+
+	//record offsets into buffer, which moves as it grows
+	vector<size_t> offsets(locations.size(), 0);
+	vector<unsigned> sizes(locations.size(), 0);
+	size_t next = 0;
+	ShardFrame frame;
+	vector<char> data;
+	bool stop = false;
+	while (awaitFrame(sock, stop) && readShardFrame(sock, frame, data))
+	{
+		if (frame.op == ShardOp::End)
+		{
+			for (size_t i = 0; i < next; i++)
+			{
+				if (sizes[i] > 0)
+					spans[i] = MolSpan(
+							(const unsigned char*) buffer.data() + offsets[i],
+							sizes[i]);
+			}
+			return next == locations.size();
+		}
+		if (frame.op != ShardOp::MolRecords || data.size() < sizeof(uint32_t))
+			break;
+
+		//the counts come from the peer, check them before any arithmetic
+		//that could wrap
+		uint32_t cnt = 0;
+		memcpy(&cnt, &data[0], sizeof(cnt));
+		if (cnt > (data.size() - sizeof(cnt)) / sizeof(uint32_t)
+				|| cnt > locations.size() - next)
+			break;
+		size_t pos = sizeof(cnt) + (size_t) cnt * sizeof(uint32_t);
+		for (unsigned i = 0; i < cnt; i++, next++)
+		{
+			uint32_t sz = 0;
+			memcpy(&sz, &data[sizeof(cnt) + (size_t) i * sizeof(uint32_t)], sizeof(sz));
+			if (sz > data.size() - pos)
+				return false;
+			offsets[next] = buffer.size();
+			sizes[next] = sz;
+			buffer.append(&data[pos], sz);
+			pos += sz;
+		}
+	}
+	cerr << "Could not retrieve molecules from shard " << getName() << "\n";
+	return false;
+}
+
+bool RemoteShard::getMolRecord(unsigned long location,
+		vector<unsigned char>& record)
+{
+	vector<unsigned long> locations(1, location);
+	vector<MolSpan> spans;
+	string buffer;
+	if (!getMolRecords(locations, spans, buffer) || spans[0].data == NULL)
+		return false;
+	record.assign(spans[0].data, spans[0].data + spans[0].size);
+	return true;
+}
@@ -0,0 +1,90 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * RemoteShard.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      Client side of a library subset served by a shard server on another
+ *      machine.  A query searches a remote shard alongside its local stripes;
+ *      the shard runs the triplet/shape matching on all of its stripes and
+ *      streams back the correspondence results.
+ */
+
+#ifndef PHARMITSERVER_REMOTESHARD_H_
+#define PHARMITSERVER_REMOTESHARD_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <json/json.h>
+#include "MTQueue.h"
+
+using namespace std;
+
+class CorAllocator;
+class Pharmas;
+struct CorrespondenceResult;
+struct MolSpan;
+
+class RemoteShard
+{
+	string host;
+	string port;
+	string subset;
+	Json::Value dbinfo;
+	unsigned long numMols;
+	unsigned long numConfs;
+	unsigned long molIDs; //bound on the molids the shard sends, 0 if unknown
+	bool shape;
+	std::shared_ptr<Pharmas> pharmas; //null if the shard didn't say
+
+public:
+	RemoteShard(const string& h, const string& p, const string& s,
+			const Json::Value& info);
+
+	//query the shard server at address (host:port) for the subsets it
+	//serves and add a RemoteShard for each one to shards
+	static bool discover(const string& address,
+			vector<std::shared_ptr<RemoteShard> >& shards);
+
+	//run query (json) on the shard, results are allocated from alloc and
+	//pushed onto Q with their locations encoded as database db of numdb
+	//qsize is the number of query points (0 for shape)
+	//return false if the shard failed or timed out
+	bool search(const string& query, unsigned qsize, CorAllocator& alloc,
+			MTQueue<CorrespondenceResult*>& Q, unsigned db, unsigned numdb,
+			bool& stop);
+
+	//retrieve the raw MolData records at the shard's (sorted) locations over
+	//a single connection, the shard streams them back in batches
+	//spans point into buffer and are null for unavailable records
+	bool getMolRecords(const vector<unsigned long>& locations,
+			vector<MolSpan>& spans, string& buffer);
+	bool getMolRecord(unsigned long location, vector<unsigned char>& record);
+
+	const Json::Value& getJSON() const { return dbinfo; }
+	unsigned long numMolecules() const { return numMols; }
+	unsigned long numConformations() const { return numConfs; }
+	bool hasShape() const { return shape; }
+	unsigned long molIDBound() const { return molIDs; }
+	const Pharmas* getPharmas() const { return pharmas.get(); }
+	const string& getSubset() const { return subset; }
+	string getName() const { return host + ":" + port + "/" + subset; }
+};
+
+#endif /* PHARMITSERVER_REMOTESHARD_H_ */
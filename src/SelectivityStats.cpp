@@ -0,0 +1,162 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+
+/*
+ * SelectivityStats.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "SelectivityStats.h"
+#include <cstdio>
+
+SelectivityStats::SelectivityStats(unsigned n) :
+		nclasses(n), totalMols(0), records(n, 0), mols(n, 0),
+				bits(n * FINGERPRINT_BITS, 0), together(n * n, 0)
+{
+}
+
+//add to cnts for every bit set in v, which starts at bit offset
+static void countBits(unsigned long v, unsigned offset, unsigned long *cnts)
+{
+	while (v)
+	{
+		cnts[offset + __builtin_ctzl(v)]++;
+		v &= v - 1;
+	}
+}
+
+static void countFingerprint(const TripletFingerprint& f, unsigned long *cnts)
+{
+	countBits((unsigned long) f.f1, 0, cnts);
+	countBits((unsigned long) (f.f1 >> 64), 64, cnts);
+	countBits((unsigned long) f.f2, 128, cnts);
+	countBits((unsigned long) (f.f2 >> 64), 192, cnts);
+}
+
+//collapsed conformers are counted as the records they would otherwise be,
+//since each still produces a match
+void SelectivityStats::addMol(const vector<vector<ThreePointData> >& pdatas,
+		const vector<vector<pair<unsigned, ThreePointData> > >& collapsed)
+{
+	vector<unsigned> present;
+	for (unsigned c = 0, n = pdatas.size(); c < n && c < nclasses; c++)
+	{
+		if (pdatas[c].size() == 0)
+			continue;
+		present.push_back(c);
+		records[c] += pdatas[c].size();
+		mols[c]++;
+
+		unsigned long *cnts = &bits[c * FINGERPRINT_BITS];
+		for (unsigned i = 0, nt = pdatas[c].size(); i < nt; i++)
+			countFingerprint(pdatas[c][i].fingerprint, cnts);
+		if (c < collapsed.size())
+		{
+			records[c] += collapsed[c].size();
+			for (unsigned i = 0, nt = collapsed[c].size(); i < nt; i++)
+				countFingerprint(collapsed[c][i].second.fingerprint, cnts);
+		}
+	}
+
+	for (unsigned i = 0, n = present.size(); i < n; i++)
+	{
+		for (unsigned j = 0; j < n; j++)
+		{
+			together[present[i] * nclasses + present[j]]++;
+		}
+	}
+	totalMols++;
+}
+
+bool SelectivityStats::write(const string& fname) const
+{
+	FILE *f = fopen(fname.c_str(), "w");
+	if (!f)
+		return false;
+	fwrite(&nclasses, sizeof(nclasses), 1, f);
+	fwrite(&totalMols, sizeof(totalMols), 1, f);
+	fwrite(records.data(), sizeof(unsigned long), records.size(), f);
+	fwrite(mols.data(), sizeof(unsigned long), mols.size(), f);
+	fwrite(bits.data(), sizeof(unsigned long), bits.size(), f);
+	fwrite(together.data(), sizeof(unsigned long), together.size(), f);
+	fclose(f);
+	return true;
+}
+
+//databases built before these were gathered just don't have the file
+bool SelectivityStats::read(const string& fname)
+{
+	FILE *f = fopen(fname.c_str(), "r");
+	if (!f)
+		return false;
+
+	unsigned n = 0;
+	unsigned long tm = 0;
+	bool ok = fread(&n, sizeof(n), 1, f) == 1
+			&& fread(&tm, sizeof(tm), 1, f) == 1;
+	if (ok)
+	{
+		*this = SelectivityStats(n);
+		ok = fread(records.data(), sizeof(unsigned long), n, f) == n
+				&& fread(mols.data(), sizeof(unsigned long), n, f) == n
+				&& fread(bits.data(), sizeof(unsigned long), bits.size(), f)
+						== bits.size()
+				&& fread(together.data(), sizeof(unsigned long), together.size(), f)
+						== together.size();
+	}
+	fclose(f);
+	if (!ok)
+	{
+		*this = SelectivityStats();
+		return false;
+	}
+
+	totalMols = tm;
+	bitfreqs.resize(bits.size(), 0);
+	for (unsigned c = 0; c < nclasses; c++)
+	{
+		if (records[c] == 0)
+			continue;
+		for (unsigned b = 0; b < FINGERPRINT_BITS; b++)
+			bitfreqs[c * FINGERPRINT_BITS + b] =
+					bits[c * FINGERPRINT_BITS + b] / (double) records[c];
+	}
+	return true;
+}
+
+double SelectivityStats::multiplicity(unsigned c) const
+{
+	if (c >= nclasses || mols[c] == 0)
+		return 1;
+	return records[c] / (double) mols[c];
+}
+
+double SelectivityStats::fingerprintPass(unsigned c,
+		const QueryTripletFingerprint& f) const
+{
+	if (!isValid() || c >= nclasses)
+		return 1;
+	return f.passFraction(&bitfreqs[c * FINGERPRINT_BITS]);
+}
+
+double SelectivityStats::conditional(unsigned a, unsigned b) const
+{
+	if (a >= nclasses || b >= nclasses || mols[a] == 0)
+		return 1;
+	return together[a * nclasses + b] / (double) mols[a];
+}
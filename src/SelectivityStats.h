@@ -0,0 +1,86 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+
+/*
+ * SelectivityStats.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      Per triplet class statistics gathered while building a database that
+ *      go beyond the length histogram: how often each fingerprint bit is set,
+ *      how many triplets of a class a molecule typically has, and how often
+ *      classes occur in the same molecule.  These let the searcher estimate
+ *      how many molecules a query triplet will hit, and how many of those
+ *      will survive the next triplet, when choosing the search order.
+ */
+
+#ifndef PHARMITSERVER_SELECTIVITYSTATS_H_
+#define PHARMITSERVER_SELECTIVITYSTATS_H_
+
+#include <vector>
+#include <string>
+#include "ThreePointData.h"
+#include "QueryTripletFingerprint.h"
+
+using namespace std;
+
+#define FINGERPRINT_BITS (256)
+
+class SelectivityStats
+{
+	unsigned nclasses;
+	unsigned long totalMols;
+	vector<unsigned long> records; //triplets of each class
+	vector<unsigned long> mols; //molecules with at least one triplet of each class
+	vector<unsigned long> bits; //FINGERPRINT_BITS per class, triplets with the bit set
+	vector<unsigned long> together; //nclasses^2, molecules with both classes
+
+	vector<double> bitfreqs; //normalized bits, computed on read
+
+public:
+	SelectivityStats(unsigned n = 0);
+
+	//accumulate the triplets of a single molecule, indexed by class, along
+	//with the conformer triplets collapsed into them
+	void addMol(const vector<vector<ThreePointData> >& pdatas,
+			const vector<vector<pair<unsigned, ThreePointData> > >& collapsed);
+
+	bool write(const string& fname) const;
+	bool read(const string& fname);
+
+	bool isValid() const
+	{
+		return totalMols > 0 && bitfreqs.size() == nclasses * FINGERPRINT_BITS;
+	}
+
+	//average number of triplets of class c in a molecule that has any
+	double multiplicity(unsigned c) const;
+
+	//fraction of triplets of class c expected to pass the query fingerprint
+	double fingerprintPass(unsigned c, const QueryTripletFingerprint& f) const;
+
+	//fraction of molecules with class a that also have class b
+	double conditional(unsigned a, unsigned b) const;
+
+	//number of molecules with class c
+	unsigned long molsWith(unsigned c) const
+	{
+		return c < nclasses ? mols[c] : 0;
+	}
+};
+
+#endif /* PHARMITSERVER_SELECTIVITYSTATS_H_ */
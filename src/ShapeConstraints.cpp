@@ -28,10 +28,52 @@ See the LICENSE file provided with the distribution for more information.
 #include <openbabel/elements.h>
 #include <ShapeConstraints.h>
 #include "MappableOctTree.h"
+#include "LRUCache.h"
+#include "CommandLine2/CommandLine.h"
 using namespace OpenBabel;
 using namespace Eigen;
 
 
+cl::opt<unsigned> ShapeGridCacheSize("shape-grid-cache",
+		cl::desc("Number of computed receptor/ligand shape grids to cache"),
+		cl::init(256));
+
+//users refine queries against the same receptor over and over, so keep
+//the expensive to compute grids around; a grid is at most a few tens of KB,
+//but its key holds the molecular data it was computed from
+static LRUCache<string, MGrid> gridCache;
+
+//cache key for a grid computed from molecular data with the given options;
+//the key contains the data itself since the cache is shared by all users
+//and a hash collision would hand one query another's grid
+static string gridKey(const char *kind, const string& data, const string& format,
+		const Affine3d& transform, double tolerance)
+{
+	size_t flen = format.length();
+	string key(kind, 3);
+	key.append((const char*)transform.matrix().data(), sizeof(double)*16);
+	key.append((const char*)&tolerance, sizeof(tolerance));
+	key.append((const char*)&flen, sizeof(flen));
+	key += format;
+	key += data;
+	return key;
+}
+
+//search trees are shared between stripes and between identical queries;
+//the grids they were built from are kept to confirm a hit
+#define SEARCH_TREE_CACHE 32
+struct CachedSearchTrees
+{
+	MGrid include;
+	MGrid exclude;
+	MGrid ligand;
+	std::shared_ptr<const ShapeSearchTrees> trees;
+};
+static LRUCache<string, CachedSearchTrees> treeCache;
+
+const float ShapeConstraints::sphereCellSize = 2.0;
+const unsigned ShapeConstraints::maxSphereCells = 4096;
+const int ShapeConstraints::sphereCellLimit = (1 << 20) - 1;
 const double ShapeConstraints::probeRadius = 1.4; //radius of water
 
 //return a "good" transformation to put the query coordinate system into
@@ -137,6 +179,25 @@ bool ShapeConstraints::isMeaningful() const
 	return ingood || exgood;
 }
 
+//only the shape grids prune the shape search, spheres are checked after
+//the fact so they don't reduce the work done
+//the excluded volume removes space a molecule can occupy and molecules
+//must contain the included volume, which gets exponentially less likely
+//as it approaches the size of a typical ligand
+double ShapeConstraints::estimateSelectivity() const
+{
+	double sel = 1.0;
+	double voxelvol = pow(PHARMIT_RESOLUTION, 3);
+	double total = pow(PHARMIT_DIMENSION / PHARMIT_RESOLUTION, 3);
+	if (exclusiveKind == Shape)
+		sel *= max(0.0, 1.0 - excludeGrid.numSet() / total);
+	if (inclusiveKind == Shape)
+	{
+		const double ligandvol = 400.0; //cubic angstroms
+		sel *= exp(-includeGrid.numSet() * voxelvol / ligandvol);
+	}
+	return sel;
+}
 
 //read exclusion sphere points from a json formatted stream
 //and add to excluder
@@ -199,6 +260,7 @@ bool ShapeConstraints::readJSONExclusion(Json::Value& root)
 						double y = jpnt["y"].asDouble();
 						double z = jpnt["z"].asDouble();
 						exspheres.push_back(Sphere(x,y,z,radius));
+						bucketExclusionSphere(exspheres.size()-1);
 
 						//for grid, convert to grid space
 						Vector3d c(x,y,z);
@@ -237,48 +299,72 @@ bool ShapeConstraints::readJSONExclusion(Json::Value& root)
 				tolerance = root["extolerance"].asDouble();
 			}
 
-			//parse receptor
-			OBConversion conv;
 			string rname = root["recname"].asString();
-			conv.SetInFormat(OBConversion::FormatFromExt(rname.c_str()));
-			//ignore bonds since we don't need them and openbabel likes to crash perceiving them
-			conv.AddOption("b",OBConversion::INOPTIONS);
+			string recstr = root["receptor"].asString();
+			string key = gridKey("ex ", recstr, rname, gridtransform, tolerance);
+			LRUCache<string, MGrid>::ValuePtr cached = gridCache.get(key);
+			if(cached)
+			{
+				excludeGrid = *cached;
+			}
+			else
+			{
+				//parse receptor
+				OBConversion conv;
+				conv.SetInFormat(OBConversion::FormatFromExt(rname.c_str()));
+				//ignore bonds since we don't need them and openbabel likes to crash perceiving them
+				conv.AddOption("b",OBConversion::INOPTIONS);
 
-			OBMol rec;
-			conv.ReadString(&rec, root["receptor"].asString());
+				OBMol rec;
+				conv.ReadString(&rec, recstr);
 
-			makeGrid(excludeGrid, rec, gridtransform, tolerance);
+				makeGrid(excludeGrid, rec, gridtransform, tolerance);
+				gridCache.put(key, std::make_shared<MGrid>(excludeGrid), ShapeGridCacheSize);
+			}
 		}
 
-		OBMol lig;
+		bool fromLigand = false; //grid came from an actual ligand
+		string lname, ligstr;
 		if(root["ligand"].isString())
 		{
-			ligandGrid.clear();
-			//parse ligand if available and create grid
-			OBConversion conv;
-			string lname = root["ligandFormat"].asString();
-			conv.SetInFormat(OBConversion::FormatFromExt(lname.c_str()));
-			OBMol lig;
-			conv.ReadString(&lig, root["ligand"].asString());
-
-			double resolution = ligandGrid.getResolution();
-			double dimension = ligandGrid.getDimension();
-
-			//transform to grid space
-			for (OBAtomIterator aitr = lig.BeginAtoms(); aitr != lig.EndAtoms(); ++aitr)
+			fromLigand = true;
+			lname = root["ligandFormat"].asString();
+			ligstr = root["ligand"].asString();
+			string ligkey = gridKey("lig", ligstr, lname, gridtransform, 0);
+			LRUCache<string, MGrid>::ValuePtr cached = gridCache.get(ligkey);
+			if(cached)
 			{
-				OBAtom* atom = *aitr;
-				Vector3d c(atom->x(), atom->y(), atom->z());
-				c = gridtransform*c;
-				atom->SetVector(c.x(), c.y(), c.z());
+				ligandGrid = *cached;
 			}
+			else
+			{
+				ligandGrid.clear();
+				//parse ligand if available and create grid
+				OBConversion conv;
+				conv.SetInFormat(OBConversion::FormatFromExt(lname.c_str()));
+				OBMol lig;
+				conv.ReadString(&lig, ligstr);
+
+				double resolution = ligandGrid.getResolution();
+				double dimension = ligandGrid.getDimension();
+
+				//transform to grid space
+				for (OBAtomIterator aitr = lig.BeginAtoms(); aitr != lig.EndAtoms(); ++aitr)
+				{
+					OBAtom* atom = *aitr;
+					Vector3d c(atom->x(), atom->y(), atom->z());
+					c = gridtransform*c;
+					atom->SetVector(c.x(), c.y(), c.z());
+				}
 
-			//compute grid using obanalytic for closest fidelty to database shapes
-			ShapeObj::MolInfo minfo;
-			ShapeObj obj(lig, Vector3d::Zero(), Matrix3d::Identity(), minfo, dimension, resolution);
-			MappableOctTree *tree = MappableOctTree::create(dimension, resolution, obj);
-			tree->makeGrid(ligandGrid, 0.5);
-			delete tree;
+				//compute grid using obanalytic for closest fidelty to database shapes
+				ShapeObj::MolInfo minfo;
+				ShapeObj obj(lig, Vector3d::Zero(), Matrix3d::Identity(), minfo, dimension, resolution);
+				MappableOctTree *tree = MappableOctTree::create(dimension, resolution, obj);
+				tree->makeGrid(ligandGrid, 0.5);
+				delete tree;
+				gridCache.put(ligkey, std::make_shared<MGrid>(ligandGrid), ShapeGridCacheSize);
+			}
 		}
 		else
 		{
@@ -294,12 +380,29 @@ bool ShapeConstraints::readJSONExclusion(Json::Value& root)
 				tolerance = root["intolerance"].asDouble();
 			}
 
-			includeGrid = ligandGrid;
+			LRUCache<string, MGrid>::ValuePtr cached;
+			string key;
+			if(fromLigand && tolerance != 0)
+			{
+				key = gridKey("in ", ligstr, lname, gridtransform, tolerance);
+				cached = gridCache.get(key);
+			}
 
-			if(tolerance > 0)
-				includeGrid.shrink(tolerance);
-			else if(tolerance < 0)
-				includeGrid.grow(-tolerance);
+			if(cached)
+			{
+				includeGrid = *cached;
+			}
+			else
+			{
+				includeGrid = ligandGrid;
+
+				if(tolerance > 0)
+					includeGrid.shrink(tolerance);
+				else if(tolerance < 0)
+					includeGrid.grow(-tolerance);
+				if(key.length() > 0)
+					gridCache.put(key, std::make_shared<MGrid>(includeGrid), ShapeGridCacheSize);
+			}
 		}
 
 	} catch (std::exception& e)
@@ -311,82 +414,191 @@ bool ShapeConstraints::readJSONExclusion(Json::Value& root)
 	return true;
 }
 
+//set the cells covering lo to hi, return false if they don't fit in a key
+//(or the coordinates aren't finite)
+bool ShapeConstraints::sphereCellRange(float lo, float hi, int& min, int& max)
+{
+	double l = floor(lo / sphereCellSize);
+	double h = floor(hi / sphereCellSize);
+	if (!(l >= -sphereCellLimit && h <= sphereCellLimit))
+		return false;
+	min = l;
+	max = h;
+	return true;
+}
+
+//add exclusion sphere i to every cell its bounding box overlaps; the radius
+//comes from the user, so spheres that would fill too many cells or fall
+//outside the keyable range are kept aside and checked for every point
+void ShapeConstraints::bucketExclusionSphere(unsigned i)
+{
+	const Sphere& s = exspheres[i];
+	float r = sqrt(s.rSq);
+	int minx = 0, maxx = 0, miny = 0, maxy = 0, minz = 0, maxz = 0;
+	if (!sphereCellRange(s.x - r, s.x + r, minx, maxx)
+			|| !sphereCellRange(s.y - r, s.y + r, miny, maxy)
+			|| !sphereCellRange(s.z - r, s.z + r, minz, maxz)
+			|| (double) (maxx - minx + 1) * (maxy - miny + 1) * (maxz - minz + 1)
+					> maxSphereCells)
+	{
+		bigExspheres.push_back(i);
+		return;
+	}
+
+	for (int x = minx; x <= maxx; x++)
+		for (int y = miny; y <= maxy; y++)
+			for (int z = minz; z <= maxz; z++)
+				exsphereCells[sphereCellKey(x, y, z)].push_back(i);
+}
+
+//return true if the point is in any exclusion sphere, only the unbucketed
+//spheres and those bucketed in the point's cell need to be checked so this
+//is exact
+bool ShapeConstraints::inExclusionSphere(float x, float y, float z) const
+{
+	for (unsigned i = 0, n = bigExspheres.size(); i < n; i++)
+	{
+		if (exspheres[bigExspheres[i]].contains(x, y, z))
+			return true;
+	}
+
+	//every bucketed cell is in range, so a point outside it hits none
+	int cx = 0, cy = 0, cz = 0, unused = 0;
+	if (!sphereCellRange(x, x, cx, unused) || !sphereCellRange(y, y, cy, unused)
+			|| !sphereCellRange(z, z, cz, unused))
+		return false;
+	SphereCells::const_iterator itr = exsphereCells.find(
+			sphereCellKey(cx, cy, cz));
+	if (itr == exsphereCells.end())
+		return false;
+	const vector<unsigned>& cell = itr->second;
+	for (unsigned i = 0, n = cell.size(); i < n; i++)
+	{
+		if (exspheres[cell[i]].contains(x, y, z))
+			return true;
+	}
+	return false;
+}
+
+//atoms are transformed in small batches with a single precision affine
+//transform (a loop the compiler can vectorize) and then tested, so we can
+//bail out as soon as any atom is excluded without transforming the rest
+#define EXCLUDE_BATCH 8
+
 bool ShapeConstraints::isExcluded(PMol *mol, const RMSDResult& res) const
 {
 	using namespace Eigen;
-	vector<Vector3f> coords;
 
-	Transform<double, 3, Affine>  transform = Transform<double, 3, Affine>::Identity();
-	Vector3f trans = res.translationVector();
+	//atom to search space
 	Matrix3f rot = res.rotationMatrix();
-	transform.translate(trans.cast<double>());
-	transform.rotate(rot.cast<double>());
+	Vector3f trans = res.translationVector();
+	//atom to grid space
+	Matrix3f grot = gridtransform.linear().cast<float>() * rot;
+	Vector3f gtrans = gridtransform.linear().cast<float>() * trans
+			+ gridtransform.translation().cast<float>();
+
+	const FloatCoord *coords = mol->getCoords();
+	unsigned nc = mol->numAtoms();
 
-	mol->getCoords(coords, transform);
+	bool needsGrid = exclusiveKind == Shape || inclusiveKind == Shape;
+	bool needsSpace = exclusiveKind == Spheres || inclusiveKind == Spheres;
+	bool included = inclusiveKind != Shape; //need a single included heavy atom
 
-	if(exclusiveKind == Shape)
+	float sx[EXCLUDE_BATCH], sy[EXCLUDE_BATCH], sz[EXCLUDE_BATCH];
+	float gx[EXCLUDE_BATCH], gy[EXCLUDE_BATCH], gz[EXCLUDE_BATCH];
+	vector<bool> inSphere(inclusiveKind == Spheres ? inspheres.size() : 0, false);
+	unsigned numInSpheres = 0;
+
+	for (unsigned start = 0; start < nc; start += EXCLUDE_BATCH)
 	{
-		for (unsigned c = 0, nc = coords.size(); c < nc; c++)
+		unsigned n = min((unsigned)EXCLUDE_BATCH, nc - start);
+		const FloatCoord *c = coords + start;
+		if (needsSpace)
+		{
+			for (unsigned i = 0; i < n; i++)
+			{
+				sx[i] = rot(0,0) * c[i].x + rot(0,1) * c[i].y + rot(0,2) * c[i].z + trans[0];
+				sy[i] = rot(1,0) * c[i].x + rot(1,1) * c[i].y + rot(1,2) * c[i].z + trans[1];
+				sz[i] = rot(2,0) * c[i].x + rot(2,1) * c[i].y + rot(2,2) * c[i].z + trans[2];
+			}
+		}
+		if (needsGrid)
 		{
-			const Vector3d& pnt = gridtransform*coords[c].cast<double>();
-			float x = pnt.x();
-			float y = pnt.y();
-			float z = pnt.z();
-			if(excludeGrid.inGrid(x,y,z) && excludeGrid.test(x,y,z))
-				return true;
+			for (unsigned i = 0; i < n; i++)
+			{
+				gx[i] = grot(0,0) * c[i].x + grot(0,1) * c[i].y + grot(0,2) * c[i].z + gtrans[0];
+				gy[i] = grot(1,0) * c[i].x + grot(1,1) * c[i].y + grot(1,2) * c[i].z + gtrans[1];
+				gz[i] = grot(2,0) * c[i].x + grot(2,1) * c[i].y + grot(2,2) * c[i].z + gtrans[2];
+			}
 		}
-	}
-	else if(exclusiveKind == Spheres)
-	{
-		//todo: accelerate with grid?  but it isn't perfect.. evaluate accuracy/performance tradeoff
 
-		//if any coordinate overlaps with any exclusion sphere, no good
-		for(unsigned i = 0, n = exspheres.size(); i < n; i++)
+		for (unsigned i = 0; i < n; i++)
 		{
-			for (unsigned c = 0, nc = coords.size(); c < nc; c++)
+			if (exclusiveKind == Shape)
 			{
-				const Vector3f& pnt = coords[c];
-				if(exspheres[i].contains(pnt.x(),pnt.y(),pnt.z()))
+				if (excludeGrid.testInGrid(gx[i], gy[i], gz[i]))
+					return true;
+			}
+			else if (exclusiveKind == Spheres)
+			{
+				if (inExclusionSphere(sx[i], sy[i], sz[i]))
 					return true;
 			}
-		}
-	}
 
-	if(inclusiveKind == Shape)
-	{
-		//as long as a single heavy atom is included, we are good
-		bool nogood = true;
-		for (unsigned c = 0, nc = coords.size(); c < nc && nogood; c++)
-		{
-			const Vector3d& pnt = gridtransform*coords[c].cast<double>();
-			float x = pnt.x();
-			float y = pnt.y();
-			float z = pnt.z();
-			if(includeGrid.inGrid(x,y,z) && includeGrid.test(x,y,z))
-				nogood = false;
-		}
-		if(nogood) //nothing overlapped
-			return true;
-	}
-	else if(inclusiveKind == Spheres)
-	{
-		//at least one atom must overlap inclusion sphere
-		for(unsigned i = 0, n = inspheres.size(); i < n; i++)
-		{
-			unsigned c = 0, nc = coords.size();
-			for ( ; c < nc; c++)
+			if (!included && includeGrid.testInGrid(gx[i], gy[i], gz[i]))
+				included = true;
+
+			//every inclusion sphere must be overlapped by some atom
+			for (unsigned s = 0, ns = inSphere.size(); s < ns; s++)
 			{
-				const Vector3f& pnt = coords[c];
-				if(inspheres[i].contains(pnt.x(),pnt.y(),pnt.z()))
-					break;
+				if (!inSphere[s] && inspheres[s].contains(sx[i], sy[i], sz[i]))
+				{
+					inSphere[s] = true;
+					numInSpheres++;
+				}
 			}
-			if(c == nc) //nothing overlapped
-				return true;
 		}
 	}
+
+	if (!included) //nothing overlapped
+		return true;
+	if (numInSpheres < inSphere.size())
+		return true;
 	return false;
 }
 
+//identify the trees by the contents of the grids they are built from, the
+//hashes only find the candidate and the grids themselves must match
+std::shared_ptr<const ShapeSearchTrees> ShapeConstraints::getSearchTrees() const
+{
+	size_t hashes[6] = { includeGrid.hash(), excludeGrid.hash(), ligandGrid.hash(),
+			includeGrid.numSet(), excludeGrid.numSet(), ligandGrid.numSet() };
+	string key((const char*) hashes, sizeof(hashes));
+
+	LRUCache<string, CachedSearchTrees>::ValuePtr cached = treeCache.get(key);
+	if (cached && cached->include == includeGrid
+			&& cached->exclude == excludeGrid && cached->ligand == ligandGrid)
+		return cached->trees;
+
+	std::shared_ptr<ShapeSearchTrees> trees = std::make_shared<ShapeSearchTrees>();
+	trees->small = std::shared_ptr<const MappableOctTree>(
+			MappableOctTree::createFromGrid(includeGrid), free);
+	MappableOctTree *big = MappableOctTree::createFromGrid(excludeGrid);
+	big->invert();
+	trees->big = std::shared_ptr<const MappableOctTree>(big, free);
+	trees->lig = std::shared_ptr<const MappableOctTree>(
+			MappableOctTree::createFromGrid(ligandGrid), free);
+
+	//a colliding entry is replaced
+	std::shared_ptr<CachedSearchTrees> entry = std::make_shared<CachedSearchTrees>();
+	entry->include = includeGrid;
+	entry->exclude = excludeGrid;
+	entry->ligand = ligandGrid;
+	entry->trees = trees;
+	treeCache.put(key, entry, SEARCH_TREE_CACHE);
+	return trees;
+}
+
 void ShapeConstraints::addToJSON(Json::Value& root) const
 {
 	Json::Value jpoints = root["points"];
@@ -420,13 +632,39 @@ static double Round2(double num)
     return round(num * 100.0)/100.0;
 }
 
-//set json formatted mesh of provided grid
-void ShapeConstraints::getMesh(MGrid& grid, Json::Value& mesh)
+//base64 encode len bytes of data
+static string base64Encode(const char *data, unsigned long len)
 {
-	Json::Value& verts = mesh["vertexArr"] =  Json::arrayValue;
-	Json::Value& norms =mesh["normalArr"] =  Json::arrayValue;
-	Json::Value& jfaces = mesh["faceArr"] =  Json::arrayValue;
+	static const char table[] =
+			"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	string ret;
+	ret.reserve((len + 2) / 3 * 4);
+	const unsigned char *d = (const unsigned char*) data;
+	unsigned long i = 0;
+	for (; i + 2 < len; i += 3)
+	{
+		unsigned v = (d[i] << 16) | (d[i + 1] << 8) | d[i + 2];
+		ret += table[(v >> 18) & 63];
+		ret += table[(v >> 12) & 63];
+		ret += table[(v >> 6) & 63];
+		ret += table[v & 63];
+	}
+	if (i < len) //one or two bytes left over
+	{
+		unsigned v = d[i] << 16;
+		if (i + 1 < len)
+			v |= d[i + 1] << 8;
+		ret += table[(v >> 18) & 63];
+		ret += table[(v >> 12) & 63];
+		ret += i + 1 < len ? table[(v >> 6) & 63] : '=';
+		ret += '=';
+	}
+	return ret;
+}
 
+//set json formatted mesh of provided grid
+void ShapeConstraints::getMesh(MGrid& grid, Json::Value& mesh, bool typedArrays)
+{
 	vector<Vector3f> vertices;
 	vector<Vector3f> normals;
 	vector<int> faces;
@@ -434,14 +672,50 @@ void ShapeConstraints::getMesh(MGrid& grid, Json::Value& mesh)
 	//create mesh from mgrid
 	grid.makeMesh(vertices, normals, faces);
 
+	Affine3d trans = gridtransform.inverse();
+
+	if(typedArrays)
+	{
+		//flat xyz float32 and uint32 arrays that the client can view directly
+		vector<float> coords;
+		coords.reserve(vertices.size()*3);
+		for(unsigned i = 0, n = vertices.size(); i < n; i++)
+		{
+			Vector3d v = trans*vertices[i].cast<double>();
+			coords.push_back(v.x());
+			coords.push_back(v.y());
+			coords.push_back(v.z());
+		}
+		vector<float> norms;
+		norms.reserve(normals.size()*3);
+		for(unsigned i = 0, n = normals.size(); i < n; i++)
+		{
+			Vector3d norm = normals[i].cast<double>();
+			norm.normalize();
+			Vector3d v = trans.linear()*norm;
+			norms.push_back(v.x());
+			norms.push_back(v.y());
+			norms.push_back(v.z());
+		}
+		vector<uint32_t> indices(faces.begin(), faces.end());
+
+		mesh["encoding"] = "base64";
+		mesh["vertices"] = base64Encode((const char*)coords.data(), coords.size()*sizeof(float));
+		mesh["normals"] = base64Encode((const char*)norms.data(), norms.size()*sizeof(float));
+		mesh["faces"] = base64Encode((const char*)indices.data(), indices.size()*sizeof(uint32_t));
+		return;
+	}
+
+	Json::Value& verts = mesh["vertexArr"] =  Json::arrayValue;
+	Json::Value& norms =mesh["normalArr"] =  Json::arrayValue;
+	Json::Value& jfaces = mesh["faceArr"] =  Json::arrayValue;
+
 	//copy face indices
 	for(unsigned i = 0, n = faces.size(); i < n; i++)
 	{
 		jfaces[i] = faces[i];
 	}
 
-	Affine3d trans = gridtransform.inverse();
-
 	//have to transform vertices and normals
 	for(unsigned i = 0, n = vertices.size(); i < n; i++)
 	{
@@ -464,14 +738,14 @@ void ShapeConstraints::getMesh(MGrid& grid, Json::Value& mesh)
 }
 
 //set json formated mesh of exclusive grid
-void ShapeConstraints::getExclusiveMesh(Json::Value& mesh)
+void ShapeConstraints::getExclusiveMesh(Json::Value& mesh, bool typedArrays)
 {
-	getMesh(excludeGrid, mesh);
+	getMesh(excludeGrid, mesh, typedArrays);
 }
 
-void ShapeConstraints::getInclusiveMesh(Json::Value& mesh)
+void ShapeConstraints::getInclusiveMesh(Json::Value& mesh, bool typedArrays)
 {
-	getMesh(includeGrid, mesh);
+	getMesh(includeGrid, mesh, typedArrays);
 }
 
 void ShapeConstraints::computeInteractionPoints(OBMol& ligand, OBMol& receptor, vector<Vector3d>& points)
@@ -482,3 +756,12 @@ void ShapeConstraints::computeInteractionPoints(OBMol& ligand, OBMol& receptor,
 	ShapeObj obj(ligand, Vector3d::Zero(), Matrix3d::Identity(), minfo, PHARMIT_DIMENSION, PHARMIT_RESOLUTION);
 	obj.computeInteractionPoints(receptor, points);
 }
+
+//receptor is just the atom coordinates
+void ShapeConstraints::computeInteractionPoints(OBMol& ligand, const vector<Vector3d>& receptor, vector<Vector3d>& points)
+{
+	points.clear();
+	ShapeObj::MolInfo minfo;
+	ShapeObj obj(ligand, Vector3d::Zero(), Matrix3d::Identity(), minfo, PHARMIT_DIMENSION, PHARMIT_RESOLUTION);
+	obj.computeInteractionPoints(receptor, points);
+}
@@ -32,12 +32,23 @@ See the LICENSE file provided with the distribution for more information.
 #include "MGrid.h"
 #include <json/json.h>
 #include <vector>
+#include <boost/unordered_map.hpp>
 #include <eigen3/Eigen/Core>
 #include <eigen3/Eigen/Geometry>
 #include "ShapeObj.h"
 
 using namespace std;
 
+class MappableOctTree;
+
+//octrees for searching a shape index, built from the constraint grids
+struct ShapeSearchTrees
+{
+	std::shared_ptr<const MappableOctTree> small; //inclusive
+	std::shared_ptr<const MappableOctTree> big; //exclusive, inverted
+	std::shared_ptr<const MappableOctTree> lig;
+};
+
 class ShapeConstraints
 {
 	struct Sphere
@@ -64,6 +75,26 @@ class ShapeConstraints
 	vector<Sphere> exspheres; //exclusion spheres - can't overlap any
 	vector<Sphere> inspheres; //inclusion spheres - must overlap all
 
+	//exclusion spheres bucketed by the uniform grid cells they overlap so
+	//an atom only has to be checked against nearby spheres
+	static const float sphereCellSize;
+	static const unsigned maxSphereCells; //larger spheres aren't bucketed
+	static const int sphereCellLimit; //cell coordinates must be in +/- this
+	typedef boost::unordered_map<unsigned long, vector<unsigned> > SphereCells;
+	SphereCells exsphereCells;
+	vector<unsigned> bigExspheres; //too large or far out to bucket, always checked
+
+	//x, y and z must be within sphereCellLimit so they fit in 21 bits
+	static unsigned long sphereCellKey(int x, int y, int z)
+	{
+		return ((unsigned long) (x + (1 << 20)) << 42)
+				| ((unsigned long) (y + (1 << 20)) << 21)
+				| (unsigned long) (z + (1 << 20));
+	}
+	static bool sphereCellRange(float lo, float hi, int& min, int& max);
+	void bucketExclusionSphere(unsigned i);
+	bool inExclusionSphere(float x, float y, float z) const;
+
 	MGrid excludeGrid;
 	MGrid includeGrid;
 	MGrid ligandGrid;
@@ -74,7 +105,7 @@ class ShapeConstraints
 
 	static const double probeRadius;
 
-	void getMesh(MGrid& grid, Json::Value& mesh);
+	void getMesh(MGrid& grid, Json::Value& mesh, bool typedArrays);
 
 	enum Kind {None, Shape, Spheres};
 
@@ -101,12 +132,16 @@ public:
 	bool isFullyDefined() const { return inclusiveKind != None && exclusiveKind != None; }
 	bool isMeaningful() const;
 
-	void clear() { exspheres.clear(); inspheres.clear(); }
+	//rough fraction of conformers expected to pass the shape search
+	double estimateSelectivity() const;
+
+	void clear() { exspheres.clear(); inspheres.clear(); exsphereCells.clear(); bigExspheres.clear(); }
 
 	void enableExclusionSpheres() { exclusiveKind = Spheres; }
 	void addExclusionSphere(float x, float y, float z, float r)
 	{
 		exspheres.push_back(Sphere(x,y,z,r));
+		bucketExclusionSphere(exspheres.size()-1);
 	}
 
 	void enableInclusionSpheres() { inclusiveKind = Spheres; }
@@ -115,15 +150,22 @@ public:
 		inspheres.push_back(Sphere(x,y,z,r));
 	}
 
-	void getExclusiveMesh(Json::Value& mesh);
-	void getInclusiveMesh(Json::Value& mesh);
+	//with typedArrays the vertices and faces are sent as base64 encoded
+	//little endian float32/uint32 arrays instead of json objects
+	void getExclusiveMesh(Json::Value& mesh, bool typedArrays = false);
+	void getInclusiveMesh(Json::Value& mesh, bool typedArrays = false);
 
 	const MGrid& getExclusiveGrid() const { return excludeGrid; }
 	const MGrid& getInclusiveGrid() const { return includeGrid; }
 	const MGrid& getLigandGrid() const { return ligandGrid; }
 
 	Eigen::Affine3d getGridTransform() const { return gridtransform; }
+
+	//return search trees for the current grids, these are expensive to build
+	//so the same trees are shared by identical constraints
+	std::shared_ptr<const ShapeSearchTrees> getSearchTrees() const;
 	static void computeInteractionPoints(OpenBabel::OBMol& ligand, OpenBabel::OBMol& receptor, vector<Eigen::Vector3d>& points);
+	static void computeInteractionPoints(OpenBabel::OBMol& ligand, const vector<Eigen::Vector3d>& receptor, vector<Eigen::Vector3d>& points);
 };
 
 #endif /* PHARMITSERVER_SHAPECONSTRAINTS_H_ */
@@ -0,0 +1,127 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * ShardProtocol.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      Wire format spoken between a query server and the shard servers
+ *      that search stripes of a library on other machines.  Every message
+ *      is a fixed header followed by length bytes of payload.  Results are
+ *      sent as raw CorrespondenceResult records, so both ends must be built
+ *      from the same source; the record size sent before any results
+ *      guards against mismatches.
+ *
+ *      Search: subset\0query json -> Header(record size) Results* End
+ *                                     or Error(msg)
+ *              the client may send Cancel at any time during a search
+ *      GetMol: subset\0location*  -> MolRecords* End or Error
+ *              each MolRecords is a count, that many sizes, and then the
+ *              raw MolData records, an unavailable record has size 0
+ *      Info:                       -> Info(json of served subsets)
+ */
+
+#ifndef PHARMITSERVER_SHARDPROTOCOL_H_
+#define PHARMITSERVER_SHARDPROTOCOL_H_
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <poll.h>
+#include <boost/asio.hpp>
+
+#define SHARD_MAGIC (0x44534850) //"PHSD"
+#define SHARD_MAX_PAYLOAD (1U << 30) //sanity check on untrusted lengths
+#define SHARD_HEARTBEAT_MS (1000) //servers send (possibly empty) results at least this often
+#define SHARD_MOL_BATCH (256) //records per MolRecords message
+
+namespace ShardOp
+{
+enum ShardOp
+{
+	Info = 1, Search, GetMol, Cancel, Header, Results, End, MolRecords, Error
+};
+}
+
+struct ShardFrame
+{
+	uint32_t magic;
+	uint8_t op;
+	uint32_t length;
+
+	ShardFrame(): magic(SHARD_MAGIC), op(0), length(0) {}
+	ShardFrame(unsigned o, unsigned len): magic(SHARD_MAGIC), op(o), length(len) {}
+}__attribute__((__packed__));
+
+//write a single message, return false on error
+inline bool writeShardFrame(boost::asio::ip::tcp::socket& sock, unsigned op,
+		const void *data = NULL, unsigned len = 0)
+{
+	ShardFrame frame(op, len);
+	boost::system::error_code ec;
+	boost::asio::write(sock, boost::asio::buffer(&frame, sizeof(frame)), ec);
+	if (!ec && len > 0)
+		boost::asio::write(sock, boost::asio::buffer(data, len), ec);
+	return !ec;
+}
+
+inline bool writeShardFrame(boost::asio::ip::tcp::socket& sock, unsigned op,
+		const std::string& data)
+{
+	return writeShardFrame(sock, op, data.data(), data.size());
+}
+
+//read a single message into frame and payload, return false on error
+inline bool readShardFrame(boost::asio::ip::tcp::socket& sock,
+		ShardFrame& frame, std::vector<char>& payload)
+{
+	boost::system::error_code ec;
+	boost::asio::read(sock, boost::asio::buffer(&frame, sizeof(frame)), ec);
+	if (ec || frame.magic != SHARD_MAGIC || frame.length > SHARD_MAX_PAYLOAD)
+		return false;
+	payload.resize(frame.length);
+	if (frame.length > 0)
+		boost::asio::read(sock, boost::asio::buffer(&payload[0], frame.length), ec);
+	return !ec;
+}
+
+//wait at most ms milliseconds for data to arrive on sock, asio's blocking
+//reads ignore socket timeouts so poll the descriptor directly
+inline bool shardReadable(boost::asio::ip::tcp::socket& sock, int ms)
+{
+	struct pollfd pfd;
+	pfd.fd = sock.native_handle();
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, ms) > 0;
+}
+
+//split a subset\0rest payload
+inline bool splitShardPayload(const std::vector<char>& payload,
+		std::string& subset, std::string& rest)
+{
+	std::vector<char>::const_iterator z = std::find(payload.begin(),
+			payload.end(), '\0');
+	if (z == payload.end())
+		return false;
+	subset.assign(payload.begin(), z);
+	rest.assign(z + 1, payload.end());
+	return true;
+}
+
+#endif /* PHARMITSERVER_SHARDPROTOCOL_H_ */
@@ -0,0 +1,274 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * ShardServer.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ShardServer.h"
+#include "ShardProtocol.h"
+#include "PharmerQuery.h"
+#include "Timer.h"
+
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+extern cl::opt<bool> Quiet;
+
+typedef boost::unordered_map<string, StripedSearchers> ShardMap;
+
+//return the subset with stripes named by name, null if there isn't one
+//(never insert, the map is shared by all connections)
+static StripedSearchers* findSubset(ShardMap& databases, const string& name)
+{
+	ShardMap::iterator itr = databases.find(name);
+	if (itr == databases.end() || itr->second.stripes.size() == 0)
+		return NULL;
+	return &itr->second;
+}
+
+static void sendError(tcp::socket& sock, const string& msg)
+{
+	writeShardFrame(sock, ShardOp::Error, msg);
+}
+
+//describe every subset we serve
+static void sendInfo(tcp::socket& sock, ShardMap& databases)
+{
+	Json::Value root;
+	for (ShardMap::iterator itr = databases.begin(); itr != databases.end(); ++itr)
+	{
+		StripedSearchers& s = itr->second;
+		if (s.stripes.size() == 0)
+			continue;
+		Json::Value& sub = root[itr->first];
+		sub["info"] = s.stripes[0]->getJSON();
+		sub["numMols"] = (Json::UInt64) s.totalMols;
+		sub["numConfs"] = (Json::UInt64) s.totalConfs;
+		sub["hasShape"] = s.hasShape;
+		sub["stripes"] = (unsigned) s.stripes.size();
+
+		//the client needs our features to interpret queries like we do
+		stringstream pharmas;
+		s.stripes[0]->getPharmas().write(pharmas);
+		sub["pharmas"] = pharmas.str();
+
+		//molids are interleaved across stripes, bound what we'll send
+		unsigned long maxMols = 0;
+		for (unsigned i = 0, n = s.stripes.size(); i < n; i++)
+			maxMols = max(maxMols, (unsigned long) s.stripes[i]->numMolecules());
+		sub["molIDs"] = (Json::UInt64) (maxMols * s.stripes.size());
+	}
+	Json::FastWriter writer;
+	writeShardFrame(sock, ShardOp::Info, writer.write(root));
+}
+
+//stream back the requested records in batches
+static void sendMolRecords(tcp::socket& sock, ShardMap& databases,
+		const vector<char>& payload)
+{
+	string subset, rest;
+	StripedSearchers *searchers = NULL;
+	if (!splitShardPayload(payload, subset, rest)
+			|| rest.size() % sizeof(uint64_t) != 0
+			|| (searchers = findSubset(databases, subset)) == NULL)
+	{
+		sendError(sock, "Invalid molecule request.");
+		return;
+	}
+	searchers->activate();
+
+	//locations are interleaved across stripes just like in a local query
+	vector<std::shared_ptr<PharmerDatabaseSearcher> >& stripes =
+			searchers->stripes;
+	unsigned n = stripes.size();
+	unsigned num = rest.size() / sizeof(uint64_t);
+	string batch;
+	for (unsigned start = 0; start < num; start += SHARD_MOL_BATCH)
+	{
+		uint32_t cnt = min(num - start, (unsigned) SHARD_MOL_BATCH);
+		vector<uint32_t> sizes(cnt, 0);
+		vector<const unsigned char*> recs(cnt, (const unsigned char*) NULL);
+		for (unsigned i = 0; i < cnt; i++)
+		{
+			uint64_t loc = 0;
+			memcpy(&loc, rest.data() + (start + i) * sizeof(loc), sizeof(loc));
+			unsigned sz = 0;
+			recs[i] = stripes[loc % n]->getMolRecord(loc / n, sz);
+			if (recs[i])
+				sizes[i] = sz;
+		}
+
+		batch.assign((const char*) &cnt, sizeof(cnt));
+		batch.append((const char*) &sizes[0], cnt * sizeof(uint32_t));
+		for (unsigned i = 0; i < cnt; i++)
+		{
+			if (recs[i])
+				batch.append((const char*) recs[i], sizes[i]);
+		}
+		if (!writeShardFrame(sock, ShardOp::MolRecords, batch))
+			return;
+	}
+	writeShardFrame(sock, ShardOp::End);
+}
+
+//run a query on all the stripes of the subset and stream back the
+//correspondences as they are produced
+static void runSearch(tcp::socket& sock, ShardMap& databases,
+		const vector<char>& payload)
+{
+	string subset, text;
+	StripedSearchers *subsetp = NULL;
+	if (!splitShardPayload(payload, subset, text)
+			|| (subsetp = findSubset(databases, subset)) == NULL)
+	{
+		sendError(sock, "Unknown subset.");
+		return;
+	}
+	StripedSearchers& searchers = *subsetp;
+	searchers.activate();
+
+	Json::Value data;
+	Json::Reader reader;
+	if (!reader.parse(text, data))
+	{
+		sendError(sock, "Invalid query.");
+		return;
+	}
+
+	QueryParameters qp(data);
+	vector<PharmaPoint> points;
+	readPharmaPointsJSON(searchers.stripes[0]->getPharmas(), data, points);
+	ShapeConstraints excluder;
+	excluder.readJSONExclusion(data);
+
+	unsigned nthreads = min(boost::thread::hardware_concurrency(),
+			(unsigned) searchers.stripes.size());
+	PharmerQuery query(searchers.stripes, points, qp, excluder, nthreads);
+	string msg;
+	if (!query.isValid(msg))
+	{
+		sendError(sock, msg);
+		return;
+	}
+
+	uint32_t rsize = sizeof(CorrespondenceResult)
+			+ query.numQueryPoints() * sizeof(matchType);
+	Timer t;
+	unsigned long cnt = 0;
+	bool ok = writeShardFrame(sock, ShardOp::Header, &rsize, sizeof(rsize));
+	if (ok)
+		query.execute(false);
+
+	vector<CorrespondenceResult*> corrs;
+	string batch;
+	double lastsent = 0;
+	while (ok)
+	{
+		bool more = query.drainResults(corrs);
+		if (corrs.size() > 0 || t.elapsed() - lastsent > SHARD_HEARTBEAT_MS / 2000.0)
+		{ //results, or an empty batch so the client knows we are alive
+			batch.resize(corrs.size() * rsize);
+			for (unsigned i = 0, n = corrs.size(); i < n; i++)
+				memcpy(&batch[i * rsize], (void*) corrs[i], rsize);
+			ok = writeShardFrame(sock, ShardOp::Results, batch);
+			cnt += corrs.size();
+			lastsent = t.elapsed();
+		}
+
+		//the only thing a client says during a search is cancel
+		if (ok && sock.available() > 0)
+		{
+			ShardFrame frame;
+			vector<char> dummy;
+			readShardFrame(sock, frame, dummy);
+			ok = false;
+		}
+		if (ok && !more)
+		{
+			writeShardFrame(sock, ShardOp::End);
+			break;
+		}
+		if (ok && corrs.size() == 0)
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	}
+
+	if (!ok) //client is gone or cancelled
+		query.cancel();
+	while (!query.finished())
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+	if (!Quiet)
+		cout << "Shard search " << subset << " " << cnt << " results "
+				<< t.elapsed() << (ok ? "s\n" : "s (cancelled)\n");
+}
+
+static void serveConnection(std::shared_ptr<tcp::socket> sock,
+		ShardMap *databases)
+{
+	boost::system::error_code ec;
+	sock->set_option(tcp::no_delay(true), ec);
+	ShardFrame frame;
+	vector<char> payload;
+	try
+	{
+		while (readShardFrame(*sock, frame, payload))
+		{
+			switch (frame.op)
+			{
+			case ShardOp::Info:
+				sendInfo(*sock, *databases);
+				break;
+			case ShardOp::Search:
+				runSearch(*sock, *databases, payload);
+				break;
+			case ShardOp::GetMol:
+				sendMolRecords(*sock, *databases, payload);
+				break;
+			case ShardOp::Cancel: //search already finished
+				break;
+			default:
+				sendError(*sock, "Unknown request.");
+				return;
+			}
+		}
+	} catch (std::exception& e) //don't let one bad request take down the shard
+	{
+		cerr << "Exception in shard connection: " << e.what() << "\n";
+	}
+}
+
+void shard_server(unsigned port, ShardMap& databases)
+{
+	io_service io;
+	tcp::acceptor acceptor(io, tcp::endpoint(tcp::v4(), port));
+	cout << "Shard server listening on " << port << "\n";
+	while (true)
+	{
+		std::shared_ptr<tcp::socket> sock(new tcp::socket(io));
+		boost::system::error_code ec;
+		acceptor.accept(*sock, ec);
+		if (ec)
+		{
+			cerr << "Shard accept failed: " << ec.message() << "\n";
+			continue;
+		}
+		boost::thread serve(serveConnection, sock, &databases);
+		serve.detach();
+	}
+}
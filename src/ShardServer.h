@@ -0,0 +1,39 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * ShardServer.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      Serves searches of the local stripes of a set of libraries to query
+ *      servers on other machines (see ShardProtocol.h).
+ */
+
+#ifndef PHARMITSERVER_SHARDSERVER_H_
+#define PHARMITSERVER_SHARDSERVER_H_
+
+#include <string>
+#include <boost/unordered_map.hpp>
+#include "pharmerdb.h"
+
+using namespace std;
+
+//listen on port forever, each connection is handled in its own thread
+void shard_server(unsigned port,
+		boost::unordered_map<string, StripedSearchers>& databases);
+
+#endif /* PHARMITSERVER_SHARDSERVER_H_ */
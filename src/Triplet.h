@@ -1056,6 +1056,13 @@ public:
 		}
 	}
 
+	//return true if a triplet whose fingerprint bits are all within f could
+	//pass the fingerprint check, validity only grows with more bits set
+	bool fingerprintPossible(const TripletFingerprint& f) const
+	{
+		return skipfingers || fingerprint.isValid(f);
+	}
+
 	//return true if there is any possibility of overlap
 	//between the triplet 3-space and the box
 	bool inRange(const BoundingBox& box) const
@@ -73,14 +73,14 @@ string cgiDump(Cgicc& cgi)
 }
 
 cgicc::FastCgiIO::FastCgiIO(FCGX_Request& request) :
-	std::ostream(&fOutBuf), fRequest(request), fOutBuf(request.out), fErrBuf(
+	std::ostream(&fOutBuf), fRequest(&request), fInPos(0), fOutBuf(request.out), fErrBuf(
 			request.err), fErr(&fErrBuf)
 {
 	rdbuf(&fOutBuf);
 	fErr.rdbuf(&fErrBuf);
 
 	// Parse environment
-	for (char **e = fRequest.envp; *e != NULL; ++e)
+	for (char **e = fRequest->envp; *e != NULL; ++e)
 	{
 		std::string s(*e);
 		std::string::size_type i = s.find('=');
@@ -90,10 +90,21 @@ cgicc::FastCgiIO::FastCgiIO(FCGX_Request& request) :
 	}
 }
 
+//errors are discarded since there is no fastcgi stream to send them to
+cgicc::FastCgiIO::FastCgiIO(std::streambuf *out,
+		const std::map<std::string, std::string>& env, const std::string& in) :
+	std::ostream(out), fRequest(NULL), fIn(in), fInPos(0), fErr(NULL), fEnv(env)
+{
+	rdbuf(out);
+}
+
 cgicc::FastCgiIO::FastCgiIO(const FastCgiIO& io) :
-	CgiInput(io), std::ostream(&fOutBuf), fRequest(io.fRequest),
-			fErr(&fErrBuf), fEnv(io.fEnv)
+	CgiInput(io), std::ostream(&fOutBuf), fRequest(io.fRequest), fIn(io.fIn),
+			fInPos(io.fInPos), fErr(&fErrBuf), fEnv(io.fEnv)
 {
-	rdbuf(&fOutBuf);
+	if (fRequest)
+		rdbuf(&fOutBuf);
+	else
+		rdbuf(io.rdbuf());
 	fErr.rdbuf(&fErrBuf);
 }
@@ -76,13 +76,22 @@ class FastCgiIO : public cgicc::CgiInput, public std::ostream
 public:
 
 	FastCgiIO(FCGX_Request& request);
+	//a request that has already been completely read in (e.g. by the
+	//event server), output goes to out
+	FastCgiIO(std::streambuf *out, const std::map<std::string, std::string>& env,
+			const std::string& in);
 	FastCgiIO(const FastCgiIO& io);
 	virtual inline ~FastCgiIO()
 	{}
 
 	virtual inline size_t read(char *data, size_t length)
 	{
-		return FCGX_GetStr(data, length, fRequest.in);
+		if (fRequest)
+			return FCGX_GetStr(data, length, fRequest->in);
+
+		size_t n = fIn.copy(data, length, fInPos);
+		fInPos += n;
+		return n;
 	}
 
 	virtual inline std::string getenv(const char *varName)
@@ -97,7 +106,9 @@ public:
 	//@}
 
 protected:
-	FCGX_Request& fRequest;
+	FCGX_Request *fRequest; //null if buffered
+	std::string fIn; //buffered input
+	size_t fInPos;
 	fcgi_streambuf fOutBuf;
 	fcgi_streambuf fErrBuf;
 	std::ostream fErr;
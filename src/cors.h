@@ -177,6 +177,8 @@ public:
 		allocator.clear();
 	}
 
+	void setAccountant(MemoryAccountant *acct) { allocator.setAccountant(acct); }
+
 	unsigned numChunks() const { return allocator.numChunks(); }
 };
 
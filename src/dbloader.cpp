@@ -21,8 +21,11 @@ See the LICENSE file provided with the distribution for more information.
  */
 
 #include "dbloader.h"
+#include "NumaTopology.h"
 #include <glob.h>
+#include <climits>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/thread/barrier.hpp>
 using namespace boost;
 using namespace std;
 
@@ -40,14 +43,34 @@ struct LoadDatabase
 	}
 
 	void operator()( std::shared_ptr<PharmerDatabaseSearcher>& database, unsigned i,
-			boost::filesystem::path dbpath)
+			boost::filesystem::path dbpath, boost::barrier& resident)
 	{
+		//this thread only loads this stripe, so bind it to the stripe's node
+		//and anything it allocates or faults in lands there
+		unsigned node = 0;
+		if (NumaTopology::enabled())
+		{
+			node = NumaTopology::get().nodeForStripe(i);
+			NumaTopology::get().bindThread(node);
+		}
+
 		std::shared_ptr<PharmerDatabaseSearcher> db(new PharmerDatabaseSearcher(dbpath));
+		db->setNumaNode(node);
+		if (NumaTopology::enabled() && db->isValid())
+			db->preload();
 
 		if (!db->isValid())
 		{
 			cerr << "Error reading database " << dbpath;
 		}
+
+		//every stripe claims resident memory for a tier before any moves
+		//on to the next, copying from this thread so it stays on the node
+		for (unsigned t = 0; t < PharmerDatabaseSearcher::ResidentTiers; t++)
+		{
+			db->makeResident(t);
+			resident.wait();
+		}
 		totalConf += db->numConformations();
 		totalMols += db->numMolecules();
 		hasShape &= db->hasShape();
@@ -60,9 +83,8 @@ void loadDatabases(vector<boost::filesystem::path>& dbpaths, StripedSearchers& d
 {
 	databases.totalConfs = 0;
 	databases.totalMols = 0;
-	databases.stripes.reserve(dbpaths.size());
 	vector<LoadDatabase> loaders(dbpaths.size());
-	thread_group loading_threads;
+	vector<unsigned> present;
 	for (unsigned i = 0, n = dbpaths.size(); i < n; i++)
 	{
 		if (!boost::filesystem::is_directory(dbpaths[i]))
@@ -70,10 +92,20 @@ void loadDatabases(vector<boost::filesystem::path>& dbpaths, StripedSearchers& d
 			cerr << "Invalid database directory path: " << dbpaths[i] << "\n";
 			continue; //be tolerant of missing slices exit(-1);
 		}
+		present.push_back(i);
+	}
+	if (present.size() == 0)
+		return;
 
-		databases.stripes.push_back(std::shared_ptr<PharmerDatabaseSearcher>());
+	unsigned base = databases.stripes.size();
+	databases.stripes.resize(base + present.size());
+	boost::barrier resident(present.size());
+	thread_group loading_threads;
+	for (unsigned s = 0, n = present.size(); s < n; s++)
+	{
+		unsigned i = present[s];
 		loading_threads.add_thread(
-				new boost::thread(boost::ref(loaders[i]), boost::ref(databases.stripes.back()), i, dbpaths[i]));
+				new boost::thread(boost::ref(loaders[i]), boost::ref(databases.stripes[base + s]), i, dbpaths[i], boost::ref(resident)));
 	}
 	loading_threads.join_all();
 
@@ -188,3 +220,52 @@ void loadNewFromPrefixes(vector<boost::filesystem::path>& prefixes,
 		}
 	}
 }
+
+void loadShards(const vector<string>& addresses,
+		boost::unordered_map<string, StripedSearchers >& databases)
+{
+	for(unsigned i = 0, n = addresses.size(); i < n; i++)
+	{
+		vector<std::shared_ptr<RemoteShard> > shards;
+		if(!RemoteShard::discover(addresses[i], shards))
+			continue; //be tolerant of missing shards
+
+		for(unsigned s = 0, ns = shards.size(); s < ns; s++)
+		{
+			StripedSearchers& searchers = databases[shards[s]->getSubset()];
+			searchers.shards.push_back(shards[s]);
+			searchers.totalConfs += shards[s]->numConformations();
+			searchers.totalMols += shards[s]->numMolecules();
+			searchers.hasShape &= shards[s]->hasShape();
+		}
+	}
+
+	//a shard's molids are wrapped in our sources (molid * sources + source),
+	//drop any shard whose ids won't fit
+	vector<string> empty;
+	for (boost::unordered_map<string, StripedSearchers>::iterator itr =
+			databases.begin(); itr != databases.end(); ++itr)
+	{
+		StripedSearchers& searchers = itr->second;
+		unsigned long nsrc = searchers.stripes.size() + searchers.shards.size();
+		vector<std::shared_ptr<RemoteShard> > fits;
+		for(unsigned s = 0, ns = searchers.shards.size(); s < ns; s++)
+		{
+			std::shared_ptr<RemoteShard> shard = searchers.shards[s];
+			if(shard->molIDBound() * nsrc > UINT_MAX)
+			{
+				cerr << "Shard " << shard->getName() << " has too many molecules to combine with "
+						<< nsrc << " sources\n";
+				searchers.totalConfs -= shard->numConformations();
+				searchers.totalMols -= shard->numMolecules();
+			}
+			else
+				fits.push_back(shard);
+		}
+		searchers.shards.swap(fits);
+		if(searchers.stripes.size() == 0 && searchers.shards.size() == 0)
+			empty.push_back(itr->first);
+	}
+	for(unsigned i = 0, n = empty.size(); i < n; i++)
+		databases.erase(empty[i]);
+}
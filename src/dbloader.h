@@ -38,4 +38,6 @@ void loadFromPrefixes(vector<boost::filesystem::path>& prefixes, boost::unordere
 void loadNewFromPrefixes(vector<boost::filesystem::path>& prefixes,
 		boost::unordered_map<string, StripedSearchers >& databases,
 		const boost::unordered_map<string, StripedSearchers >& olddatabases, bool deactivate=false);
+//add the subsets served by the shard servers at addresses (host:port)
+void loadShards(const vector<string>& addresses, boost::unordered_map<string, StripedSearchers >& databases);
 #endif /* DBLOADER_H_ */
@@ -32,6 +32,7 @@ See the LICENSE file provided with the distribution for more information.
 #include <unistd.h>
 #include "CommandLine2/CommandLine.h"
 #include "pharmarec.h"
+#include "ReceptorPharma.h"
 #include "pharmerdb.h"
 #include "PharmerQuery.h"
 #include <iostream>
@@ -50,6 +51,7 @@ See the LICENSE file provided with the distribution for more information.
 #include <ShapeConstraints.h>
 #include "ReadMCMol.h"
 #include "dbloader.h"
+#include "ShardServer.h"
 #include "MinimizationSupport.h"
 #include <openbabel/stereo/stereo.h>
 
@@ -62,7 +64,7 @@ cl::opt<bool> ShowQuery("show-query", cl::desc("print query points"),
 		cl::init(false));
 cl::opt<bool> Print("print", cl::desc("print results"), cl::init(true));
 cl::opt<string> Cmd("cmd",
-		cl::desc("command [pharma, dbcreate, dbcreateserverdir, dbsearch, server]"),
+		cl::desc("command [pharma, dbcreate, dbcreateserverdir, dbsearch, server, shardserver]"),
 		cl::Positional);
 cl::list<string> Database("dbdir", cl::desc("database directory(s)"));
 cl::list<string> inputFiles("in", cl::desc("input file(s)"));
@@ -93,6 +95,7 @@ cl::opt<unsigned> MaxOrient("max-orient",
 cl::opt<unsigned> MaxHits("max-hits", cl::desc("return at most n results"),
 		cl::value_desc("n"), cl::init(UINT_MAX));
 cl::opt<unsigned> Port("port", cl::desc("port for server to listen on"),cl::init(17000));
+cl::list<string> Shards("shard", cl::desc("[server] host:port of a shardserver searched along with the local databases"));
 cl::opt<string> LogDir("logdir", cl::desc("log directory for server"),
 		cl::init("."));
 cl::opt<bool> ExtraInfo("extra-info",
@@ -120,6 +123,8 @@ cl::opt<string> DBInfo("dbinfo",
 cl::opt<string> Ligands("ligs", cl::desc("[dbcreateserverdir] Text file listing locations of molecules"));
 cl::opt<bool> NoIndex("noindex",cl::desc("[dbcreateserverdir] Do not create indices"), cl::init(false));
 cl::opt<bool> NoShapeIndex("no-shape-index",cl::desc("[dbcreateserverdir] Do not create shape indices"), cl::init(false));
+cl::opt<bool> MortonShapeIndex("morton-shape-index",cl::desc("[dbcreateserverdir] Store shape indices with linearized (Morton ordered) trees"), cl::init(false));
+cl::opt<bool> CollapseConformers("collapse-conformers",cl::desc("[dbcreate,dbcreateserverdir] Store conformer triplets identical to an earlier conformer's in a compact side table"), cl::init(false));
 
 typedef void (*pharmaOutputFn)(ostream&, vector<PharmaPoint>&, ShapeConstraints& excluder);
 
@@ -251,16 +256,20 @@ static void handle_pharma_cmd(const Pharmas& pharmas)
 			OBMol mol;
 			vector<PharmaPoint> points;
 
-			OBMol receptor;
+			//receptor is parsed once for all the ligands
+			std::shared_ptr<ReceptorPharma> receptor;
 			if (Receptor.size() > 0)
 			{
 				OBConversion rconv;
 				OBFormat *rformat = rconv.FormatFromExt(Receptor.c_str());
 				if (format)
 				{
+					OBMol rec;
 					rconv.SetInFormat(rformat);
 					ifstream rin(Receptor.c_str());
-					rconv.Read(&receptor, &rin);
+					rconv.Read(&rec, &rin);
+					if (rec.NumAtoms() > 0)
+						receptor = std::make_shared<ReceptorPharma>(rec);
 				}
 			}
 
@@ -279,10 +288,10 @@ static void handle_pharma_cmd(const Pharmas& pharmas)
 				atyper.AssignTypes(mol);
 				atyper.AssignHyb(mol);
 
-				if (receptor.NumAtoms() > 0)
+				if (receptor)
 				{
 					vector<PharmaPoint> screenedout;
-					getInteractionPoints(pharmas, receptor, mol, points,
+					getInteractionPoints(pharmas, *receptor, mol, points,
 							screenedout);
 				}
 				else
@@ -1063,6 +1072,48 @@ static void handle_dbsearch_cmd()
 	cout << "Time: " << timer.elapsed() << "\n";
 }
 
+//load the databases of a server from either dbdir or prefixes
+static void load_server_databases(vector<filesystem::path>& prefixpaths,
+		boost::unordered_map<string, StripedSearchers >& databases)
+{
+	if(Prefixes.length() > 0 && Database.size() > 0)
+	{
+		cerr << "Cannot specify both dbdir and prefixes\n";
+		exit(-1);
+	}
+	else if(Database.size() > 0)
+	{
+		//only one subset
+		vector<filesystem::path> dbpaths;
+		for(unsigned i = 0, n = Database.size(); i < n; i++)
+		{
+			dbpaths.push_back(filesystem::path(Database[i]));
+		}
+		loadDatabases(dbpaths, databases[""]);
+	}
+	else
+	{
+		//use prefixes
+		ifstream prefixes(Prefixes.c_str());
+		string line;
+		while(getline(prefixes, line))
+		{
+			if(filesystem::exists(line))
+			{
+				prefixpaths.push_back(filesystem::path(line));
+			}
+			else
+				cerr << line << " does not exist\n";
+		}
+		if(prefixpaths.size() == 0)
+		{
+			cerr << "No valid prefixes\n";
+			exit(-1);
+		}
+		loadFromPrefixes(prefixpaths, databases);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	namespace filesystem = boost::filesystem;
@@ -1128,42 +1179,9 @@ int main(int argc, char *argv[])
 				reservedFD[i] = open("/dev/null",O_RDONLY);
 		}
 		//loadDatabases will open a whole bunch of files
-		if(Prefixes.length() > 0 && Database.size() > 0)
-		{
-			cerr << "Cannot specify both dbdir and prefixes\n";
-			exit(-1);
-		}
-		else if(Database.size() > 0)
-		{
-			//only one subset
-			vector<filesystem::path> dbpaths;
-			for(unsigned i = 0, n = Database.size(); i < n; i++)
-			{
-				dbpaths.push_back(filesystem::path(Database[i]));
-			}
-			loadDatabases(dbpaths, databases[""]);
-		}
-		else
-		{
-			//use prefixes
-			ifstream prefixes(Prefixes.c_str());
-			string line;
-			while(getline(prefixes, line))
-			{
-				if(filesystem::exists(line))
-				{
-					prefixpaths.push_back(filesystem::path(line));
-				}
-				else
-					cerr << line << " does not exist\n";
-			}
-			if(prefixpaths.size() == 0)
-			{
-				cerr << "No valid prefixes\n";
-				exit(-1);
-			}
-			loadFromPrefixes(prefixpaths, databases);
-		}
+		if(Database.size() > 0 || Prefixes.length() > 0 || Shards.size() == 0)
+			load_server_databases(prefixpaths, databases);
+		loadShards(Shards, databases);
 		//now free reserved fds
 		for(unsigned i = 0; i < MAXRESERVEDFD; i++)
 		{
@@ -1171,6 +1189,13 @@ int main(int argc, char *argv[])
 		}
 		pharmer_server(Port, prefixpaths, databases, LogDir, MinServer, MinPort);
 	}
+	else if (Cmd == "shardserver")
+	{
+		vector<filesystem::path> prefixpaths;
+		boost::unordered_map<string, StripedSearchers > databases;
+		load_server_databases(prefixpaths, databases);
+		shard_server(Port, databases);
+	}
 	else
 	{
 		cl::PrintHelpMessage();
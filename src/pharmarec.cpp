@@ -33,6 +33,7 @@ See the LICENSE file provided with the distribution for more information.
 #include "pharmarec.h"
 #include "Timer.h"
 #include "ShapeConstraints.h"
+#include "ReceptorPharma.h"
 #include <boost/lexical_cast.hpp>
 #include <boost/assign/list_of.hpp>
 #include <boost/unordered_set.hpp>
@@ -139,7 +140,7 @@ static const vector<Pharma> proteinPharmaVec = assign::list_of(
 		Pharma(3, "PositiveIon", positive_ion_protein, 7, 1.0, 0.1))(
 		Pharma(4, "NegativeIon", negative_ion_protein, 8, 1.0, 0.1))(
 		Pharma(5, "Hydrophobic", hydrophobic_protein, 6, 1.0, 2.0));
-static Pharmas proteinPharmas(proteinPharmaVec);
+Pharmas proteinPharmas(proteinPharmaVec);
 
 //setup lookup tables, pharmas must be initialized
 //use a manually managed array to make sure pointers stay valid
@@ -155,6 +156,28 @@ void Pharmas::initialize(const vector<Pharma>& ps)
 		pharmas[i] = ps[i];
 		nameLookup[pharmas[i].name] = i;
 	}
+
+	//identical smarts (e.g. the rings of aromatic and hydrophobic) only
+	//need to be matched once
+	patterns.clear();
+	patternIndex.clear();
+	patternIndex.resize(numPharmas);
+	boost::unordered_map<string, unsigned> seen;
+	for (unsigned i = 0; i < numPharmas; i++)
+	{
+		const vector<OBSmartsPattern>& smarts = pharmas[i].smarts;
+		for (unsigned s = 0, ns = smarts.size(); s < ns; s++)
+		{
+			string sm = smarts[s].GetSMARTS();
+			boost::unordered_map<string, unsigned>::iterator pos = seen.find(sm);
+			if (pos == seen.end())
+			{
+				pos = seen.insert(make_pair(sm, (unsigned)patterns.size())).first;
+				patterns.push_back(&smarts[s]);
+			}
+			patternIndex[i].push_back(pos->second);
+		}
+	}
 }
 
 bool Pharma::operator==(const Pharma& rhs) const
@@ -501,30 +524,30 @@ static void clusterPoints(const Pharma *pharma, vector<PharmaPoint>& points,
 	unsigned n = points.size();
 	vector<PharmaPoint> npts;
 	npts.reserve(n);
-	vector<vector<double> > distance(n, vector<double>(n, 0));
+	//only close neighbors can ever be clustered together, so keep those
+	//instead of a full distance matrix (receptors have thousands of points)
+	vector<vector<unsigned> > neighbors(n);
 	vector<unsigned> degrees(n, 0);
 
-	//compute distances and degrees (number of close neighbors)
+	//compute close neighbors and degrees
 	for (unsigned i = 0; i < n; i++)
 	{
 		for (unsigned j = 0; j < i; j++)
 		{
 			double d = PharmaPoint::pharmaDist(points[i], points[j]);
-			distance[j][i] = distance[i][j] = d;
-
 			if (d <= dist)
 			{
+				neighbors[i].push_back(j);
+				neighbors[j].push_back(i);
 				degrees[i]++;
 				degrees[j]++;
 			}
 		}
 	}
 
-	unsigned order[n];
 	//add all zero degree points
 	for (unsigned i = 0; i < n; i++)
 	{
-		order[i] = i;
 		if (degrees[i] == 0)
 			npts.push_back(points[i]);
 	}
@@ -536,18 +559,19 @@ static void clusterPoints(const Pharma *pharma, vector<PharmaPoint>& points,
 		cluster.push_back(maxi);
 		degrees[maxi] = 0;
 
+		vector<unsigned>& order = neighbors[maxi];
 		DistanceSorter sorter(maxi, points);
-		sort(order, order + n, sorter);
+		sort(order.begin(), order.end(), sorter);
 		//add points that are within threshold of all member of the cluster
-		for (unsigned o = 0; o < n; o++)
+		for (unsigned o = 0, no = order.size(); o < no; o++)
 		{
 			unsigned i = order[o];
 			if (degrees[i] > 0)
 			{
-				unsigned j = 0;
+				unsigned j = 1; //already know it is close to maxi
 				for (unsigned csz = cluster.size(); j < csz; j++)
 				{
-					if (distance[i][cluster[j]] > dist)
+					if (PharmaPoint::pharmaDist(points[i], points[cluster[j]]) > dist)
 						break;
 				}
 				if (j == cluster.size()) //close to all current cluster members
@@ -661,76 +685,79 @@ bool isPharmaGist(const Pharmas& pharmas, const string& mol,
 	return false;
 }
 
+//all the smarts are matched up front (each distinct pattern once), then the
+//conformers are swept with the maps fixed, setting each conformer only once
 void getPharmaPointsMC(const Pharmas& pharmas, OBMol& mol,
 		vector<vector<PharmaPoint> >& points)
 {
+	unsigned nc = mol.NumConformers();
 	points.clear();
-	points.resize(mol.NumConformers());
-	//for each kind of pharma
-	for (int p = 0, np = pharmas.size(); p < np; p++)
+	points.resize(nc);
+
+	//matches are conformer independent
+	vector<vector<vector<int> > > matches(pharmas.numPatterns());
+	for (unsigned m = 0, nm = matches.size(); m < nm; m++)
 	{
-		const Pharma* pharma = pharmas[p];
+		if (!pharmas.pattern(m).Match(mol, matches[m], OBSmartsPattern::AllUnique))
+			matches[m].clear();
+	}
 
-		vector<vector<PharmaPoint> > cpoints(mol.NumConformers());
-		vector<vector<vector<Coord> > > ccoords(mol.NumConformers());
-		//foreach smart for the pharma
-		for (int s = 0, ns = pharma->smarts.size(); s < ns; s++)
+	vector<PharmaPoint> cpoints;
+	vector<vector<Coord> > ccoords;
+	for (unsigned c = 0; c < nc; c++)
+	{
+		mol.SetConformer(c);
+		//for each kind of pharma
+		for (unsigned p = 0, np = pharmas.size(); p < np; p++)
 		{
-			const OBSmartsPattern& matcher = pharma->smarts[s];
-			vector<vector<int> > maplist;
-			if (matcher.Match(mol, maplist, OBSmartsPattern::AllUnique))
+			const Pharma* pharma = pharmas[p];
+			cpoints.clear();
+			ccoords.clear();
+			//foreach smart for the pharma
+			for (unsigned s = 0, ns = pharma->smarts.size(); s < ns; s++)
 			{
-				for (unsigned c = 0, nc = mol.NumConformers(); c < nc; c++)
+				const vector<vector<int> >& maplist = matches[pharmas.patternFor(p, s)];
+				//foreach map, record the point as the average of the matched atoms
+				for (unsigned i = 0, n = maplist.size(); i < n; i++)
 				{
-					//foreach map, record the point as the average of the matched atoms
-					for (int i = 0, n = maplist.size(); i < n; i++)
-					{
-						mol.SetConformer(c);
-						ccoords[c].resize(ccoords[c].size() + 1);
-
-						PharmaPoint point(pharma);
-						point.x = point.y = point.z = 0;
+					ccoords.resize(ccoords.size() + 1);
 
-						//get each atom
-						int numatoms = maplist[i].size();
-						point.size = numatoms;
-						for (int a = 0; a < numatoms; a++)
-						{
-							OBAtom *atom = mol.GetAtom(maplist[i][a]);
-							point.x += atom->x();
-							point.y += atom->y();
-							point.z += atom->z();
-							if (pharma->clusterLimit > 0)
-								ccoords[c].back().push_back(
-										Coord(atom->x(), atom->y(), atom->z()));
-						}
-						//take average
-						if (numatoms > 0)
-						{
-							point.x /= numatoms;
-							point.y /= numatoms;
-							point.z /= numatoms;
-						}
+					PharmaPoint point(pharma);
+					point.x = point.y = point.z = 0;
 
-						if (pharma->getVectors != NULL)
-							pharma->getVectors(maplist[i], mol, point);
-						cpoints[c].push_back(point);
+					//get each atom
+					unsigned numatoms = maplist[i].size();
+					point.size = numatoms;
+					for (unsigned a = 0; a < numatoms; a++)
+					{
+						OBAtom *atom = mol.GetAtom(maplist[i][a]);
+						point.x += atom->x();
+						point.y += atom->y();
+						point.z += atom->z();
+						if (pharma->clusterLimit > 0)
+							ccoords.back().push_back(
+									Coord(atom->x(), atom->y(), atom->z()));
 					}
+					//take average
+					if (numatoms > 0)
+					{
+						point.x /= numatoms;
+						point.y /= numatoms;
+						point.z /= numatoms;
+					}
+
+					if (pharma->getVectors != NULL)
+						pharma->getVectors(maplist[i], mol, point);
+					cpoints.push_back(point);
 				}
 			}
-		}
-		//now add all points for each conformation, clustering as necessary
-		for (unsigned c = 0, nc = cpoints.size(); c < nc; c++)
-		{
+
+			//add the points for this conformation, clustering as necessary
 			if (pharma->clusterLimit > 0)
 			{
-				clusterPoints(pharma, cpoints[c], ccoords[c],
-						pharma->clusterLimit);
+				clusterPoints(pharma, cpoints, ccoords, pharma->clusterLimit);
 			}
-
-			//add (possibly clustered) conformer points
-			points[c].insert(points[c].end(), cpoints[c].begin(),
-					cpoints[c].end());
+			points[c].insert(points[c].end(), cpoints.begin(), cpoints.end());
 		}
 	}
 }
@@ -1024,17 +1051,16 @@ bool jsonPharmaQuery(const Pharmas& pharmas, Json::Value& root,
 		}
 		else //compute interaction pharma
 		{
-			conv.SetInFormat(rformat);
-			OBMol rec;
-			if (!conv.ReadString(&rec, recdata))
+			std::shared_ptr<const ReceptorPharma> rec = ReceptorPharma::get(recdata, rformat);
+			if (!rec)
 			{
 				getPharmaPoints(pharmas, mol, points);
 			}
 			else
 			{
-				getInteractionPoints(pharmas, rec, mol, points, disabled);
+				getInteractionPoints(pharmas, *rec, mol, points, disabled);
 				points.insert(points.end(), disabled.begin(), disabled.end());
-				ShapeConstraints::computeInteractionPoints(mol, rec, ipoints);
+				ShapeConstraints::computeInteractionPoints(mol, rec->atomCoords(), ipoints);
 			}
 		}
 	}
@@ -1080,70 +1106,30 @@ void getProteinPharmaPoints(const Pharmas& pharmas, OBMol& mol,
 	}
 }
 
-//prune atoms from rec that are more than dist from ligand
-//this is approximate since I'm just using the bounding box
-static OBMol getPrunedReceptor(OBMol& rec, OBMol& ligand, double dist)
-{
-	if(ligand.NumAtoms() == 0) return rec;
-
-	double min[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL};
-	double max[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
-
-	//get bounding box of ligand
-	FOR_ATOMS_OF_MOL(a, ligand)
-	{
-		vector3 pt = a->GetVector();
-		for(unsigned i = 0; i < 3; i++) {
-			if(pt[i] > max[i]) max[i] = pt[i];
-			if(pt[i] < min[i]) min[i] = pt[i];
-		}
-	}
-
-	//now expand by dist
-	for(unsigned i = 0; i < 3; i++)
-	{
-		max[i] += dist;
-		min[i] -= dist;
-	}
-
-	//identify receptor atoms outside of box
-	vector<OBAtom*> toremove;
-	OBMol ret = rec;
-	FOR_ATOMS_OF_MOL(a, ret)
-	{
-		vector3 pt = a->GetVector();
-		if(pt[0] > max[0] || pt[1] > max[1] || pt[2] > max[2] ||
-				pt[0] < min[0] || pt[1] < min[1] || pt[2] < min[2])
-		{
-			toremove.push_back(&(*a));
-		}
-	}
-
-	ret.BeginModify();
-	for(unsigned i = 0, n = toremove.size(); i < n; i++)
-	{
-		ret.DeleteAtom(toremove[i],true);
-	}
-	ret.EndModify();
-	return ret;
-}
-
 //compute pharmacophore of the interaction
 //calculate both ligand and receptor points and then
 //enable only those ligand points that are close to complimentary receptor points
 void getInteractionPoints(const Pharmas& pharmas, OBMol& receptor,
 		OBMol& ligand, vector<PharmaPoint>& points,
 		vector<PharmaPoint>& screenedout)
+{
+	ReceptorPharma rec(receptor);
+	getInteractionPoints(pharmas, rec, ligand, points, screenedout);
+}
+
+//receptor features near each ligand point are looked up in a grid
+void getInteractionPoints(const Pharmas& pharmas, const ReceptorPharma& receptor,
+		OBMol& ligand, vector<PharmaPoint>& points,
+		vector<PharmaPoint>& screenedout)
 {
 	points.clear();
 	screenedout.clear();
 
 	vector<PharmaPoint> ligandpoints;
 	vector<PharmaPoint> receptorpoints;
-
 	getPharmaPoints(pharmas, ligand, ligandpoints);
-	OBMol prunedrec = getPrunedReceptor(receptor, ligand, 10); //prune receptor
-	getProteinPharmaPoints(pharmas, prunedrec, receptorpoints); //could potentially prune a very large molecule..
+	receptor.featuresNear(ligand, receptorpoints);
+	PharmaGrid grid(receptorpoints);
 
 	//remove anything without interacting info
 	vector<PharmaPoint> interactpoints;
@@ -1160,34 +1146,31 @@ void getInteractionPoints(const Pharmas& pharmas, OBMol& receptor,
 			screenedout.push_back(ligandpoints[i]);
 		}
 	}
-	//collate receptor points
-	vector<vector<PharmaPoint> > rinteractpoints(pharmas.size());
-
-	for (unsigned i = 0, n = receptorpoints.size(); i < n; i++)
+	//which of the requested pharmas each receptor pharma corresponds to,
+	//only for receptor pharmas with interacting info
+	vector<int> recpharma(proteinPharmas.size(), -1);
+	for (unsigned i = 0, n = proteinPharmas.size(); i < n; i++)
 	{
-		const PharmaInteract& interact =
-				pharmaInteractions[receptorpoints[i].pharma->name];
-		if (interact.maxDist > 0)
-		{
-			rinteractpoints[receptorpoints[i].pharma->index].push_back(
-					receptorpoints[i]);
-		}
+		const Pharma *p = pharmas.pharmaFromName(proteinPharmas[i]->name);
+		if (p != NULL && pharmaInteractions[p->name].maxDist > 0)
+			recpharma[i] = p->index;
 	}
 
 	//screen ligand points
+	vector<unsigned> near;
 	for (unsigned i = 0, n = interactpoints.size(); i < n; i++)
 	{
 		const PharmaPoint& l = interactpoints[i];
 		unsigned cnt = 0;
 		const PharmaInteract& I = pharmaInteractions[l.pharma->name];
-		const vector<PharmaPoint>& rvec = rinteractpoints[I.complement];
+		grid.pointsNear(l.x, l.y, l.z, I.maxDist, near);
 		unsigned j, m;
-		for (j = 0, m = rvec.size(); j < m; j++)
+		for (j = 0, m = near.size(); j < m; j++)
 		{
-			const PharmaPoint& rp = rvec[j];
-			double d = PharmaPoint::pharmaDist(l, rp);
-			if (d <= I.maxDist)
-				cnt++;
+			const PharmaPoint& rp = receptorpoints[near[j]];
+			if (recpharma[rp.pharma->index] != (int) I.complement)
+				continue;
+			cnt++;
 			if (cnt >= I.minMatch)
 			{
 				//just hydrogen bond features and set vector
@@ -126,6 +126,12 @@ protected:
 	Pharma *pharmas;
 	unsigned numPharmas;
 	boost::unordered_map<string, unsigned> nameLookup;
+
+	//matching plan: every distinct smarts pattern across all the pharmas is
+	//matched once per molecule and the matches are shared by every pharma
+	//that uses the pattern
+	vector<const OpenBabel::OBSmartsPattern*> patterns;
+	vector< vector<unsigned> > patternIndex; //[pharma][smarts] -> patterns
 	void initialize(const vector<Pharma>& ps);
 
 public:
@@ -151,6 +157,11 @@ public:
 
 	unsigned size() const { return numPharmas; }
 
+	unsigned numPatterns() const { return patterns.size(); }
+	const OpenBabel::OBSmartsPattern& pattern(unsigned i) const { return *patterns[i]; }
+	//index into patterns of the s'th smarts of pharma p
+	unsigned patternFor(unsigned p, unsigned s) const { return patternIndex[p][s]; }
+
 	const Pharma* pharmaFromName(const string& name) const;
 
 	void setDefaultSearchRadius(double val /*= 1.0*/);
@@ -160,6 +171,8 @@ public:
 };
 
 extern const vector<Pharma> defaultPharmaVec;
+//reduced set of definitions used to perceive receptors
+extern Pharmas proteinPharmas;
 
 //a single pharmacophore point
 struct PharmaPoint {
@@ -248,6 +261,11 @@ extern void getProteinPharmaPoints(const Pharmas& pharmas, OpenBabel::OBMol& pro
 extern void getInteractionPoints(const Pharmas& pharmas, OpenBabel::OBMol& receptor, OpenBabel::OBMol& ligand,
 		vector<PharmaPoint>& points, vector<PharmaPoint>& screenedout);
 
+//same as above, but with an already parsed (possibly cached) receptor
+class ReceptorPharma;
+extern void getInteractionPoints(const Pharmas& pharmas, const ReceptorPharma& receptor, OpenBabel::OBMol& ligand,
+		vector<PharmaPoint>& points, vector<PharmaPoint>& screenedout);
+
 //translate a point vector into json
 extern bool convertPharmaJson(Json::Value& root, const vector<PharmaPoint>& points);
 
@@ -49,6 +49,8 @@ extern cl::opt<bool> Quiet;
 extern cl::opt<unsigned> ReduceConfs;
 extern cl::opt<bool> ComputeThresholds;
 extern cl::opt<bool> NoShapeIndex;
+extern cl::opt<bool> MortonShapeIndex;
+extern cl::opt<bool> CollapseConformers;
 
 //location comparison functions for pointdata
 bool comparePointDataX(const ThreePointData& lhs, const ThreePointData& rhs)
@@ -163,6 +165,76 @@ void MolDataCreator::processMol(OBMol& mol, MolProperties& props, unsigned mid)
 		bufferSize += conf.byteSize();
 		numConfs++;
 	}
+
+	if (CollapseConformers)
+		collapseConformers();
+}
+
+//order triplets by everything the search filters on without looking at
+//the conformer specific data (see ConformerTriplet)
+static bool filterKeyLess(const ThreePointData& a, const ThreePointData& b)
+{
+	if (a.l1 != b.l1)
+		return a.l1 < b.l1;
+	if (a.l2 != b.l2)
+		return a.l2 < b.l2;
+	if (a.l3 != b.l3)
+		return a.l3 < b.l3;
+	if (a.extra1 != b.extra1)
+		return a.extra1 < b.extra1;
+	if (a.extra2 != b.extra2)
+		return a.extra2 < b.extra2;
+	if (a.extra3 != b.extra3)
+		return a.extra3 < b.extra3;
+	if (a.weight != b.weight)
+		return a.weight < b.weight;
+	if (a.nrot != b.nrot)
+		return a.nrot < b.nrot;
+	return memcmp(&a.fingerprint, &b.fingerprint, sizeof(TripletFingerprint)) < 0;
+}
+
+//fold triplets that match a triplet of an earlier conformer exactly (at the
+//reduced precision they are stored at) into that triplet's record
+void MolDataCreator::collapseConformers()
+{
+	collapsed.resize(pdatas.size());
+	for (unsigned p = 0, np = pdatas.size(); p < np; p++)
+	{
+		vector<ThreePointData>& pd = pdatas[p];
+		unsigned n = pd.size();
+		if (n < 2)
+			continue;
+
+		//stable, so the first of every group is from the earliest conformer
+		vector<unsigned> order(n);
+		for (unsigned i = 0; i < n; i++)
+			order[i] = i;
+		stable_sort(order.begin(), order.end(),
+				[&pd](unsigned a, unsigned b) {return filterKeyLess(pd[a], pd[b]);});
+
+		vector<int> rep(n, -1); //representative of each folded record
+		for (unsigned i = 1; i < n; i++)
+		{
+			unsigned prev = order[i - 1];
+			if (!filterKeyLess(pd[prev], pd[order[i]]))
+				rep[order[i]] = rep[prev] >= 0 ? rep[prev] : prev;
+		}
+
+		//compact in place, representatives always precede their folded records
+		vector<unsigned> newpos(n, 0);
+		unsigned k = 0;
+		for (unsigned i = 0; i < n; i++)
+		{
+			if (rep[i] < 0)
+			{
+				newpos[i] = k;
+				pd[k++] = pd[i];
+			}
+			else
+				collapsed[p].push_back(make_pair(newpos[rep[i]], pd[i]));
+		}
+		pd.resize(k);
+	}
 }
 
 //flatten all the conf info into a buffer
@@ -182,7 +254,8 @@ void MolDataCreator::createBuffer()
 
 //write out the data with proper offsets to files (assumed positioned properly and single threaded)
 unsigned MolDataCreator::write(FILE *molData,
-		vector<PointDataFile>& pointDataFiles)
+		vector<PointDataFile>& pointDataFiles,
+		vector<PointDataFile>& confDataFiles)
 {
 	unsigned long location = ftell(molData);
 
@@ -204,8 +277,29 @@ unsigned MolDataCreator::write(FILE *molData,
 	fwrite(buffer, bufferSize, 1, molData);
 	for (unsigned p = 0, np = pdatas.size(); p < np; p++)
 	{
-		pointDataFiles[p].write(&pdatas[p][0], sizeof(pdatas[p][0]),
-				pdatas[p].size());
+		if (pdatas[p].size() > 0)
+			pointDataFiles[p].write(&pdatas[p][0], sizeof(pdatas[p][0]),
+					pdatas[p].size());
+	}
+
+	//mols are written in order, so sorting each mol's conformers keeps the
+	//whole file sorted by key
+	for (unsigned p = 0, np = collapsed.size(); p < np; p++)
+	{
+		if (collapsed[p].size() == 0)
+			continue;
+		vector<ConformerTriplet> ctrips;
+		ctrips.reserve(collapsed[p].size());
+		for (unsigned i = 0, n = collapsed[p].size(); i < n; i++)
+		{
+			ThreePointData& conf = collapsed[p][i].second;
+			conf.molPos += location;
+			ctrips.push_back(
+					ConformerTriplet(pdatas[p][collapsed[p][i].first], conf));
+		}
+		sort(ctrips.begin(), ctrips.end());
+		confDataFiles[p].write(&ctrips[0], sizeof(ConformerTriplet),
+				ctrips.size());
 	}
 
 	//align the start of every mol so the upper MOLID_BITS correspond to an mol id
@@ -282,6 +376,14 @@ bool MolData::read(unsigned char *molData, unsigned long location,
 	return mol != NULL;
 }
 
+//read a record fetched with getMolRecords
+bool MolData::read(const MolSpan& record, PMolReader& areader)
+{
+	if (record.data == NULL)
+		return false;
+	return read((unsigned char*) record.data, 0, areader);
+}
+
 //read just metadata, don't parse full mol
 void MolData::readDataOnly(unsigned char *molData, unsigned long location)
 {
@@ -363,8 +465,18 @@ void PharmerDatabaseCreator::initializeDatabases()
 		pointDataFiles[i] = PointDataFile(pdpath.string(), i);
 	}
 
+	//collapsed conformers, only created if there are any
+	confDataFiles.resize(tindex.size());
+	for (int i = 0, n = tindex.size(); i < n; i++)
+	{
+		string cname = string("confData_") + lexical_cast<string>(i);
+		filesystem::path cdpath = dbpath / cname;
+		confDataFiles[i] = PointDataFile(cdpath.string(), i);
+	}
+
 	//geoData
 	geoDataFiles.resize(tindex.size(), NULL);
+	geoFingerFiles.resize(tindex.size(), NULL);
 
 	//property files
 	MolProperties::createFiles(dbpath, propFiles);
@@ -474,7 +586,7 @@ void PharmerDatabaseCreator::addMolToDatabase(OBMol& mol, long uniqueid,
 	//generate moldata
 	MolDataCreator mdc(pharmas, tindex, mol, props, stats[NumMols]);
 
-	unsigned mid = mdc.write(molData, pointDataFiles);
+	unsigned mid = mdc.write(molData, pointDataFiles, confDataFiles);
 	mids.push_back(mid);
 	props.write(mid, propFiles);
 
@@ -511,6 +623,17 @@ void PharmerDatabaseCreator::addMolToDatabase(OBMol& mol, long uniqueid,
 		shapedb.addObject(shobj);
 	}
 
+	//collapsed conformers still match, so the statistics count them as the
+	//records they would have been
+	const vector<vector<pair<unsigned, ThreePointData> > >& collapsed =
+			mdc.getCollapsed();
+	for (unsigned p = 0, np = collapsed.size(); p < np; p++)
+	{
+		for (unsigned i = 0, n = collapsed[p].size(); i < n; i++)
+			incrementBinCnt(collapsed[p][i].second, p);
+	}
+	selectivity.addMol(mdc.getTriplets(), collapsed);
+
 	stats[NumMols]++;
 	stats[NumConfs] += mdc.NumConfs();
 	stats[NumDbPoints] += mdc.NumPoints();
@@ -530,6 +653,7 @@ void PharmerDatabaseCreator::initPointDataArrays()
 			pointDataFiles[i].close();
 			pointDataArrays[i].map(pointDataFiles[i].name, false, true);
 		}
+		confDataFiles[i].close();
 	}
 }
 
@@ -712,7 +836,7 @@ ThreePointData* PharmerDatabaseCreator::partitionData(ThreePointData *start,
 //each node splits points data in two along the axis with the largest spread
 //every node has an explicit bounding box (so in that sense this is more like an R-tree)
 void PharmerDatabaseCreator::doSplitInPage(unsigned pharma, FILE *geoFile,
-		GeoKDPage& page,
+		FILE *fingerFile, GeoKDPage& page, GeoKDPageFingers& fingers,
 		unsigned pos, ThreePointData *start, ThreePointData *end,
 		ThreePointData *begin,
 		unsigned depth)
@@ -722,10 +846,12 @@ void PharmerDatabaseCreator::doSplitInPage(unsigned pharma, FILE *geoFile,
 	unsigned long numUnique = 0;
 	TripleInt last(0, 0, 0);
 	BoundingBox box;
+	TripletFingerprint summary;
 	for (ThreePointData *itr = start; itr != end; itr++)
 	{
 		TripleInt coords(itr->l1, itr->l2, itr->l3);
 		box.update(coords);
+		summary |= itr->fingerprint;
 		if (coords != last)
 		{
 			last = coords;
@@ -739,6 +865,7 @@ void PharmerDatabaseCreator::doSplitInPage(unsigned pharma, FILE *geoFile,
 
 	page.nodes[pos].box = box;
 	page.nodes[pos].splitType = info.type;
+	fingers.nodes[pos] = summary;
 	if (info.type == NoSplit)
 	{
 		//this is the end
@@ -756,11 +883,10 @@ void PharmerDatabaseCreator::doSplitInPage(unsigned pharma, FILE *geoFile,
 
 		if (2 * pos + 1 < SPLITS_PER_GEOPAGE) //stay on internal page
 		{
-			doSplitInPage(pharma, geoFile, page, 2 * pos, start, median, begin,
-					depth);
-			doSplitInPage(pharma, geoFile, page, 2 * pos + 1, median, end,
-					begin,
-					depth);
+			doSplitInPage(pharma, geoFile, fingerFile, page, fingers, 2 * pos,
+					start, median, begin, depth);
+			doSplitInPage(pharma, geoFile, fingerFile, page, fingers,
+					2 * pos + 1, median, end, begin, depth);
 		}
 		else //children pushed to new page
 		{
@@ -768,12 +894,10 @@ void PharmerDatabaseCreator::doSplitInPage(unsigned pharma, FILE *geoFile,
 			unsigned lpos = 2 * pos - SPLITS_PER_GEOPAGE;
 			unsigned rpos = lpos + 1;
 			assert(rpos < SPLITS_PER_GEOPAGE);
-			page.nextPages[lpos] = doSplitNewPage(pharma, geoFile, start,
-					median,
-					begin, depth);
-			page.nextPages[rpos] = doSplitNewPage(pharma, geoFile, median, end,
-					begin,
-					depth);
+			page.nextPages[lpos] = doSplitNewPage(pharma, geoFile, fingerFile,
+					start, median, begin, depth);
+			page.nextPages[rpos] = doSplitNewPage(pharma, geoFile, fingerFile,
+					median, end, begin, depth);
 		}
 	}
 }
@@ -782,11 +906,12 @@ void PharmerDatabaseCreator::doSplitInPage(unsigned pharma, FILE *geoFile,
 //writes out page to geoFile and returns its location as an index into an array
 //of geokdpages
 unsigned long PharmerDatabaseCreator::doSplitNewPage(unsigned pharma,
-		FILE *geoFile,
+		FILE *geoFile, FILE *fingerFile,
 		ThreePointData *start, ThreePointData *end, ThreePointData *begin,
 		unsigned depth)
 {
 	GeoKDPage page;
+	GeoKDPageFingers fingers;
 
 	//reserve space
 	boost::unique_lock<boost::shared_mutex> lock(fileAccessLock);
@@ -799,7 +924,8 @@ unsigned long PharmerDatabaseCreator::doSplitNewPage(unsigned pharma,
 
 	depth++;
 	//create the page
-	doSplitInPage(pharma, geoFile, page, 1, start, end, begin, depth);
+	doSplitInPage(pharma, geoFile, fingerFile, page, fingers, 1, start, end,
+			begin, depth);
 
 	stats[NumInternalPages]++;
 
@@ -810,6 +936,11 @@ unsigned long PharmerDatabaseCreator::doSplitNewPage(unsigned pharma,
 	ret = fwrite(&page, sizeof(page), 1, geoFile);
 	assert(ret == 1);
 
+	//pages may finish out of order, so place the summary explicitly
+	fseek(fingerFile, location * sizeof(GeoKDPageFingers), SEEK_SET);
+	ret = fwrite(&fingers, sizeof(GeoKDPageFingers), 1, fingerFile);
+	assert(ret == 1);
+
 	return location;
 }
 
@@ -858,8 +989,17 @@ void PharmerDatabaseCreator::createIJKSpatialIndex(int p)
 	GeoKDPage blank;
 	fwrite(&blank, sizeof(blank), 1, geoFile);
 
+	//fingerprint summaries, parallel to the pages
+	string fname = string("geoFinger_") + lexical_cast<string>(p);
+	boost::filesystem::path fpath = dbpath / fname;
+	FILE *fingerFile = fopen(fpath.string().c_str(), "w");
+	geoFingerFiles[p] = fingerFile;
+	assert(fingerFile);
+	GeoKDPageFingers blankFingers;
+	fwrite(&blankFingers, sizeof(blankFingers), 1, fingerFile);
+
 	//top-down recursively create kd/r tree spatial data structure
-	doSplitNewPage(p, geoFile, start, end, begin, 0);
+	doSplitNewPage(p, geoFile, fingerFile, start, end, begin, 0);
 }
 
 /* Create spatial index. */
@@ -880,9 +1020,13 @@ void PharmerDatabaseCreator::createSpatialIndex()
 	for (unsigned i = 0, n = binnedCnts.size(); i < n; i++)
 		fwrite(binnedCnts[i].c_array(), LENGTH_BINS * LENGTH_BINS * LENGTH_BINS,
 				sizeof(unsigned), binData);
+	selectivity.write((dbpath / "tripletStats").string());
 
 	if(!NoShapeIndex)
+	{
+		shapedb.setMortonFormat(MortonShapeIndex);
 		shapedb.createIndex();
+	}
 
 	cout << stats[NumConfs] << "\tconformations\n";
 	cout << stats[NumMols] << "\tmolecules\n";
@@ -978,6 +1122,8 @@ void PharmerDatabaseSearcher::initializeDatabases()
 		cerr << "Missing binnedCnts " << binpath << "\n";
 		return;
 	}
+	//finer statistics, not in older databases
+	selectivity.read((dbpath / "tripletStats").string());
 	//pointData
 	unsigned n = tindex.size();
 	tripletDataArrays = new MMappedRegion<ThreePointData> [n];
@@ -999,6 +1145,26 @@ void PharmerDatabaseSearcher::initializeDatabases()
 			geoDataArrays[i].map(gpath.string(), true, true);
 	}
 
+	//fingerprint summaries, not in older databases
+	geoFingerArrays = new MMappedRegion<GeoKDPageFingers> [n];
+	for (unsigned i = 0; i < n; i++)
+	{
+		string fname = string("geoFinger_") + lexical_cast<string>(i);
+		filesystem::path fpath = dbpath / fname;
+		if (filesystem::exists(fpath))
+			geoFingerArrays[i].map(fpath.string(), true, true);
+	}
+
+	//collapsed conformers, only present in some databases
+	confDataArrays = new MMappedRegion<ConformerTriplet> [n];
+	for (unsigned i = 0; i < n; i++)
+	{
+		string cname = string("confData_") + lexical_cast<string>(i);
+		filesystem::path cpath = dbpath / cname;
+		if (filesystem::exists(cpath))
+			confDataArrays[i].map(cpath.string(), true, true);
+	}
+
 	//property data
 	MolProperties::initializeReader(dbpath, props);
 	valid = true;
@@ -1007,6 +1173,50 @@ void PharmerDatabaseSearcher::initializeDatabases()
 	shapesearch.load(shape);
 }
 
+//the resident memory budget goes first to what searches traverse
+//randomly, then to what they scan
+void PharmerDatabaseSearcher::makeResident(unsigned tier)
+{
+	if (!valid)
+		return;
+	unsigned n = tindex.size();
+	switch (tier)
+	{
+	case 0:
+		binnedCnts.makeResident();
+		midList.makeResident();
+		break;
+	case 1:
+		for (unsigned i = 0; i < n; i++)
+		{
+			geoDataArrays[i].makeResident();
+			geoFingerArrays[i].makeResident();
+		}
+		break;
+	case 2:
+		shapesearch.makeResident();
+		break;
+	case 3:
+		for (unsigned i = 0; i < n; i++)
+			tripletDataArrays[i].makeResident();
+		pharmInfoData.makeResident();
+		break;
+	}
+}
+
+//only the structures traversed randomly by every search, the triplet data
+//is read in large sequential runs
+void PharmerDatabaseSearcher::preload()
+{
+	binnedCnts.touch();
+	midList.touch();
+	for (unsigned i = 0, n = tindex.size(); i < n && geoDataArrays; i++)
+	{
+		geoDataArrays[i].touch();
+		geoFingerArrays[i].touch();
+	}
+}
+
 //unmap all memory maps
 void PharmerDatabaseSearcher::deactivate()
 {
@@ -1020,6 +1230,10 @@ void PharmerDatabaseSearcher::deactivate()
 	tripletDataArrays = nullptr;
 	if(geoDataArrays) delete [] geoDataArrays;
 	geoDataArrays = nullptr;
+	if(geoFingerArrays) delete [] geoFingerArrays;
+	geoFingerArrays = nullptr;
+	if(confDataArrays) delete [] confDataArrays;
+	confDataArrays = nullptr;
 
 	props.clear();
 	shapesearch.clear();
@@ -1044,8 +1258,18 @@ unsigned PharmerDatabaseSearcher::getBinCnt(unsigned pclass, unsigned i,
 	return binnedCnts[index];
 }
 
+//expected number of molecules with one of the given number of triplet matches
+static double expectedMols(const SelectivityStats& selectivity,
+		unsigned pclass, double matches)
+{
+	return min(matches / selectivity.multiplicity(pclass),
+			(double) selectivity.molsWith(pclass));
+}
+
 //generate ranking and return index of best triplet
-//use binnedCnts histogram
+//use binnedCnts histogram, scaled by the expected fingerprint pass rate if
+//we have statistics, in which case the best triplet is the one expected to
+//hit the fewest molecules (since that is how many matches get created)
 unsigned PharmerDatabaseSearcher::rankTriplets(
 		const vector<QueryTriplet>& triplets, vector<double>& ranking)
 {
@@ -1074,15 +1298,55 @@ unsigned PharmerDatabaseSearcher::rankTriplets(
 
 		ranking[i] = val * triplets[i].numOrderings(); //symmetries will increases matches
 
-		if (val < minval)
+		double cost = val;
+		if (selectivity.isValid())
 		{
-			minval = val;
+			ranking[i] *= selectivity.fingerprintPass(pclass,
+					trip.getFingerPrint());
+			cost = expectedMols(selectivity, pclass, ranking[i]);
+		}
+
+		if (cost < minval)
+		{
+			minval = cost;
 			besttrip = i;
 		}
 	}
 	return besttrip;
 }
 
+//the fraction of molecules that match prev that are expected to also
+//match next, so the chain prunes as early as possible; without statistics
+//this is just next's ranking
+double PharmerDatabaseSearcher::chainCost(const QueryTriplet& prev,
+		const QueryTriplet& next, double nextRank)
+{
+	if (!selectivity.isValid())
+		return nextRank;
+
+	unsigned pclass = tindex(prev.getPharma(0), prev.getPharma(1),
+			prev.getPharma(2));
+	unsigned nclass = tindex(next.getPharma(0), next.getPharma(1),
+			next.getPharma(2));
+	unsigned long nmols = selectivity.molsWith(nclass);
+	if (nmols == 0)
+		return 0;
+	double hit = expectedMols(selectivity, nclass, nextRank) / nmols;
+	return selectivity.conditional(pclass, nclass) * hit;
+}
+
+//estimate the work of a triplet search from the histogram; the search starts
+//from the most selective triplet so its matches bound the work done
+double PharmerDatabaseSearcher::estimateTripletCost(
+		const vector<QueryTriplet>& triplets)
+{
+	if (triplets.size() == 0 || numMolecules() == 0)
+		return 0;
+	vector<double> ranking;
+	unsigned best = rankTriplets(triplets, ranking);
+	return ranking[best];
+}
+
 //get values along appropriate axis for split
 static void getMinMax(const Triplet& t, SplitType split, int& min, int& max)
 {
@@ -1112,6 +1376,30 @@ inline void dump(ostream& out, const ThreePointData& tpd)
 			<< "\n";
 }
 
+//add the conformers that were collapsed into rep, return number valid
+//filter is rep's filter result, shared by all of its conformers and only
+//computed once one of them is found in the match table
+static unsigned addCollapsedConformers(QueryInfo& t, unsigned mid,
+		const ThreePointData& rep, TripletMatches::FilterResult& filter)
+{
+	ConformerTriplet key;
+	key.key = ConformerTriplet::makeKey(rep);
+	pair<const ConformerTriplet*, const ConformerTriplet*> range = equal_range(
+			t.confs, t.confsEnd, key);
+
+	unsigned cnt = 0;
+	for (const ConformerTriplet *c = range.first; c != range.second; c++)
+	{
+		ThreePointData tdata = rep;
+		c->expand(tdata);
+		if (t.M.addExpanded(mid, tdata, t.triplet, t.which, filter))
+			cnt++;
+		else if (filter == TripletMatches::FilterFail)
+			break;
+	}
+	return cnt;
+}
+
 void PharmerDatabaseSearcher::queryProcessPoints(QueryInfo& t,
 		unsigned long startLoc, unsigned long endLoc)
 {
@@ -1120,14 +1408,30 @@ void PharmerDatabaseSearcher::queryProcessPoints(QueryInfo& t,
 
 	//put the range of point datas into the priorty queue,
 	//let the PQ filter out bad values
+	//prefetch match table entries a few records ahead, keeping the hashes
+	//the prefetch computed in a ring so add doesn't hash the record again
+	const unsigned PREFETCH_AHEAD = 8;
+	uint64_t hashes[PREFETCH_AHEAD];
+	for (unsigned i = 0; i < PREFETCH_AHEAD && start + i < end; i++)
+		hashes[i] = t.M.prefetch(start[i]);
+
 	unsigned cnt = 0;
 	for (const ThreePointData *itr = start; itr != end; itr++)
 	{
+		uint64_t& h = hashes[(itr - start) % PREFETCH_AHEAD];
+		uint64_t hash = h;
+		if (end - itr > PREFETCH_AHEAD)
+			h = t.M.prefetch(itr[PREFETCH_AHEAD]);
 		unsigned mid = getBaseMID(itr->molID());
-		if (t.M.add(mid, *itr, t.triplet, t.which))
+		TripletMatches::FilterResult filter = TripletMatches::FilterUnknown;
+		if (t.M.add(mid, *itr, t.triplet, t.which, filter, hash))
 		{
 			cnt++;
 		}
+		//conformers collapsed into this record share everything the filters
+		//look at, so they are skipped once it is known to fail
+		if (t.confs != t.confsEnd && filter != TripletMatches::FilterFail)
+			cnt += addCollapsedConformers(t, mid, *itr, filter);
 	}
 	if (cnt == 0)
 		emptyCnt++;
@@ -1163,6 +1467,13 @@ void PharmerDatabaseSearcher::queryIndex(QueryInfo& t, const GeoKDPage *page,
 		{
 			return;
 		}
+		//nothing beneath can satisfy the fingerprint constraints
+		if (t.fingers
+				&& !t.triplet.fingerprintPossible(
+						t.fingers[page - t.pages].nodes[pos]))
+		{
+			return;
+		}
 		if (node.splitType == NoSplit)
 		{
 			queryProcessPoints(t, startLoc, endLoc);
@@ -1213,24 +1524,19 @@ void PharmerDatabaseSearcher::queryIndex(QueryInfo& t, const GeoKDPage *page,
 }
 
 
-void PharmerDatabaseSearcher::generateShapeMatches(const ShapeConstraints& constraints,
+void PharmerDatabaseSearcher::generateShapeMatches(const ShapeSearchTrees& trees,
 		ShapeResults& results)
 {
 	if(numMolecules() == 0)
 		return;
-	//create tree version of constraints
-	GSSTreeSearcher::ObjectTree small = std::shared_ptr<const MappableOctTree>(
-					MappableOctTree::createFromGrid(constraints.getInclusiveGrid()), free);
-	std::shared_ptr<MappableOctTree> big = std::shared_ptr<MappableOctTree>(
-					MappableOctTree::createFromGrid(constraints.getExclusiveGrid()), free);
-	GSSTreeSearcher::ObjectTree lig = std::shared_ptr<const MappableOctTree>(
-					MappableOctTree::createFromGrid(constraints.getLigandGrid()), free);
-
-	big->invert();
-
-	shapesearch.dc_search(small, big, lig, true, results);
+	shapesearch.dc_search(trees.small, trees.big, trees.lig, true, results);
 }
 
+//most entries to reserve in the match table up front, the histogram counts
+//triplets rather than conformers so overestimates broad queries; the
+//table grows past this if needed
+#define MAX_MATCH_RESERVE (1UL << 16)
+
 //put all matching triplets into Q
 //each triplet is expanded to get all overlapping trips
 //this is intentionally not multi-threaded - performance-wise it's better to
@@ -1244,7 +1550,28 @@ void PharmerDatabaseSearcher::generateTripletMatches(const vector<vector<
 	matchedCnt = 0;
 	if(numMolecules() == 0)
 		return;
-		
+
+	//matches are only created by the first triplet, so size the match table
+	//from the histogram estimate of its hits instead of growing repeatedly
+	if (triplets.size() > 0 && triplets[0].size() > 0)
+	{
+		vector<double> ranking;
+		rankTriplets(triplets[0], ranking);
+		double est = 0;
+		unsigned long records = 0; //can't match more than are stored
+		for (unsigned t = 0, nt = ranking.size(); t < nt; t++)
+		{
+			const QueryTriplet& trip = triplets[0][t];
+			unsigned pclass = tindex(trip.getPharma(0), trip.getPharma(1),
+					trip.getPharma(2));
+			est += ranking[t];
+			records += tripletDataArrays[pclass].length()
+					+ confDataArrays[pclass].length();
+		}
+		est = min(est, (double) records);
+		M.reserve(min(est, (double) MAX_MATCH_RESERVE));
+	}
+
 	for (unsigned i = 0, n = triplets.size(); i < n; i++)
 	{
 		for (unsigned t = 0, nt = triplets[i].size(); t < nt; t++)
@@ -1254,7 +1581,13 @@ void PharmerDatabaseSearcher::generateTripletMatches(const vector<vector<
 					trip.getPharma(2));
 			const GeoKDPage *pages = geoDataArrays[pclass].begin();
 			const ThreePointData *data = tripletDataArrays[pclass].begin();
-			QueryInfo qinfo(trip, t, pages, data, i, M, stopEarly);
+			const ConformerTriplet *confs = confDataArrays[pclass].begin();
+			//summaries are only usable if they cover every page
+			const GeoKDPageFingers *fingers = NULL;
+			if (geoFingerArrays[pclass].length() == geoDataArrays[pclass].length())
+				fingers = geoFingerArrays[pclass].begin();
+			QueryInfo qinfo(trip, t, pages, fingers, data, confs,
+					confs + confDataArrays[pclass].length(), i, M, stopEarly);
 			queryIndex(qinfo, &pages[1], 1, 0,
 					tripletDataArrays[pclass].length());
 		}
@@ -1274,6 +1607,8 @@ void PharmerDatabaseSearcher::generateTripletMatches(const vector<vector<
 		if (stopEarly)
 			break;
 	}
+	M.finish();
+
 	if (!Quiet)
 	{
 		cout << "PageCnt :" << pageCnt << "\n";
@@ -1288,31 +1623,93 @@ static bool first_pair_cmp(const ulong_pair& lhs, const ulong_pair& rhs)
 {
 	return lhs.first < rhs.first;
 }
-//find the smina data location given the moldata location and copy the smina
-//data to out
-void PharmerDatabaseSearcher::getSminaData(unsigned long molloc, ostream& out)
+//return the sminaIndex entry covering molloc, searching only [start,end)
+static const ulong_pair* findSminaIndex(const ulong_pair *start,
+		const ulong_pair *end, const ulong_pair *first, unsigned long molloc)
 {
 	ulong_pair findit(molloc, 0);
 
 	//molloc is the conformer location in molData, do binary search
-	ulong_pair *pos = lower_bound(sminaIndex.begin(), sminaIndex.end(), findit,
-			first_pair_cmp);
+	const ulong_pair *pos = lower_bound(start, end, findit, first_pair_cmp);
 
-	if (pos == sminaIndex.end())
+	if (pos == end)
 	{
-		pos = sminaIndex.end() - 1;
+		pos = end - 1;
 	}
 	else if (pos->first > molloc)
 	{
 		pos--;
 	}
-	assert(pos >= sminaIndex.begin());
+	assert(pos >= first);
+	return pos;
+}
+
+//find the smina data location given the moldata location and copy the smina
+//data to out
+void PharmerDatabaseSearcher::getSminaData(unsigned long molloc, ostream& out)
+{
+	const ulong_pair *pos = findSminaIndex(sminaIndex.begin(),
+			sminaIndex.end(), sminaIndex.begin(), molloc);
 
 	//pos is now the correct spot
-	unsigned long sminaloc = pos->second;
 	unsigned sz = 0;
+	const char *data = getSminaData(pos->second, sz);
+	out.write(data, sz);
+}
+
+//since mollocs are sorted, each search only has to consider the part of
+//the index after the previous hit
+void PharmerDatabaseSearcher::getSminaLocations(
+		const vector<unsigned long>& mollocs, vector<unsigned long>& sminalocs)
+{
+	sminalocs.resize(mollocs.size());
+	const ulong_pair *first = sminaIndex.begin();
+	const ulong_pair *start = first;
+	const ulong_pair *end = sminaIndex.end();
+	for (unsigned i = 0, n = mollocs.size(); i < n; i++)
+	{
+		assert(i == 0 || mollocs[i - 1] <= mollocs[i]);
+		const ulong_pair *pos = findSminaIndex(start, end, first, mollocs[i]);
+		sminalocs[i] = pos->second;
+		start = pos;
+	}
+}
+
+//sorted locations make this a single forward sweep through the mapping
+void PharmerDatabaseSearcher::getMolRecords(
+		const vector<unsigned long>& locations, vector<MolSpan>& spans)
+{
+	spans.resize(locations.size());
+	for (unsigned i = 0, n = locations.size(); i < n; i++)
+	{
+		assert(i == 0 || locations[i - 1] <= locations[i]);
+		unsigned sz = 0;
+		const unsigned char *rec = getMolRecord(locations[i], sz);
+		spans[i] = rec ? MolSpan(rec, sz) : MolSpan();
+	}
+}
+
+void PharmerDatabaseSearcher::getSminaRecords(
+		const vector<unsigned long>& mollocs, vector<MolSpan>& spans)
+{
+	vector<unsigned long> sminalocs;
+	getSminaLocations(mollocs, sminalocs);
+	spans.resize(mollocs.size());
+	for (unsigned i = 0, n = sminalocs.size(); i < n; i++)
+	{
+		unsigned sz = 0;
+		const char *data = getSminaData(sminalocs[i], sz);
+		spans[i] = MolSpan((const unsigned char*) data, sz);
+	}
+}
+
+//smina data is stored as a size followed by the data
+const char* PharmerDatabaseSearcher::getSminaData(unsigned long sminaloc,
+		unsigned& sz)
+{
+	sz = 0;
 	memcpy(&sz, sminaData.begin() + sminaloc, sizeof(unsigned)); //size of smina data
-	out.write(sminaData.begin() + sminaloc + sizeof(unsigned), sz);
+	return sminaData.begin() + sminaloc + sizeof(unsigned);
 }
 
 //given a location in pharmInfoData and a query, check to see if the pharmacophore at phlocation
@@ -54,11 +54,14 @@ See the LICENSE file provided with the distribution for more information.
 #include "packers/Packers.h"
 #include "shapedb/GSSTreeSearcher.h"
 #include "ShapeObj.h"
+#include "RemoteShard.h"
+#include "SelectivityStats.h"
 
 using namespace std;
 
 class ShapeResults;
 class ShapeConstraints;
+struct ShapeSearchTrees;
 class TripletMatches;
 extern cl::opt<bool> Quiet;
 
@@ -111,6 +114,66 @@ struct PointDataFile
 
 };
 
+//when conformers are collapsed, a conformer's triplet that is identical to an
+//earlier conformer's in everything the search filters on (lengths, extra,
+//fingerprint, weight, rotatable bonds) doesn't get its own record; only what
+//differs is kept in a side table sorted by the key of the surviving record
+struct ConformerTriplet
+{
+	unsigned long key; //molPos and indices of the representative record
+	unsigned long molPos: TPD_MOLDATA_BITS;
+	unsigned i1: TPD_INDEX_BITS;
+	unsigned i2: TPD_INDEX_BITS;
+	unsigned i3: TPD_INDEX_BITS;
+	signed x: TPD_COORD_BITS;
+	signed y: TPD_COORD_BITS;
+	signed z: TPD_COORD_BITS;
+	unsigned theta2: TPD_ANGLE_BITS;
+	unsigned phi2: TPD_ANGLE_BITS;
+	unsigned theta3: TPD_ANGLE_BITS;
+	unsigned phi3: TPD_ANGLE_BITS;
+
+	ConformerTriplet(): key(0), molPos(0), i1(0), i2(0), i3(0), x(0), y(0), z(0),
+			theta2(0), phi2(0), theta3(0), phi3(0)
+	{
+	}
+
+	ConformerTriplet(const ThreePointData& rep, const ThreePointData& conf) :
+			key(makeKey(rep)), molPos(conf.molPos), i1(conf.i1), i2(conf.i2), i3(
+					conf.i3), x(conf.x), y(conf.y), z(conf.z), theta2(conf.theta2), phi2(
+					conf.phi2), theta3(conf.theta3), phi3(conf.phi3)
+	{
+	}
+
+	//unique for every record of a triplet class
+	static unsigned long makeKey(const ThreePointData& t)
+	{
+		return ((unsigned long) t.molPos << (3 * TPD_INDEX_BITS))
+				| (t.i1 << (2 * TPD_INDEX_BITS)) | (t.i2 << TPD_INDEX_BITS) | t.i3;
+	}
+
+	//replace the conformer specific data of the representative t
+	void expand(ThreePointData& t) const
+	{
+		t.molPos = molPos;
+		t.i1 = i1;
+		t.i2 = i2;
+		t.i3 = i3;
+		t.x = x;
+		t.y = y;
+		t.z = z;
+		t.theta2 = theta2;
+		t.phi2 = phi2;
+		t.theta3 = theta3;
+		t.phi3 = phi3;
+	}
+
+	bool operator<(const ConformerTriplet& rhs) const
+	{
+		return key < rhs.key;
+	}
+}__attribute__((__packed__));
+
 struct MolDataHeader
 {
 	unsigned molID; /* unique identifier for mol */
@@ -155,6 +218,8 @@ class MolDataCreator
 	vector<ConfCreator> confs;
 	vector<unsigned> confOffsets; //offset from start of mol for each conformer
 	vector<vector<ThreePointData> > pdatas; //indexed by triplet type
+	//conformer triplets folded into a record of pdatas, indexed by triplet type
+	vector<vector<pair<unsigned, ThreePointData> > > collapsed;
 
 	vector<vector<PharmaPoint> > mcpoints;
 
@@ -165,6 +230,7 @@ class MolDataCreator
 	unsigned numConfs;
 
 	void processMol(OpenBabel::OBMol& mol, MolProperties& props, unsigned mid);
+	void collapseConformers();
 	void createBuffer();
 
 	static unsigned maxIndex;
@@ -185,7 +251,8 @@ public:
 		if (buffer)
 			delete[] buffer;
 	}
-	unsigned write(FILE *molData, vector<PointDataFile>& pointDataFiles);
+	unsigned write(FILE *molData, vector<PointDataFile>& pointDataFiles,
+			vector<PointDataFile>& confDataFiles);
 	unsigned NumPoints() const
 	{
 		unsigned ret = 0;
@@ -207,6 +274,18 @@ public:
 		return confOffsets;
 	}
 
+	//triplet records, indexed by triplet type
+	const vector<vector<ThreePointData> >& getTriplets() const
+	{
+		return pdatas;
+	}
+
+	//conformer triplets folded into a record of getTriplets, with its index
+	const vector<vector<pair<unsigned, ThreePointData> > >& getCollapsed() const
+	{
+		return collapsed;
+	}
+
 	const vector<PharmaPoint>& getConfFeatures(unsigned c) const
 	{
 		if(c >= mcpoints.size()) abort();
@@ -215,6 +294,17 @@ public:
 
 };
 
+//a record of a database, points straight into the memory mapped data
+//so it is only valid as long as the database (or fetch buffer) is
+struct MolSpan
+{
+	const unsigned char *data; //null if not available
+	unsigned size;
+
+	MolSpan(): data(NULL), size(0) {}
+	MolSpan(const unsigned char *d, unsigned sz): data(d), size(sz) {}
+};
+
 //data for a single conformation, include full mol since this turns out to
 //be faster than more compressed layouts
 struct MolData
@@ -233,6 +323,7 @@ struct MolData
 	bool read(FILE *molData, unsigned long location, PMolReader& areader);
 	bool read(unsigned char *molData, unsigned long location,
 			PMolReader& areader);
+	bool read(const MolSpan& record, PMolReader& areader);
 	void readDataOnly(unsigned char *molData, unsigned long location);
 	void clear();
 };
@@ -361,6 +452,14 @@ struct GeoKDPage
 	}
 };
 
+//the union of the fingerprints beneath every node of a page, stored
+//separately (geoFinger_N) at the same index as the page so older databases
+//without it still load
+struct GeoKDPageFingers
+{
+	TripletFingerprint nodes[SPLITS_PER_GEOPAGE];
+};
+
 class QueryPoint;
 
 enum Stats
@@ -402,8 +501,10 @@ private:
 
 	vector<PointDataFile> pointDataFiles; //just pointdata objects; separate library for every pharma combo; indexed by triplet index
 	MMappedRegion<ThreePointData> *pointDataArrays;
+	vector<PointDataFile> confDataFiles; //collapsed conformers; indexed by triplet index
 
 	vector<FILE*> geoDataFiles; //spatial indexes; indexed  by trip index
+	vector<FILE*> geoFingerFiles; //fingerprint summaries of geoDataFiles
 
 	//coarsely track length distributions using simple binning
 	vector<
@@ -411,6 +512,7 @@ private:
 					boost::array<boost::array<unsigned, LENGTH_BINS>,
 							LENGTH_BINS>,
 					LENGTH_BINS> > binnedCnts;
+	SelectivityStats selectivity; //for ordering query triplets
 
 	//shape data
 	KSamplePartitioner topdown;
@@ -421,13 +523,14 @@ private:
 	void initPointDataArrays();
 	void initializeDatabases();
 
-	void doSplitInPage(unsigned pharma, FILE *geoFile, GeoKDPage& page,
+	void doSplitInPage(unsigned pharma, FILE *geoFile, FILE *fingerFile,
+			GeoKDPage& page, GeoKDPageFingers& fingers,
 			unsigned pos, ThreePointData *start,
 			ThreePointData *end, ThreePointData *begin, unsigned depth);
 
 	unsigned long doSplitNewPage(unsigned pharma, FILE *geoFile,
-			ThreePointData *start, ThreePointData *end, ThreePointData *begin,
-			unsigned depth);
+			FILE *fingerFile, ThreePointData *start, ThreePointData *end,
+			ThreePointData *begin, unsigned depth);
 
 	void incrementBinCnt(const ThreePointData& t, unsigned pclass);
 	void createIJKSpatialIndex(int p);
@@ -470,6 +573,7 @@ public:
 		LENGTH_BINS * LENGTH_BINS * LENGTH_BINS * sizeof(unsigned));
 		memset(tmpFiles, 0, sizeof(tmpFiles));
 		binnedCnts.resize(tindex.size(), zero);
+		selectivity = SelectivityStats(tindex.size());
 		//create databases
 
 		initializeDatabases();
@@ -510,11 +614,20 @@ public:
 		{
 			pointDataFiles[i].close();
 		}
+		for (unsigned i = 0, n = confDataFiles.size(); i < n; i++)
+		{
+			confDataFiles[i].close();
+		}
 		for (unsigned i = 0, n = geoDataFiles.size(); i < n; i++)
 		{
 			if (geoDataFiles[i])
 				fclose(geoDataFiles[i]);
 		}
+		for (unsigned i = 0, n = geoFingerFiles.size(); i < n; i++)
+		{
+			if (geoFingerFiles[i])
+				fclose(geoFingerFiles[i]);
+		}
 
 		if (pointDataArrays != NULL)
 			delete[] pointDataArrays;
@@ -571,16 +684,21 @@ struct QueryInfo
 {
 	const QueryTriplet& triplet;
 	const GeoKDPage *pages;
+	const GeoKDPageFingers *fingers; //may be null
 	const ThreePointData *data;
+	const ConformerTriplet *confs; //collapsed conformers of data, sorted by key
+	const ConformerTriplet *confsEnd;
 	const unsigned index;
 	unsigned which; //which triplet ordering
 	TripletMatches& M;
 	volatile bool& stopEarly;
 	QueryInfo(const QueryTriplet& trp, unsigned w, const GeoKDPage *p,
-			const ThreePointData *d, unsigned i,
+			const GeoKDPageFingers *f,
+			const ThreePointData *d, const ConformerTriplet *cs,
+			const ConformerTriplet *ce, unsigned i,
 			TripletMatches& m, bool& stop) :
-			triplet(trp), pages(p), data(d), index(i), which(w), M(m), stopEarly(
-					stop)
+			triplet(trp), pages(p), fingers(f), data(d), confs(cs), confsEnd(ce), index(i), which(
+					w), M(m), stopEarly(stop)
 	{
 
 	}
@@ -600,6 +718,8 @@ class PharmerDatabaseSearcher
 	MMappedRegion<unsigned char> molData;
 	MMappedRegion<ThreePointData> * tripletDataArrays = nullptr;
 	MMappedRegion<GeoKDPage> * geoDataArrays = nullptr;
+	MMappedRegion<GeoKDPageFingers> * geoFingerArrays = nullptr;
+	MMappedRegion<ConformerTriplet> * confDataArrays = nullptr;
 	MMappedRegion<unsigned> midList; //index from location-based id to "actual" mid
 
 	MMappedRegion<pair<unsigned long, unsigned long> > sminaIndex; //maps moldata location to sminadata
@@ -614,10 +734,12 @@ class PharmerDatabaseSearcher
 	void initializeDatabases();
 
 	MMappedRegion<unsigned> binnedCnts;
+	SelectivityStats selectivity; //empty for older databases
 
 	unsigned long stats[LastStat];
 	bool valid;
 	bool inactive = false;
+	unsigned numaNode = 0; //node this stripe's memory and searches are placed on
 
 	void queryProcessPoints(QueryInfo& t,
 			unsigned long startLoc, unsigned long endLoc);
@@ -654,6 +776,10 @@ class PharmerDatabaseSearcher
 			delete[] tripletDataArrays;
 		if (geoDataArrays != nullptr)
 			delete[] geoDataArrays;
+		if (geoFingerArrays != nullptr)
+			delete[] geoFingerArrays;
+		if (confDataArrays != nullptr)
+			delete[] confDataArrays;
 	}
 
 	//setup memory maps
@@ -661,7 +787,11 @@ class PharmerDatabaseSearcher
 	{
 		if(inactive) {
 			boost::unique_lock<boost::mutex> m(lock);
-			if(inactive) initializeDatabases();
+			if(inactive) {
+				initializeDatabases();
+				for (unsigned t = 0; t < ResidentTiers; t++)
+					makeResident(t);
+			}
 			inactive = false;
 		}
 	}
@@ -706,11 +836,45 @@ class PharmerDatabaseSearcher
 	unsigned rankTriplets(const vector<QueryTriplet>& triplets,
 			vector<double>& ranking);
 
+	void setNumaNode(unsigned n)
+	{
+		numaNode = n;
+	}
+
+	unsigned getNumaNode() const
+	{
+		return numaNode;
+	}
+
+	//touch the index structures from the calling thread so they are
+	//placed in its memory
+	void preload();
+
+	//copy one priority tier of index files into resident memory; loaders
+	//finish a tier on every stripe before starting the next so the budget
+	//is split by importance rather than by which stripe loaded first
+	static const unsigned ResidentTiers = 4;
+	void makeResident(unsigned tier);
+
+	//true if there are statistics beyond the length histogram to rank with
+	bool hasSelectivityStats() const
+	{
+		return selectivity.isValid();
+	}
+
+	//relative cost of following prev with next in the search, lower is
+	//better; nextRank is next's value from rankTriplets
+	double chainCost(const QueryTriplet& prev, const QueryTriplet& next,
+			double nextRank);
+
+	//expected number of matches for the most selective triplet
+	double estimateTripletCost(const vector<QueryTriplet>& triplets);
+
 	//put all matching triplets into Q
 	void generateTripletMatches(const vector<vector<QueryTriplet> >& triplets,
 			TripletMatches& Q, bool& stopEarly);
 
-	void generateShapeMatches(const ShapeConstraints& constraints,
+	void generateShapeMatches(const ShapeSearchTrees& trees,
 			ShapeResults& results);
 
 	//get mol data, a single conformation, at location
@@ -725,8 +889,38 @@ class PharmerDatabaseSearcher
 		mdata.readDataOnly(molData.begin(), location);
 	}
 
+	//raw bytes of the record at location, as read by MolData::read,
+	//null if location is out of range
+	const unsigned char* getMolRecord(unsigned long location, unsigned& sz)
+	{
+		unsigned short psize = 0;
+		unsigned long hsize = sizeof(MolDataHeader) + sizeof(psize);
+		//location may come from a remote peer, don't let it wrap
+		if (location > molData.length() || hsize > molData.length() - location)
+			return NULL;
+		memcpy(&psize, molData.begin() + location + sizeof(MolDataHeader), sizeof(psize));
+		sz = hsize + psize;
+		if (sz > molData.length() - location)
+			return NULL;
+		return molData.begin() + location;
+	}
+
+	//spans of the records at locations, which must be sorted, for MolData::read
+	void getMolRecords(const vector<unsigned long>& locations, vector<MolSpan>& spans);
+
 	void getSminaData(unsigned long location, ostream& out);
 
+	//spans of the smina data of the mols at the sorted locations
+	void getSminaRecords(const vector<unsigned long>& mollocs, vector<MolSpan>& spans);
+
+	//bulk version of the smina lookup; mollocs must be sorted, sminalocs
+	//is filled with the corresponding offsets into sminaData
+	void getSminaLocations(const vector<unsigned long>& mollocs,
+			vector<unsigned long>& sminalocs);
+
+	//return a pointer directly into sminaData at an offset from getSminaLocations
+	const char* getSminaData(unsigned long sminaloc, unsigned& sz);
+
 	const Pharmas& getPharmas() const
 	{
 		return pharmas;
@@ -754,6 +948,7 @@ class PharmerDatabaseSearcher
 struct StripedSearchers
 {
 	vector<std::shared_ptr<PharmerDatabaseSearcher> > stripes;
+	vector<std::shared_ptr<RemoteShard> > shards; //served by other machines
 	unsigned long totalConfs;
 	unsigned long totalMols;
 	bool hasShape;
@@ -765,9 +960,9 @@ struct StripedSearchers
 
 	Json::Value getJSON() const
 	{
-		assert(stripes.size() > 0);
+		assert(stripes.size() > 0 || shards.size() > 0);
 		//each stripe should have same db info, but the totals need to be summed
-		Json::Value ret = stripes[0]->getJSON();
+		Json::Value ret = stripes.size() > 0 ? stripes[0]->getJSON() : shards[0]->getJSON();
 		unsigned totalConfs = 0;
 		unsigned totalMols = 0;
 		for (unsigned i = 0, n = stripes.size(); i < n; i++)
@@ -775,6 +970,11 @@ struct StripedSearchers
 			totalConfs += stripes[i]->numConformations();
 			totalMols += stripes[i]->numMolecules();
 		}
+		for (unsigned i = 0, n = shards.size(); i < n; i++)
+		{
+			totalConfs += shards[i]->numConformations();
+			totalMols += shards[i]->numMolecules();
+		}
 		ret["numConfs"] = totalConfs;
 		ret["numMols"] = totalMols;
 		return ret;
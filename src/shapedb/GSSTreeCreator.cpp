@@ -181,7 +181,14 @@ file_index GSSTreeCreator::optimizeLevelsR(ostream& outnodes,
 	{
 		const GSSLeaf* leaf = (const GSSLeaf*) n;
 		file_index ret = outleaves.tellp();
-		outleaves.write((const char*) leaf, leaf->bytes());
+		if (mortonFormat)
+		{
+			GSSLeaf *mleaf = leaf->createMorton();
+			outleaves.write((const char*) mleaf, mleaf->bytes());
+			free(mleaf);
+		}
+		else
+			outleaves.write((const char*) leaf, leaf->bytes());
 		lstart = ret;
 		lend = outleaves.tellp();
 
@@ -203,6 +210,12 @@ file_index GSSTreeCreator::optimizeLevelsR(ostream& outnodes,
 		nodeContentDistribution[node->size()]++;
 
 		GSSInternalNode* newnode = node->createTruncated(dimension, resolution);
+		if (mortonFormat)
+		{
+			GSSInternalNode *mnode = newnode->createMorton();
+			free(newnode);
+			newnode = mnode;
+		}
 
 		outnodes.write((const char*) newnode, newnode->bytes());
 		unsigned nextlevel = level - 1;
@@ -310,6 +323,12 @@ void GSSTreeCreator::optimizeLevels()
 			free(superroots[i]);
 		}
 		superroots.clear();
+		if (mortonFormat)
+		{
+			GSSInternalNode *mnode = newnode->createMorton();
+			free(newnode);
+			newnode = mnode;
+		}
 
 		file_index ret = outnodes.tellp();
 		outnodes.write((const char*) newnode, newnode->bytes());
@@ -133,6 +133,7 @@ class GSSTreeCreator
 	float dimension;
 	float resolution;
 	unsigned superNodeDepth;
+	bool mortonFormat; //write trees as MortonOctTrees
 	//some bookkeeping for analysis purposes
 	unsigned numNodes;
 	unsigned numLeaves;
@@ -149,14 +150,14 @@ class GSSTreeCreator
 
 public:
 	GSSTreeCreator(GSSLevelCreator *l, unsigned sdepth = 3) :
-			leveler(l), dimension(0), resolution(0), superNodeDepth(sdepth), numNodes(
-					0), numLeaves(0)
+			leveler(l), dimension(0), resolution(0), superNodeDepth(sdepth),
+			mortonFormat(false), numNodes(0), numLeaves(0)
 	{
 	}
 
 	GSSTreeCreator() :
-			leveler(NULL), dimension(0), resolution(0), superNodeDepth(3), numNodes(
-					0), numLeaves(0)
+			leveler(NULL), dimension(0), resolution(0), superNodeDepth(3),
+			mortonFormat(false), numNodes(0), numLeaves(0)
 	{
 
 	}
@@ -181,6 +182,13 @@ public:
 		return resolution;
 	}
 
+	//store the final leaves and nodes with linearized trees, which are
+	//faster to search; the searcher detects the format
+	void setMortonFormat(bool m)
+	{
+		mortonFormat = m;
+	}
+
 	bool create(boost::filesystem::path dir, boost::filesystem::path treedir,
 			float dim,
 			float res);
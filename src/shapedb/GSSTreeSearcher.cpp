@@ -56,9 +56,50 @@ bool GSSTreeSearcher::load(const boost::filesystem::path& dbpath)
 		return false;
 	}
 
+	//the format of the trees is recorded in every node
+	morton = false;
+	if (internalNodes.size() > 0)
+		morton = ((const GSSNodeCommon*) internalNodes.begin())->isMorton;
+	else if (leaves.size() > 0)
+		morton = ((const GSSNodeCommon*) leaves.begin())->isMorton;
+
 	return true;
 }
 
+//convert a query tree to the linearized format, null stays null
+GSSTreeSearcher::MortonTree GSSTreeSearcher::linearize(
+		const MappableOctTree *tree)
+{
+	if (tree == NULL)
+		return MortonTree();
+	return MortonTree(MortonOctTree::create(tree), free);
+}
+
+double GSSTreeSearcher::leafShapeDistance(const MappableOctTree *tree,
+		const MappableOctTree *min, const MappableOctTree *max) const
+{
+	return shapeDistance(tree, tree, min, max);
+}
+
+//shapeDistance is only defined on MappableOctTrees, so expand the tree
+double GSSTreeSearcher::leafShapeDistance(const MortonOctTree *tree,
+		const MappableOctTree *min, const MappableOctTree *max) const
+{
+	MappableOctTree *mtree = tree->createMappable(resolution);
+	double ret = shapeDistance(mtree, mtree, min, max);
+	free(mtree);
+	return ret;
+}
+
+double GSSTreeSearcher::leafShapeDistance(const GSSLeaf::Child *child,
+		const MappableOctTree *min, const MappableOctTree *max) const
+{
+	if (morton)
+		return leafShapeDistance(child->getTree<MortonOctTree>(), min, max);
+	else
+		return leafShapeDistance(&child->tree, min, max);
+}
+
 void GSSTreeSearcher::clear()
 {
 	objects.clear();
@@ -89,16 +130,34 @@ void GSSTreeSearcher::dc_search(ObjectTree smallobjTree,
 	leavesVisited = 0;
 	levelCnts.clear();
 	unsigned cnt = 0;
+	const GSSInternalNode* root = NULL;
+	const GSSLeaf* leaf = NULL;
 	if (internalNodes.size() > 0)
+		root = (GSSInternalNode*) internalNodes.begin();
+	else //very small tree with just a leaf
+		leaf = (GSSLeaf*) leaves.begin();
+
+	if (morton)
 	{
-		const GSSInternalNode* root = (GSSInternalNode*) internalNodes.begin();
-		cnt += findTweeners(root, smallTree, bigTree, origTree, res, 0, loadObjs);
+		//convert the query once, all comparisons are then merges
+		MortonTree msmall = linearize(smallTree);
+		MortonTree mbig = linearize(bigTree);
+		MortonTree morig = linearize(origTree);
+		TweenerQuery<MortonOctTree> q =
+		{ msmall.get(), mbig.get(), morig.get(), smallTree, bigTree };
+		if (root)
+			cnt += findTweeners(root, q, res, 0, loadObjs);
+		else
+			cnt += findTweeners(leaf, q, res, loadObjs);
 	}
 	else
 	{
-		//very small tree with just a leaf
-		const GSSLeaf* leaf = (GSSLeaf*) leaves.begin();
-		cnt += findTweeners(leaf, smallTree, bigTree, origTree, res, loadObjs);
+		TweenerQuery<MappableOctTree> q =
+		{ smallTree, bigTree, origTree, smallTree, bigTree };
+		if (root)
+			cnt += findTweeners(root, q, res, 0, loadObjs);
+		else
+			cnt += findTweeners(leaf, q, res, loadObjs);
 	}
 
 	if (verbose)
@@ -150,8 +209,9 @@ struct ScoredChild
 };
 
 //explore children to find closest value
+template<class Tree>
 void GSSTreeSearcher::findNearest(const GSSInternalNode* node,
-		const MappableOctTree* obj, TopObj& res, unsigned level)
+		const Tree* obj, TopObj& res, unsigned level)
 {
 	nodesVisited++;
 	if (levelCnts.size() <= level)
@@ -169,8 +229,8 @@ void GSSTreeSearcher::findNearest(const GSSInternalNode* node,
 	{
 		const GSSInternalNode::Child *child = node->getChild(i);
 		float min = 0, max = 0;
-		float score = searchVolumeDist(obj, child->getMIV(), child->getMSV(),
-				min, max);
+		float score = searchVolumeDist(obj, child->template getMIVAs<Tree>(),
+				child->template getMSVAs<Tree>(), min, max);
 		fitsCheck++;
 		if (min < res.worst())
 		{
@@ -211,15 +271,16 @@ void GSSTreeSearcher::findNearest(const GSSInternalNode* node,
 }
 
 //add nearest neighbors to res if appropriate
-void GSSTreeSearcher::findNearest(const GSSLeaf* node,
-		const MappableOctTree* obj, TopObj& res)
+template<class Tree>
+void GSSTreeSearcher::findNearest(const GSSLeaf* node, const Tree* obj,
+		TopObj& res)
 {
 	leavesVisited++;
 	unsigned cnt = 0;
 	for (unsigned i = 0, n = node->size(); i < n; i++)
 	{
 		const GSSLeaf::Child *child = node->getChild(i);
-		double dist = volumeDist(obj, &child->tree);
+		double dist = volumeDist(obj, child->template getTree<Tree>());
 		fitsCheck++;
 		if (dist < res.worst())
 		{
@@ -241,8 +302,7 @@ void GSSTreeSearcher::findNearest(const GSSLeaf* node,
 	for (unsigned i = 0, n = node->size(); i < n; i++)
 	{
 		const GSSLeaf::Child *child = node->getChild(i);
-		double dist = shapeDistance(&child->tree, &child->tree, smallTree,
-				bigTree);
+		double dist = leafShapeDistance(child, smallTree, bigTree);
 		fitsCheck++;
 		if (dist < res.worst())
 		{
@@ -334,8 +394,7 @@ void GSSTreeSearcher::nn_scan(ObjectTree smallobjTree, ObjectTree bigobjTree,
 		for (unsigned i = 0, n = leaf->size(); i < n; i++)
 		{
 			const GSSLeaf::Child *child = leaf->getChild(i);
-			double dist = shapeDistance(&child->tree, &child->tree, smallTree,
-					bigTree);
+			double dist = leafShapeDistance(child, smallTree, bigTree);
 			fitsCheck++;
 			respos.push_back(result_info(child->object_pos, dist));
 		}
@@ -382,16 +441,26 @@ void GSSTreeSearcher::nn_search(ObjectTree objectTree,	unsigned k, double thresh
 	nodesVisited = 0;
 	leavesVisited = 0;
 	levelCnts.clear();
+	MortonTree mobjTree;
+	if (morton)
+		mobjTree = linearize(objTree);
+
 	if (internalNodes.size() > 0)
 	{
 		const GSSInternalNode* root = (GSSInternalNode*) internalNodes.begin();
-		findNearest(root, objTree, ret, 0);
+		if (morton)
+			findNearest(root, mobjTree.get(), ret, 0);
+		else
+			findNearest(root, objTree, ret, 0);
 	}
 	else
 	{
 		//very small tree with just a leaf
 		const GSSLeaf* leaf = (GSSLeaf*) leaves.begin();
-		findNearest(leaf, objTree, ret);
+		if (morton)
+			findNearest(leaf, mobjTree.get(), ret);
+		else
+			findNearest(leaf, objTree, ret);
 	}
 
 	Timer objload;
@@ -428,6 +497,9 @@ void GSSTreeSearcher::nn_search(ObjectTree objectTree,	unsigned k, double thresh
 void GSSTreeSearcher::nn_scan(ObjectTree objectTree, bool loadObjs, Results& res)
 {
 	const MappableOctTree* objTree = objectTree.get();
+	MortonTree mobjTree;
+	if (morton)
+		mobjTree = linearize(objTree);
 
 	res.clear();
 
@@ -448,7 +520,12 @@ void GSSTreeSearcher::nn_scan(ObjectTree objectTree, bool loadObjs, Results& res
 		for (unsigned i = 0, n = leaf->size(); i < n; i++)
 		{
 			const GSSLeaf::Child *child = leaf->getChild(i);
-			double dist = volumeDist(objTree, &child->tree);
+			double dist = 0;
+			if (morton)
+				dist = volumeDist(mobjTree.get(),
+						child->getTree<MortonOctTree>());
+			else
+				dist = volumeDist(objTree, &child->tree);
 			fitsCheck++;
 			respos.push_back(result_info(child->object_pos, dist));
 		}
@@ -485,9 +562,9 @@ void GSSTreeSearcher::nn_scan(ObjectTree objectTree, bool loadObjs, Results& res
 }
 
 //return true if the object(s) represented by MIV/MSV might fit in between min and max
-bool GSSTreeSearcher::fitsInbetween(const MappableOctTree *MIV,
-		const MappableOctTree *MSV, const MappableOctTree *min,
-		const MappableOctTree *max)
+template<class Tree>
+bool GSSTreeSearcher::fitsInbetween(const Tree *MIV, const Tree *MSV,
+		const Tree *min, const Tree *max)
 {
 	fitsCheck++;
 	//the MSV must completely enclose min
@@ -515,9 +592,24 @@ void GSSTreeSearcher::dc_scan_search(ObjectTree smallobjTree,
 	Timer t;
 	vector<result_info> respos;
 	unsigned cnt = 0;
+	MortonTree msmall, mbig, morig;
+	if (morton)
+	{
+		msmall = linearize(smallTree);
+		mbig = linearize(bigTree);
+		morig = linearize(origTree);
+	}
+	TweenerQuery<MortonOctTree> mq =
+	{ msmall.get(), mbig.get(), morig.get(), smallTree, bigTree };
+	TweenerQuery<MappableOctTree> q =
+	{ smallTree, bigTree, origTree, smallTree, bigTree };
+
 	for (; leaf != end; leaf = (const GSSLeaf*) ((char*) leaf + leaf->bytes()))
 	{
-		cnt += findTweeners(leaf, smallTree, bigTree, origTree, res, loadObjs);
+		if (morton)
+			cnt += findTweeners(leaf, mq, res, loadObjs);
+		else
+			cnt += findTweeners(leaf, q, res, loadObjs);
 	}
 
 
@@ -529,9 +621,10 @@ void GSSTreeSearcher::dc_scan_search(ObjectTree smallobjTree,
 
 }
 
+template<class Tree>
 unsigned GSSTreeSearcher::findTweeners(const GSSInternalNode* node,
-		const MappableOctTree* min, const MappableOctTree* max, const MappableOctTree* orig,
-		Results& res, unsigned level, bool computeDist)
+		const TweenerQuery<Tree>& q, Results& res, unsigned level,
+		bool computeDist)
 {
 	nodesVisited++;
 	if (levelCnts.size() <= level)
@@ -547,7 +640,8 @@ unsigned GSSTreeSearcher::findTweeners(const GSSInternalNode* node,
 	{
 		const GSSInternalNode::Child *child = node->getChild(i);
 
-		if (fitsInbetween(child->getMIV(), child->getMSV(), min, max))
+		if (fitsInbetween(child->template getMIVAs<Tree>(),
+				child->template getMSVAs<Tree>(), q.min, q.max))
 		{
 			goodchildren.push_back(child);
 		}
@@ -563,14 +657,14 @@ unsigned GSSTreeSearcher::findTweeners(const GSSInternalNode* node,
 		{
 			const GSSLeaf* next = (const GSSLeaf*) (leaves.begin()
 					+ child->position());
-			ret += findTweeners(next, min, max, orig, res, computeDist);
+			ret += findTweeners(next, q, res, computeDist);
 		}
 		else
 		{
 			const GSSInternalNode* next =
 					(const GSSInternalNode*) (internalNodes.begin()
 							+ child->position());
-			ret += findTweeners(next, min, max, orig, res, level + 1, computeDist);
+			ret += findTweeners(next, q, res, level + 1, computeDist);
 		}
 	}
 	return ret;
@@ -578,25 +672,26 @@ unsigned GSSTreeSearcher::findTweeners(const GSSInternalNode* node,
 
 //identify and trees in this leaf that fit
 //if computeDist is true, compute a goodness of fit for reach result
+template<class Tree>
 unsigned GSSTreeSearcher::findTweeners(const GSSLeaf* node,
-		const MappableOctTree* min, const MappableOctTree* max, const MappableOctTree* orig,
-		Results& res, bool computeDist)
+		const TweenerQuery<Tree>& q, Results& res, bool computeDist)
 {
 	leavesVisited++;
 	unsigned cnt = 0;
 	for (unsigned i = 0, n = node->size(); i < n; i++)
 	{
 		const GSSLeaf::Child *child = node->getChild(i);
+		const Tree *tree = child->template getTree<Tree>();
 
-		if (fitsInbetween(&child->tree, &child->tree, min, max))
+		if (fitsInbetween(tree, tree, q.min, q.max))
 		{
 			double goodness = 0;
 			if (computeDist)
 			{
-				if(orig)
-					goodness = volumeDist(orig,&child->tree);
+				if(q.orig)
+					goodness = volumeDist(q.orig, tree);
 				else
-					goodness = shapeDistance(&child->tree, &child->tree, min, max);
+					goodness = leafShapeDistance(tree, q.mappedMin, q.mappedMax);
 
 				const char * addr = objects.begin() + child->object_pos;
 				res.add(addr, goodness);
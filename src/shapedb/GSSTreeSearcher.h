@@ -43,15 +43,38 @@ class GSSTreeSearcher
 	unsigned total;
 	float dimension;
 	float resolution;
+	bool morton; //index trees are MortonOctTrees
 
-	unsigned findTweeners(const GSSInternalNode* node, const MappableOctTree* min,
-			const MappableOctTree* max, const MappableOctTree* orig,
-			Results& res,
-			unsigned level, bool computeDist);
-	unsigned findTweeners(const GSSLeaf* node, const MappableOctTree* min,
-			const MappableOctTree* max, const MappableOctTree* orig,
-			Results& res,
+	typedef std::shared_ptr<const MortonOctTree> MortonTree;
+	static MortonTree linearize(const MappableOctTree *tree);
+
+	//the trees of a dc search in the format of the index, along with the
+	//original query trees for evaluating shapeDistance
+	template<class Tree>
+	struct TweenerQuery
+	{
+		const Tree *min;
+		const Tree *max;
+		const Tree *orig;
+		const MappableOctTree *mappedMin;
+		const MappableOctTree *mappedMax;
+	};
+
+	template<class Tree>
+	unsigned findTweeners(const GSSInternalNode* node,
+			const TweenerQuery<Tree>& q, Results& res, unsigned level,
 			bool computeDist);
+	template<class Tree>
+	unsigned findTweeners(const GSSLeaf* node, const TweenerQuery<Tree>& q,
+			Results& res, bool computeDist);
+
+	//shapeDistance of a single leaf tree against the query
+	double leafShapeDistance(const MappableOctTree *tree,
+			const MappableOctTree *min, const MappableOctTree *max) const;
+	double leafShapeDistance(const MortonOctTree *tree,
+			const MappableOctTree *min, const MappableOctTree *max) const;
+	double leafShapeDistance(const GSSLeaf::Child *child,
+			const MappableOctTree *min, const MappableOctTree *max) const;
 
 	struct ObjDist
 	{
@@ -101,10 +124,11 @@ class GSSTreeSearcher
 
 	};
 
-	void findNearest(const GSSInternalNode* node, const MappableOctTree* obj,
+	template<class Tree>
+	void findNearest(const GSSInternalNode* node, const Tree* obj,
 			TopObj& res, unsigned level);
-	void findNearest(const GSSLeaf* node, const MappableOctTree* obj,
-			TopObj& res);
+	template<class Tree>
+	void findNearest(const GSSLeaf* node, const Tree* obj, TopObj& res);
 
 	void findNearest(const GSSInternalNode* node, const MappableOctTree* minobj,
 			const MappableOctTree* maxobj,
@@ -120,19 +144,26 @@ class GSSTreeSearcher
 	vector<unsigned> maxlevelCnts;
 	unsigned leavesVisited;
 	unsigned fullLeaves;
-	bool fitsInbetween(const MappableOctTree *MIV, const MappableOctTree *MSV,
-			const MappableOctTree *min, const MappableOctTree *max);
+	template<class Tree>
+	bool fitsInbetween(const Tree *MIV, const Tree *MSV, const Tree *min,
+			const Tree *max);
 
 public:
 	typedef std::shared_ptr<const MappableOctTree> ObjectTree;
 
 	GSSTreeSearcher(bool v = false) :
-			verbose(v), total(0)
+			verbose(v), total(0), dimension(0), resolution(0), morton(false)
 	{
 	}
 
 	bool load(const boost::filesystem::path& dbpath);
 	void clear();
+
+	//the nodes are traversed randomly by every search
+	void makeResident()
+	{
+		internalNodes.makeResident();
+	}
 	~GSSTreeSearcher();
 
 	unsigned size() const
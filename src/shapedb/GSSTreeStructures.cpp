@@ -23,6 +23,7 @@ void GSSLeaf::writeLeaf(const DataViewer *data, const Cluster& cluster, ostream&
 	GSSNodeCommon info;
 	info.isLeaf = true;
 	info.N = cluster.size();
+	info.isMorton = false;
 
 	unsigned positions[info.N];
 
@@ -70,6 +71,7 @@ void GSSInternalNode::writeNode(const DataViewer *data, const Cluster& cluster,
 	GSSNodeCommon info;
 	info.isLeaf = false;
 	info.N = cluster.size();
+	info.isMorton = false;
 
 	unsigned positions[info.N];
 	outNodes.write((char*)&info, sizeof(info));
@@ -143,6 +145,7 @@ GSSInternalNode* GSSInternalNode::createMergedNode(const vector<GSSInternalNode*
 
 	ret->info.isLeaf = false;
 	ret->info.N = numChildren;
+	ret->info.isMorton = false;
 	unsigned offset = 0;
 	memcpy(ret->data(), &positions[0], posoff);
 	offset += posoff;
@@ -174,16 +177,21 @@ unsigned GSSLeaf::bytes() const
 	const Child* child = (const Child*)&d[child_positions[info.N-1]];
 	//add size of last child
 	ret += sizeof(file_index);
-	ret += child->tree.bytes();
+	if(info.isMorton)
+		ret += child->getTree<MortonOctTree>()->bytes();
+	else
+		ret += child->tree.bytes();
 	return ret;
 }
 
-unsigned GSSInternalNode::Child::bytes() const
+unsigned GSSInternalNode::Child::bytes(bool morton) const
 {
 	unsigned ret = sizeof(Child);
 	ret += MSVindex;
-	const MappableOctTree* msv = getMSV();
-	ret += msv->bytes();
+	if(morton)
+		ret += getMSVAs<MortonOctTree>()->bytes();
+	else
+		ret += getMSV()->bytes();
 
 	return ret;
 }
@@ -196,7 +204,7 @@ unsigned GSSInternalNode::bytes() const
 	unsigned char *d = data();
 	const Child* child = (const Child*)&d[child_positions[info.N-1]];
 	//add size of last child
-	ret += child->bytes();
+	ret += child->bytes(info.isMorton);
 	return ret;
 }
 
@@ -327,3 +335,89 @@ GSSInternalNode* GSSInternalNode::createTruncated(float dimension, float res) co
 	return (GSSInternalNode*)buffer;
 }
 
+
+//malloc a copy of this leaf with each tree linearized
+GSSLeaf* GSSLeaf::createMorton() const
+{
+	unsigned nc = size();
+	MortonOctTree *trees[nc];
+	unsigned positions[nc];
+
+	unsigned curoffset = nc*sizeof(unsigned);
+	for(unsigned c = 0; c < nc; c++)
+	{
+		trees[c] = MortonOctTree::create(&getChild(c)->tree);
+		positions[c] = curoffset;
+		curoffset += sizeof(file_index);
+		curoffset += trees[c]->bytes();
+	}
+
+	unsigned char* buffer = (unsigned char*)malloc(curoffset+sizeof(GSSLeaf));
+	GSSLeaf *ret = (GSSLeaf*)buffer;
+	ret->info = info;
+	ret->info.isMorton = true;
+	unsigned offset = sizeof(GSSLeaf);
+	memcpy(buffer+offset, positions, sizeof(unsigned)*nc);
+	offset += sizeof(unsigned)*nc;
+
+	for(unsigned c = 0; c < nc; c++)
+	{
+		file_index pos = getChild(c)->object_pos;
+		memcpy(buffer+offset, &pos, sizeof(file_index));
+		offset += sizeof(file_index);
+		memcpy(buffer+offset, trees[c], trees[c]->bytes());
+		offset += trees[c]->bytes();
+		free(trees[c]);
+	}
+
+	assert(offset == curoffset+sizeof(GSSLeaf));
+	return ret;
+}
+
+//malloc a copy of this node with each MIV/MSV linearized
+GSSInternalNode* GSSInternalNode::createMorton() const
+{
+	unsigned nc = size();
+	MortonOctTree *MIVs[nc];
+	MortonOctTree *MSVs[nc];
+	unsigned positions[nc];
+
+	unsigned curoffset = nc*sizeof(unsigned);
+	for(unsigned c = 0; c < nc; c++)
+	{
+		const Child *child = getChild(c);
+		MIVs[c] = MortonOctTree::create(child->getMIV());
+		MSVs[c] = MortonOctTree::create(child->getMSV());
+		positions[c] = curoffset;
+		curoffset += sizeof(Child);
+		curoffset += MIVs[c]->bytes();
+		curoffset += MSVs[c]->bytes();
+	}
+
+	unsigned char* buffer = (unsigned char*)malloc(curoffset+sizeof(GSSInternalNode));
+	GSSInternalNode *ret = (GSSInternalNode*)buffer;
+	ret->info = info;
+	ret->info.isMorton = true;
+	unsigned offset = sizeof(GSSInternalNode);
+	memcpy(buffer+offset, positions, sizeof(unsigned)*nc);
+	offset += sizeof(unsigned)*nc;
+
+	for(unsigned c = 0; c < nc; c++)
+	{
+		Child child = *getChild(c);
+		child.MSVindex = MIVs[c]->bytes();
+
+		memcpy(buffer+offset, &child, sizeof(Child));
+		offset += sizeof(Child);
+		memcpy(buffer+offset, MIVs[c], MIVs[c]->bytes());
+		offset += MIVs[c]->bytes();
+		memcpy(buffer+offset, MSVs[c], MSVs[c]->bytes());
+		offset += MSVs[c]->bytes();
+
+		free(MIVs[c]);
+		free(MSVs[c]);
+	}
+
+	assert(offset == curoffset+sizeof(GSSInternalNode));
+	return ret;
+}
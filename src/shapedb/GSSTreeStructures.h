@@ -28,6 +28,7 @@ See the LICENSE file provided with the distribution for more information.
 #define GSSTREESTRUCTURES_H_
 
 #include "MappableOctTree.h"
+#include "MortonOctTree.h"
 #include "GSSTypes.h"
 #include <cassert>
 
@@ -58,10 +59,12 @@ struct GSSDoubleTree
 };
 
 //header of leaf and internal nodes
+//isMorton is the top bit so indices written before it existed read as unset
 struct GSSNodeCommon
 {
 	bool isLeaf: 1;
-	unsigned N: 31;
+	unsigned N: 30;
+	bool isMorton: 1; //trees are stored as MortonOctTrees
 };
 
 //a GSSLeaf only needs to store a single tree for each object, and the positions
@@ -73,6 +76,10 @@ public:
 	{
 		file_index object_pos;
 		MappableOctTree tree;
+
+		//view the tree as Tree, which must match the format of the leaf
+		template<class Tree>
+		const Tree* getTree() const { return (const Tree*)&tree; }
 	} __attribute__((__packed__));
 private:
 	GSSNodeCommon info;
@@ -88,6 +95,10 @@ public:
 	unsigned char *data() const { return (unsigned char*)&child_positions; }
 	unsigned size() const { return info.N; }
 	unsigned bytes() const;
+	bool isMorton() const { return info.isMorton; }
+
+	//copy with the trees linearized, returns result in malloced memory
+	GSSLeaf* createMorton() const;
 } __attribute__((__packed__));
 
 //a GSSInternalNode stores both the MIV and MSV for each subnode, and points to their locations
@@ -110,9 +121,15 @@ public:
 		const MappableOctTree* getMIV() const { return (const MappableOctTree*)data; }
 		const MappableOctTree* getMSV() const { return (MappableOctTree*)&data[MSVindex];}
 
+		//view the trees as Tree, which must match the format of the node
+		template<class Tree>
+		const Tree* getMIVAs() const { return (const Tree*)data; }
+		template<class Tree>
+		const Tree* getMSVAs() const { return (const Tree*)&data[MSVindex]; }
+
 		file_index position() const { return node_pos; }
 		bool isLeafPosition() const { return isLeaf; }
-		unsigned bytes() const;
+		unsigned bytes(bool morton = false) const;
 	} __attribute__((__packed__));
 private:
 	GSSNodeCommon info;
@@ -127,11 +144,15 @@ public:
 	}
 	unsigned size() const { return info.N; }
 	unsigned bytes() const;
+	bool isMorton() const { return info.isMorton; }
 	unsigned char *data() const { return (unsigned char*)&child_positions; }
 
 	//truncates MIV/MSV of children, returns result in malloced memory
 	GSSInternalNode* createTruncated(float dimension, float resolution) const;
 
+	//copy with the trees linearized, returns result in malloced memory
+	GSSInternalNode* createMorton() const;
+
 	void setChildPos(unsigned i, file_index newpos, bool isLeaf, file_index lstart, file_index lend);
 } __attribute__((__packed__));
 
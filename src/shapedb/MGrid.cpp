@@ -22,6 +22,7 @@ See the LICENSE file provided with the distribution for more information.
 
 #include "MGrid.h"
 #include "molecules/Molecule.h"
+#include <boost/functional/hash.hpp>
 
 void MGrid::gridToPoint(unsigned long g, double& x, double& y, double& z) const
 {
@@ -100,7 +101,9 @@ void MGrid::markZChord(double x, double y, double z, double r)
 //makr a circle in grid centered at x,y,z with radius r
 void MGrid::markYZCircle(double x, double y, double z, double r)
 {
-	for (double d = 0; d <= r; d += resolution)
+	//chords further out than both edges of the grid can't be marked
+	double maxd = min(r, max(fabs(y + dimension / 2), fabs(y - dimension / 2)));
+	for (double d = 0; d <= maxd; d += resolution)
 	{
 		double cr = chordRadius(r, d);
 		markZChord(x, y + d, z, cr);
@@ -113,8 +116,10 @@ void MGrid::markXYZSphere(double x, double y, double z, double r)
 {
 	if (sphereInGrid(x, y, z, r))
 	{
-		//mark all yz circles
-		for (double d = 0; d <= r; d += resolution)
+		//mark all yz circles, those past both edges of the grid can't be
+		//marked and a huge radius shouldn't mean a huge loop
+		double maxd = min(r, max(fabs(x + dimension / 2), fabs(x - dimension / 2)));
+		for (double d = 0; d <= maxd; d += resolution)
 		{
 			double cr = chordRadius(r, d);
 			markYZCircle(x + d, y, z, cr);
@@ -285,27 +290,140 @@ void MGrid::growByOne()
 }
 
 
+//one dimensional squared distance transform of the sampled function f
+//(Felzenszwalb and Huttenlocher, Distance Transforms of Sampled Functions, 2012)
+//v and z are scratch space of size n and n+1
+static void distanceTransform1D(const float *f, float *d, unsigned n, int *v, float *z)
+{
+	const float INF = 1e20;
+	int k = 0;
+	v[0] = 0;
+	z[0] = -INF;
+	z[1] = INF;
+	for (int q = 1; q < (int) n; q++)
+	{
+		float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		while (s <= z[k])
+		{
+			k--;
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = INF;
+	}
+
+	k = 0;
+	for (int q = 0; q < (int) n; q++)
+	{
+		while (z[k + 1] < q)
+			k++;
+		d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+//compute, in place, the squared euclidean distance (in grid units) of every
+//point of the len^3 grid to the nearest point where dist is zero
+//this is separable, so transform along z, then y, then x
+static void distanceTransform(vector<float>& dist, unsigned len)
+{
+	vector<float> f(len), d(len), z(len + 1);
+	vector<int> v(len);
+	unsigned strides[3] = { 1, len, len * len };
+	for (unsigned s = 0; s < 3; s++)
+	{
+		unsigned stride = strides[s];
+		//each line along this axis starts at a point whose coordinate is 0 along it
+		for (unsigned i = 0, n = len * len * len; i < n; i++)
+		{
+			if ((i / stride) % len != 0)
+				continue;
+			for (unsigned j = 0; j < len; j++)
+				f[j] = dist[i + j * stride];
+			distanceTransform1D(&f[0], &d[0], len, &v[0], &z[0]);
+			for (unsigned j = 0; j < len; j++)
+				dist[i + j * stride] = d[j];
+		}
+	}
+}
+
 //reduce the size of the object by the specified amount
+//removes every set point within amount (rounded up to the resolution) of an
+//unset point; points outside the grid are considered set
 void MGrid::shrink(double amount)
 {
 	unsigned num = ceil(amount / resolution);
-	for (unsigned i = 0; i < num; i++)
+	if (num == 0 || grid.count() == 0)
+		return;
+
+	unsigned len = dimension / resolution;
+	unsigned total = len * len * len;
+	vector<float> dist(total, 0);
+	bvect::enumerator en = grid.first();
+	bvect::enumerator en_end = grid.end();
+	while (en < en_end)
 	{
-		shrinkByOne();
-		if(grid.count() == 0)
-			break;
+		dist[*en] = 1e20; //unset points are the seeds
+		++en;
 	}
 
+	distanceTransform(dist, len);
+
+	bvect shrunk;
+	float maxdistSq = num * num;
+	for (unsigned i = 0; i < total; i++)
+	{
+		if (dist[i] > maxdistSq)
+			shrunk.set(i);
+	}
+	grid.swap(shrunk);
 }
 
 //grow the size of the object by the specified amount
+//sets every point within amount (rounded up to the resolution) of a set point
 void MGrid::grow(double amount)
 {
 	unsigned num = ceil(amount / resolution);
-	for (unsigned i = 0; i < num; i++)
+	if (num == 0 || grid.count() == 0)
+		return;
+
+	unsigned len = dimension / resolution;
+	unsigned total = len * len * len;
+	vector<float> dist(total, 1e20);
+	bvect::enumerator en = grid.first();
+	bvect::enumerator en_end = grid.end();
+	while (en < en_end)
+	{
+		dist[*en] = 0; //set points are the seeds
+		++en;
+	}
+
+	distanceTransform(dist, len);
+
+	bvect grown;
+	float maxdistSq = num * num;
+	for (unsigned i = 0; i < total; i++)
+	{
+		if (dist[i] <= maxdistSq)
+			grown.set(i);
+	}
+	grid.swap(grown);
+}
+
+size_t MGrid::hash() const
+{
+	size_t seed = 0;
+	boost::hash_combine(seed, dimension);
+	boost::hash_combine(seed, resolution);
+	bvect::enumerator en = grid.first();
+	bvect::enumerator en_end = grid.end();
+	while (en < en_end)
 	{
-		growByOne();
+		boost::hash_combine(seed, *en);
+		++en;
 	}
+	return seed;
 }
 
 //return all set points in vector
@@ -325,89 +443,161 @@ void MGrid::getSetPoints(vector<MGrid::Point>& points) const
 
 }
 
-//make a face a distance r from pt along which axis
-void MGrid::makeFace(Eigen::Vector3f pt, int which, double r,vector<Eigen::Vector3f>& vertices, vector<Eigen::Vector3f>& normals, vector<int>& faces)
+//word j of the dense bit string src, with everything outside the grid set
+static inline uint64_t gridWord(const vector<uint64_t>& src, long j,
+		unsigned long nbits)
 {
-	using namespace Eigen;
-	Vector3f neigh = pt;
-	neigh[which] += 2*r;
-	if(!test(neigh.x(), neigh.y(), neigh.z()))
-	{
-		//exposed, make verts
-		pt[which] += r;
-
-		//one dimension is only in r, the other are +/- both ways to make corners
-		Vector3f v1 = pt, v2 = pt, v3 = pt, v4 = pt;
-		v1[(which+1)%3] += r;
-		v1[(which+2)%3] += r;
-
-		v2[(which+1)%3] += r;
-		v2[(which+2)%3] -= r;
-
-		v3[(which+1)%3] -= r;
-		v3[(which+2)%3] -= r;
-
-		v4[(which+1)%3] -= r;
-		v4[(which+2)%3] += r;
-
-		int i1,i2,i3,i4;
-		i1 = vertices.size();
-		vertices.push_back(v1);
-
-		i2 = vertices.size();
-		vertices.push_back(v2);
-
-		i3 = vertices.size();
-		vertices.push_back(v3);
-
-		i4 = vertices.size();
-		vertices.push_back(v4);
-
-		//the normals are all the same - r
-		Vector3f norm(0,0,0);
-		norm[which] = -1.0; //becaue of counterclockwise winding??
-		normals.push_back(norm);
-		normals.push_back(norm);
-		normals.push_back(norm);
-		normals.push_back(norm);
-
-		//two faces [v1,v2,v3] and [v1,v3,v4]
-		faces.push_back(i1);
-		faces.push_back(i2);
-		faces.push_back(i3);
+	if (j < 0 || (unsigned long) j >= src.size())
+		return ~0ULL;
+	uint64_t word = src[j];
+	if ((unsigned long) j == src.size() - 1 && nbits % 64 != 0)
+		word |= ~0ULL << (nbits % 64);
+	return word;
+}
 
-		faces.push_back(i1);
-		faces.push_back(i3);
-		faces.push_back(i4);
+//dst[i] = src[i+shift] as a dense bit string, bits shifted in from outside
+//the grid are set since test treats points outside the grid as set
+static void shiftBits(const vector<uint64_t>& src, long shift,
+		unsigned long nbits, vector<uint64_t>& dst)
+{
+	long nw = src.size();
+	long q = shift >= 0 ? shift / 64 : -((-shift + 63) / 64);
+	unsigned r = shift - q * 64;
+	dst.resize(nw);
+	for (long w = 0; w < nw; w++)
+	{
+		uint64_t word = gridWord(src, w + q, nbits) >> r;
+		if (r > 0)
+			word |= gridWord(src, w + q + 1, nbits) << (64 - r);
+		dst[w] = word;
 	}
 }
 
 //create a voxel mesh from a grid
 //does not clear vectors, instead appends info
+//faces of set voxels are only made where the neighboring voxel (in grid) is
+//unset; these are found a word at a time from shifted copies of the grid and
+//quad corners are shared between faces through a table of lattice corners
 void MGrid::makeMesh(vector<Eigen::Vector3f>& vertices, vector<Eigen::Vector3f>& normals, vector<int>& faces)
 {
 	using namespace Eigen;
+	unsigned len = dimension / resolution;
+	unsigned long nbits = (unsigned long) len * len * len;
+	unsigned long nw = (nbits + 63) / 64;
+
+	//dense copy of the grid, index is (x*len+y)*len+z
+	vector<uint64_t> bits(nw, 0);
 	bvect::enumerator en = grid.first();
 	bvect::enumerator en_end = grid.end();
-	double x = 0, y = 0, z = 0;
-
 	while (en < en_end)
 	{
 		unsigned g = *en;
 		++en;
-		gridToPoint(g, x, y , z);
+		bits[g / 64] |= 1ULL << (g % 64);
+	}
+
+	//exposed[2*axis] are faces in the + direction, then -
+	unsigned long strides[3] = { (unsigned long) len * len, len, 1 };
+	vector<uint64_t> exposed[6];
+	vector<uint64_t> anyexposed(nw, 0);
+	vector<uint64_t> neigh;
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		for (unsigned s = 0; s < 2; s++)
+		{
+			long shift = s == 0 ? (long) strides[axis] : -(long) strides[axis];
+			shiftBits(bits, shift, nbits, neigh);
+
+			//neighbors across a row boundary are outside the grid
+			if (axis > 0)
+			{
+				unsigned long stride = strides[axis];
+				unsigned long edge = s == 0 ? (len - 1) * stride : 0;
+				for (unsigned long start = edge; start < nbits; start += stride * len)
+				{
+					for (unsigned long i = start; i < start + stride; i++)
+						neigh[i / 64] |= 1ULL << (i % 64);
+				}
+			}
+
+			vector<uint64_t>& ex = exposed[2 * axis + s];
+			ex.resize(nw);
+			for (unsigned long w = 0; w < nw; w++)
+			{
+				ex[w] = bits[w] & ~neigh[w];
+				anyexposed[w] |= ex[w];
+			}
+		}
+	}
+
+	//index of each cell corner's vertex, -1 if not made yet
+	unsigned clen = len + 1;
+	vector<int> corners((unsigned long) clen * clen * clen, -1);
+	unsigned long base = vertices.size();
+	float half = dimension / 2;
 
-		if(isExposedPoint(x,y,z))
+	for (unsigned long w = 0; w < nw; w++)
+	{
+		uint64_t word = anyexposed[w];
+		while (word)
 		{
-			double r = resolution/2.0;
-			Vector3f pt(x,y,z);
-			for(unsigned i = 0; i < 3; i++)
+			unsigned b = __builtin_ctzll(word);
+			word &= word - 1;
+			unsigned long g = w * 64 + b;
+			unsigned c[3] = { (unsigned) (g / strides[0]),
+					(unsigned) ((g / len) % len), (unsigned) (g % len) };
+
+			for (unsigned which = 0; which < 3; which++)
 			{
-				//doesn't make a face unless actually exposed
-				makeFace(pt, i, r, vertices, normals, faces);
-				makeFace(pt, i, -r, vertices, normals, faces);
+				for (unsigned s = 0; s < 2; s++)
+				{
+					if (!(exposed[2 * which + s][w] & (1ULL << b)))
+						continue;
+
+					//one dimension is fixed on the face, the others are +/- r both
+					//ways to make the corners: v1 ++, v2 +-, v3 --, v4 -+
+					//(r is negative on the - side, which flips the corners)
+					unsigned a1 = (which + 1) % 3, a2 = (which + 2) % 3;
+					static const unsigned offs[4][2] = { {1,1}, {1,0}, {0,0}, {0,1} };
+					unsigned flip = s == 0 ? 0 : 1;
+					int idx[4];
+					for (unsigned v = 0; v < 4; v++)
+					{
+						unsigned corner[3];
+						corner[which] = c[which] + 1 - flip;
+						corner[a1] = c[a1] + (offs[v][0] ^ flip);
+						corner[a2] = c[a2] + (offs[v][1] ^ flip);
+						unsigned long ci = ((unsigned long) corner[0] * clen
+								+ corner[1]) * clen + corner[2];
+						if (corners[ci] < 0)
+						{
+							corners[ci] = vertices.size();
+							vertices.push_back(Vector3f(corner[0] * resolution - half,
+									corner[1] * resolution - half,
+									corner[2] * resolution - half));
+							normals.push_back(Vector3f(0, 0, 0));
+						}
+						idx[v] = corners[ci];
+						//accumulate face normals, normalized below
+						normals[idx[v]][which] -= 1.0; //becaue of counterclockwise winding??
+					}
+
+					//two faces [v1,v2,v3] and [v1,v3,v4]
+					faces.push_back(idx[0]);
+					faces.push_back(idx[1]);
+					faces.push_back(idx[2]);
+
+					faces.push_back(idx[0]);
+					faces.push_back(idx[2]);
+					faces.push_back(idx[3]);
+				}
 			}
 		}
 	}
+
+	for (unsigned long i = base, n = normals.size(); i < n; i++)
+	{
+		normals[i].normalize();
+	}
 }
 
@@ -42,9 +42,6 @@ class MGrid
 	void shrinkByOne();
 	void growByOne();
 
-	 void makeFace(Eigen::Vector3f pt, int which, double r,
-			 vector<Eigen::Vector3f>& vertices, vector<Eigen::Vector3f>& normals, vector<int>& faces);
-
 
 	double dimension; //max size, in distance unites
 	double resolution; //size of each grid cube
@@ -82,6 +79,13 @@ public:
 		return pointToGrid(x,y,z) >= 0;
 	}
 
+	//inGrid && test with a single lookup
+	bool testInGrid(float x, float y, float z) const
+	{
+		int pt = pointToGrid(x,y,z);
+		return pt >= 0 && grid.test(pt);
+	}
+
 	//test for x,y,z - match signature expected from oct tree creation
 	bool containsPoint(float x, float y, float z) const
 	{
@@ -130,6 +134,15 @@ public:
 		return grid.count();
 	}
 
+	bool operator==(const MGrid& rhs) const
+	{
+		return dimension == rhs.dimension && resolution == rhs.resolution
+				&& grid == rhs.grid;
+	}
+
+	//hash of the set points
+	size_t hash() const;
+
 	void getSetPoints(std::vector<Point>& points) const;
 
 	void makeMesh(vector<Eigen::Vector3f>& vertices, vector<Eigen::Vector3f>& normals, vector<int>& faces);
@@ -162,6 +162,7 @@ struct MOctNode
 
 class MappableOctTree
 {
+	friend class MortonOctTree;
 	MChildNode root;
 	float dimension;
 	unsigned N; //number of octnodes
@@ -268,6 +269,22 @@ public:
 			"#FFFFFFFF") const;
 	void countLeavesAtDepths(vector<unsigned>& counts) const;
 private:
+	//objects that can cheaply restrict themselves to a cube (the analytic
+	//molecules) provide narrow() so children are only tested against the
+	//part of the object that reaches into their parent
+	template<class Object>
+	static auto narrowTo(const Object& obj, const Cube& cube, int)
+			-> decltype(obj.narrow(cube))
+	{
+		return obj.narrow(cube);
+	}
+
+	template<class Object>
+	static const Object& narrowTo(const Object& obj, const Cube& cube, long)
+	{
+		return obj;
+	}
+
 	template<class Object>
 	static MChildNode create_r(float res, const Cube& cube, const Object& obj,
 			vector<MOctNode>& tree)
@@ -295,7 +312,8 @@ private:
 		}
 
 		//does the object overlap with this cube?
-		bool intersects = obj.intersects(cube);
+		const auto& part = narrowTo(obj, cube, 0);
+		bool intersects = part.intersects(cube);
 		if (!intersects)
 		{
 			//no overlap, all done
@@ -325,7 +343,7 @@ private:
 			for (unsigned i = 0; i < 8; i++)
 			{
 				Cube newc = cube.getOctant(i);
-				MChildNode child = create_r(res, newc, obj, tree);
+				MChildNode child = create_r(res, newc, part, tree);
 				tree[pos].children[i] = child;
 				if (child.isLeaf)
 				{
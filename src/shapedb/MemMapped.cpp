@@ -21,6 +21,7 @@ See the LICENSE file provided with the distribution for more information.
  */
 
 #include "MemMapped.h"
+#include "ResidentMemory.h"
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <cstdio>
@@ -32,16 +33,32 @@ using namespace boost;
 void MemMapped::clear()
 {
 	if(addr != NULL)
-		munmap(addr, sz);
+	{
+		if(resident)
+			ResidentMemory::release(name, addr, resident);
+		else
+			munmap(addr, sz);
+	}
 	addr = NULL;
 	sz = 0;
+	resident = 0;
+}
+
+void MemMapped::makeResident()
+{
+	if(addr == NULL || resident)
+		return;
+	void *mem = ResidentMemory::copy(name, addr, sz, resident);
+	if(mem == NULL)
+		return; //keep the file mapping
+	munmap(addr, sz);
+	addr = mem;
 }
 
 bool MemMapped::map(const string& fname, bool readOnly, bool sequential, bool populate/*=false*/, bool readonce/*=false*/)
 {
-	if(addr != NULL)
-		munmap(addr, sz);
-	addr = NULL;
+	clear();
+	name = fname;
 	unsigned flags = readOnly ? O_RDONLY : O_RDWR;
 	int fd = open(fname.c_str(), flags);
 	assert(fd >= 0);
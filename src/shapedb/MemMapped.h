@@ -34,8 +34,10 @@ class MemMapped
 {
 	void *addr;
 	unsigned long sz;
+	string name;
+	unsigned long resident; //length of a resident copy, 0 if mapped from the file
 public:
-	MemMapped(): addr(NULL), sz(0) {}
+	MemMapped(): addr(NULL), sz(0), resident(0) {}
 	~MemMapped() {} //does not unmap, must explicitly clear
 
 	//map a file into memory
@@ -48,6 +50,9 @@ public:
 	const char * end() const { return (const char*)addr + sz; }
 	void clear();
 	unsigned long size() const { return sz; }
+
+	//replace a read only mapping with a huge page backed copy if allowed
+	void makeResident();
 };
 
 #endif /* MEMMAPPED_H_ */
@@ -0,0 +1,258 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * MortonOctTree.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "MortonOctTree.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+//append [s,e) to runs, merging with the previous run if adjacent
+static inline void addRun(vector<uint32_t>& runs, uint32_t s, uint32_t e)
+{
+	if (runs.size() > 0 && runs.back() == s)
+		runs.back() = e;
+	else
+	{
+		runs.push_back(s);
+		runs.push_back(e);
+	}
+}
+
+//octants are visited in order, so runs come out sorted
+void MortonOctTree::collectRuns(const MOctNode* tree, const MChildNode& node,
+		uint32_t start, uint32_t size, vector<uint32_t>& runs)
+{
+	if (node.isLeaf && node.leaf.pattern == 0)
+		return;
+	if (node.isLeaf && node.leaf.pattern == 0xff)
+	{
+		addRun(runs, start, start + size);
+		return;
+	}
+
+	uint32_t sub = size / 8;
+	if (sub == 0)
+	{
+		cerr
+				<< "Oct tree deeper than MORTON_DEPTH. Must recompile to support finer resolutions.\n";
+		abort();
+	}
+
+	for (unsigned i = 0; i < 8; i++)
+	{
+		if (node.isLeaf)
+		{
+			if (node.leaf.pattern & (1 << i))
+				addRun(runs, start + i * sub, start + (i + 1) * sub);
+		}
+		else
+		{
+			collectRuns(tree, tree[node.node.index].children[i],
+					start + i * sub, sub, runs);
+		}
+	}
+}
+
+MortonOctTree* MortonOctTree::create(const MappableOctTree *tree)
+{
+	vector<uint32_t> runs;
+	collectRuns(tree->tree, tree->root, 0, 1U << (3 * MORTON_DEPTH), runs);
+
+	unsigned N = runs.size() / 2;
+	MortonOctTree *ret = (MortonOctTree*) malloc(
+			sizeof(MortonOctTree) + runs.size() * sizeof(uint32_t));
+	ret->dimension = tree->dimension;
+	ret->N = N;
+	ret->count = 0;
+	for (unsigned i = 0; i < N; i++)
+	{
+		ret->runs[2 * i] = runs[2 * i];
+		ret->runs[2 * i + 1] = runs[2 * i + 1];
+		ret->count += runs[2 * i + 1] - runs[2 * i];
+	}
+	return ret;
+}
+
+MappableOctTree* MortonOctTree::createMappable(float res) const
+{
+	return MappableOctTree::create(dimension, res, *this);
+}
+
+void MortonOctTree::write(ostream& out) const
+{
+	out.write((char*) this, bytes());
+}
+
+uint32_t MortonOctTree::encode(uint32_t x, uint32_t y, uint32_t z)
+{
+	uint32_t code = 0;
+	for (unsigned b = 0; b < MORTON_DEPTH; b++)
+	{
+		code |= ((x >> b) & 1) << (3 * b);
+		code |= ((y >> b) & 1) << (3 * b + 1);
+		code |= ((z >> b) & 1) << (3 * b + 2);
+	}
+	return code;
+}
+
+//binary search for the first run ending after s
+bool MortonOctTree::overlaps(uint32_t s, uint32_t e) const
+{
+	unsigned lo = 0, hi = N;
+	while (lo < hi)
+	{
+		unsigned mid = (lo + hi) / 2;
+		if (runs[2 * mid + 1] <= s)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < N && runs[2 * lo] < e;
+}
+
+bool MortonOctTree::containsPoint(float x, float y, float z) const
+{
+	float cell = dimension / (1 << MORTON_DEPTH);
+	float half = dimension / 2;
+	if (x < -half || y < -half || z < -half || x >= half || y >= half
+			|| z >= half)
+		return false;
+
+	uint32_t code = encode((x + half) / cell, (y + half) / cell,
+			(z + half) / cell);
+	return overlaps(code, code + 1);
+}
+
+//cubes must be aligned with the octree, as they are in MappableOctTree::create
+bool MortonOctTree::intersects(const Cube& cube) const
+{
+	float cell = dimension / (1 << MORTON_DEPTH);
+	float half = dimension / 2;
+	float bx = 0, by = 0, bz = 0;
+	cube.getBottomCorner(bx, by, bz);
+	uint32_t side = lround(cube.getDimension() / cell);
+	if (side == 0)
+		side = 1;
+	uint32_t s = encode(lround((bx + half) / cell), lround((by + half) / cell),
+			lround((bz + half) / cell));
+	return overlaps(s, s + side * side * side);
+}
+
+//every run of this must lie within a single run of rhs since rhs's runs
+//are maximal
+bool MortonOctTree::containedIn(const MortonOctTree *rhs) const
+{
+	if (count > rhs->count)
+		return false;
+
+	const uint32_t *a = runs;
+	const uint32_t *aend = runs + 2 * N;
+	const uint32_t *b = rhs->runs;
+	const uint32_t *bend = rhs->runs + 2 * rhs->N;
+
+	for (; a != aend; a += 2)
+	{
+		while (b != bend && b[1] <= a[0])
+			b += 2;
+		if (b == bend || b[0] > a[0] || b[1] < a[1])
+			return false;
+	}
+	return true;
+}
+
+void MortonOctTree::intersectUnionVolume(const MortonOctTree *rhs, float& ival,
+		float& uval) const
+{
+	const uint32_t *a = runs;
+	const uint32_t *aend = runs + 2 * N;
+	const uint32_t *b = rhs->runs;
+	const uint32_t *bend = rhs->runs + 2 * rhs->N;
+
+	unsigned long icnt = 0;
+	while (a != aend && b != bend)
+	{
+		uint32_t lo = max(a[0], b[0]);
+		uint32_t hi = min(a[1], b[1]);
+		if (hi > lo)
+			icnt += hi - lo;
+		//advance whichever run ends first
+		if (a[1] < b[1])
+			a += 2;
+		else
+			b += 2;
+	}
+
+	float cvol = cellVolume();
+	ival = icnt * cvol;
+	uval = ((unsigned long) count + rhs->count - icnt) * cvol;
+}
+
+float MortonOctTree::intersectVolume(const MortonOctTree *rhs) const
+{
+	float ival = 0, uval = 0;
+	intersectUnionVolume(rhs, ival, uval);
+	return ival;
+}
+
+float MortonOctTree::unionVolume(const MortonOctTree *rhs) const
+{
+	float ival = 0, uval = 0;
+	intersectUnionVolume(rhs, ival, uval);
+	return uval;
+}
+
+float MortonOctTree::relativeVolumeDistance(const MortonOctTree *rhs) const
+{
+	float ival = 0, uval = 0;
+	if (dimension != rhs->dimension)
+	{
+		std::cerr << "Dimensions do not match relativeVolumeDistance: "
+				<< dimension << " vs " << rhs->dimension << "\n";
+		return 0;
+	}
+
+	intersectUnionVolume(rhs, ival, uval);
+	if (uval == 0) //two empty shapes
+		return 0.0;
+	return 1 - ival / uval;
+}
+
+float MortonOctTree::absoluteVolumeDistance(const MortonOctTree *rhs) const
+{
+	float ival = 0, uval = 0;
+	if (dimension != rhs->dimension)
+	{
+		std::cerr << "Dimensions do not match in absoluteVolumeDistance: "
+				<< dimension << " vs " << rhs->dimension << "\n";
+		return rhs->volume() + volume();
+	}
+
+	intersectUnionVolume(rhs, ival, uval);
+	return uval - ival;
+}
+
+bool MortonOctTree::equals(const MortonOctTree *rhs) const
+{
+	if (N != rhs->N || dimension != rhs->dimension)
+		return false;
+	return memcmp(runs, rhs->runs, 2 * N * sizeof(uint32_t)) == 0;
+}
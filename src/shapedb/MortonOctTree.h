@@ -0,0 +1,116 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * MortonOctTree.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *  A linearized, mappable alternative to MappableOctTree.  Every leaf of the
+ *  oct tree (full leaves and the set octants of partial leaves) covers a
+ *  contiguous range of Morton codes at a fixed maximum depth, so the whole
+ *  shape is just a sorted list of disjoint [start,end) code runs.  Containment
+ *  and intersection/union volume become linear merges of two flat arrays
+ *  instead of a recursion through the child nodes.
+ */
+
+#ifndef MORTONOCTTREE_H_
+#define MORTONOCTTREE_H_
+
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+#include "Cube.h"
+#include "MappableOctTree.h"
+using namespace std;
+
+//depth of the implicit octree codes are taken at, must be at least as deep
+//as any partial leaf of the source tree; 3*10 bits fit in a uint32_t
+#define MORTON_DEPTH 10
+
+class MortonOctTree
+{
+	float dimension;
+	unsigned count; //number of finest level cells set
+	unsigned N; //number of runs
+	uint32_t runs[]; //start/end pairs, must memalloc beyond
+
+	MortonOctTree()
+	{
+		//creation must be performed externally to properly allocate memory
+	}
+
+	static void collectRuns(const MOctNode* tree, const MChildNode& node,
+			uint32_t start, uint32_t size, vector<uint32_t>& runs);
+
+	//volume of a single finest level cell
+	float cellVolume() const
+	{
+		float c = dimension / (1 << MORTON_DEPTH);
+		return c * c * c;
+	}
+
+	//return the code of the finest cell containing the bottom corner of the
+	//given grid coordinates
+	static uint32_t encode(uint32_t x, uint32_t y, uint32_t z);
+
+	//return true if any cell in [s,e) is set
+	bool overlaps(uint32_t s, uint32_t e) const;
+
+public:
+
+	//return a linearized version of tree, the pointer should be deallocated using free
+	static MortonOctTree* create(const MappableOctTree *tree);
+
+	//expand back into a conventional oct tree at the given resolution
+	MappableOctTree* createMappable(float res) const;
+
+	unsigned bytes() const
+	{
+		return sizeof(MortonOctTree) + 2 * N * sizeof(uint32_t);
+	}
+
+	unsigned numRuns() const
+	{
+		return N;
+	}
+
+	void write(ostream& out) const;
+
+	float volume() const
+	{
+		return count * cellVolume();
+	}
+
+	bool containedIn(const MortonOctTree *rhs) const;
+
+	float intersectVolume(const MortonOctTree *rhs) const;
+	float unionVolume(const MortonOctTree *rhs) const;
+	void intersectUnionVolume(const MortonOctTree *rhs, float& ival,
+			float& uval) const;
+
+	float relativeVolumeDistance(const MortonOctTree *rhs) const;
+	float absoluteVolumeDistance(const MortonOctTree *rhs) const;
+
+	//object interface for MappableOctTree::create
+	bool containsPoint(float x, float y, float z) const;
+	bool intersects(const Cube& cube) const;
+
+	bool equals(const MortonOctTree *rhs) const;
+}__attribute__((__packed__));
+
+#endif /* MORTONOCTTREE_H_ */
@@ -0,0 +1,173 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * ResidentMemory.cpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ResidentMemory.h"
+#include <sys/mman.h>
+#include <cstring>
+#include <sstream>
+#include "CommandLine2/CommandLine.h"
+
+cl::opt<unsigned> ResidentBudget("resident-memory",
+		cl::desc("[server] Megabytes of index files to copy into huge page backed memory"),
+		cl::init(0));
+cl::opt<unsigned> ResidentPageSize("resident-page-size",
+		cl::desc("[server] Largest huge page size (KB) to back resident index files with, 2048 or 1048576"),
+		cl::init(2048));
+
+#define HUGE_PAGE_2MB (2UL*1024*1024)
+#define HUGE_PAGE_1GB (1024UL*1024*1024)
+
+boost::mutex ResidentMemory::lock;
+unsigned long ResidentMemory::used = 0;
+map<string, unsigned long> ResidentMemory::files;
+
+bool ResidentMemory::enabled()
+{
+	return ResidentBudget > 0;
+}
+
+//pagesize of zero asks for normal pages that are eligible to be transparently merged
+void* ResidentMemory::mapAnonymous(unsigned long len, unsigned long pagesize)
+{
+	//hugetlb pages are reserved up front so the copy can't fault for lack of them
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	if (pagesize > 0)
+	{
+#ifdef MAP_HUGETLB
+		flags |= MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+		flags |= __builtin_ctzl(pagesize) << MAP_HUGE_SHIFT;
+#endif
+#else
+		return NULL;
+#endif
+	}
+
+	void *ret = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (ret == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	if (pagesize == 0)
+		madvise(ret, len, MADV_HUGEPAGE);
+#endif
+	return ret;
+}
+
+bool ResidentMemory::reserve(unsigned long len)
+{
+	boost::unique_lock<boost::mutex> L(lock);
+	if (used + len > (unsigned long) ResidentBudget * 1024 * 1024)
+		return false;
+	used += len;
+	return true;
+}
+
+void ResidentMemory::unreserve(unsigned long len)
+{
+	boost::unique_lock<boost::mutex> L(lock);
+	used -= len;
+}
+
+void* ResidentMemory::copy(const string& name, const void *src,
+		unsigned long sz, unsigned long& maplen)
+{
+	maplen = 0;
+	if (!enabled() || sz == 0)
+		return NULL;
+
+	//largest configured pages first, a file that doesn't fit the budget
+	//rounded up to big pages may still fit with smaller ones
+	static const unsigned long hugesizes[] = { HUGE_PAGE_1GB, HUGE_PAGE_2MB };
+	void *mem = NULL;
+	unsigned long pagesize = 0;
+	unsigned long maxpage = (unsigned long) ResidentPageSize * 1024;
+	for (unsigned i = 0; i < sizeof(hugesizes) / sizeof(hugesizes[0]); i++)
+	{
+		if (hugesizes[i] > maxpage)
+			continue;
+		unsigned long len = (sz + hugesizes[i] - 1) / hugesizes[i] * hugesizes[i];
+		if (!reserve(len))
+			continue;
+		mem = mapAnonymous(len, hugesizes[i]);
+		if (mem)
+		{
+			pagesize = hugesizes[i];
+			maplen = len;
+			break;
+		}
+		unreserve(len);
+	}
+
+	if (mem == NULL)
+	{
+		//no huge pages set aside by the system, settle for transparent ones
+		unsigned long len = (sz + HUGE_PAGE_2MB - 1) / HUGE_PAGE_2MB
+				* HUGE_PAGE_2MB;
+		if (!reserve(len))
+			return NULL;
+		mem = mapAnonymous(len, 0);
+		if (mem == NULL)
+		{
+			unreserve(len);
+			return NULL;
+		}
+		maplen = len;
+	}
+
+	memcpy(mem, src, sz);
+	mprotect(mem, maplen, PROT_READ);
+
+	boost::unique_lock<boost::mutex> L(lock);
+	files[name] = pagesize;
+	return mem;
+}
+
+void ResidentMemory::release(const string& name, void *addr,
+		unsigned long maplen)
+{
+	munmap(addr, maplen);
+	boost::unique_lock<boost::mutex> L(lock);
+	used -= maplen;
+	files.erase(name);
+}
+
+string ResidentMemory::status()
+{
+	boost::unique_lock<boost::mutex> L(lock);
+	stringstream str;
+	str << "{";
+	for (map<string, unsigned long>::iterator itr = files.begin();
+			itr != files.end(); ++itr)
+	{
+		if (itr != files.begin())
+			str << ", ";
+		str << "\"" << itr->first << "\": ";
+		if (itr->second == 0)
+			str << "\"transparent\"";
+		else if (itr->second >= 1024 * 1024 * 1024)
+			str << "\"" << (itr->second >> 30) << "GB\"";
+		else
+			str << "\"" << (itr->second >> 20) << "MB\"";
+	}
+	str << "}";
+	return str.str();
+}
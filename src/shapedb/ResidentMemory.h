@@ -0,0 +1,63 @@
+/*
+Pharmit
+Copyright (c) David Ryan Koes, University of Pittsburgh and contributors.
+All rights reserved.
+
+Pharmit is licensed under both the BSD 3-clause license and the GNU
+Public License version 2. Any use of the code that retains its reliance
+on the GPL-licensed OpenBabel library is subject to the terms of the GPL2.
+
+Use of the Pharmit code independently of OpenBabel (or any other
+GPL2 licensed software) may choose between the BSD or GPL licenses.
+
+See the LICENSE file provided with the distribution for more information.
+
+*/
+
+/*
+ * ResidentMemory.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *  Copies of hot, read-only mapped files kept in anonymous memory backed by
+ *  huge pages, so random traversal of large indices doesn't spend its time
+ *  on TLB misses.  Copies are made only within a configured budget and
+ *  fall back to smaller huge pages, then transparent huge pages; when none
+ *  can be had the caller just keeps using the file mapping.
+ */
+
+#ifndef RESIDENTMEMORY_H_
+#define RESIDENTMEMORY_H_
+
+#include <string>
+#include <map>
+#include <boost/thread/mutex.hpp>
+
+using namespace std;
+
+class ResidentMemory
+{
+	static boost::mutex lock;
+	static unsigned long used; //bytes of resident copies
+	static map<string, unsigned long> files; //name of resident copy to page size, 0 for transparent
+
+	static void* mapAnonymous(unsigned long len, unsigned long pagesize);
+	static bool reserve(unsigned long len);
+	static void unreserve(unsigned long len);
+
+public:
+	//return a read only copy of the sz bytes at src, setting the length of
+	//the mapping to release; null if residency is off or no memory is available
+	static void* copy(const string& name, const void *src, unsigned long sz,
+			unsigned long& maplen);
+
+	//free a copy returned by copy
+	static void release(const string& name, void *addr, unsigned long maplen);
+
+	//json object from resident file name to the page size backing it
+	static string status();
+
+	static bool enabled();
+};
+
+#endif /* RESIDENTMEMORY_H_ */
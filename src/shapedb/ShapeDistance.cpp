@@ -188,3 +188,18 @@ float volumeDist(const MappableOctTree* x, const MappableOctTree* y)
 	return x->relativeVolumeDistance(y);
 }
 
+
+//same bounds for linearized trees
+float searchVolumeDist(const MortonOctTree* obj, const MortonOctTree* MIV,
+		const MortonOctTree* MSV, float& min, float& max)
+{
+	min = 1 - obj->intersectVolume(MSV)/obj->unionVolume(MIV);
+	max = 1 - obj->intersectVolume(MIV)/obj->unionVolume(MSV);
+
+	return min + max;
+}
+
+float volumeDist(const MortonOctTree* x, const MortonOctTree* y)
+{
+	return x->relativeVolumeDistance(y);
+}
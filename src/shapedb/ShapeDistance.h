@@ -23,6 +23,7 @@ See the LICENSE file provided with the distribution for more information.
 #ifndef SHAPEDISTANCE_H_
 #define SHAPEDISTANCE_H_
 #include "MappableOctTree.h"
+#include "MortonOctTree.h"
 
 typedef
 float (*shapeMetricFn)(const MappableOctTree* leftMIV, const MappableOctTree* leftMSV,
@@ -40,4 +41,8 @@ float searchVolumeDist(const MappableOctTree* obj, const MappableOctTree* MIV,
 		const MappableOctTree* MSV, float& min, float& max);
 float volumeDist(const MappableOctTree* x, const MappableOctTree* y);
 
+float searchVolumeDist(const MortonOctTree* obj, const MortonOctTree* MIV,
+		const MortonOctTree* MSV, float& min, float& max);
+float volumeDist(const MortonOctTree* x, const MortonOctTree* y);
+
 #endif /* SHAPEDISTANCE_H_ */
@@ -213,6 +213,10 @@ cl::opt<unsigned> SuperNodeDepth("superdepth",
 		cl::desc("Depth to descend to create aggregrated super root"),
 		cl::init(0));
 
+cl::opt<bool> MortonTrees("morton",
+		cl::desc("Store index trees as linearized Morton ordered runs"),
+		cl::init(false));
+
 cl::opt<unsigned> TimeTrials("time-trials",
 		cl::desc("Number of runs to get average for benchmarking"),
 		cl::init(1));
@@ -439,6 +443,7 @@ int main(int argc, char *argv[])
 				SwitchToPack);
 
 		GSSTreeCreator creator(&leveler, SuperNodeDepth);
+		creator.setMortonFormat(MortonTrees);
 
 		filesystem::path dbpath(Database.c_str());
 
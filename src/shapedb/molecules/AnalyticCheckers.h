@@ -487,4 +487,65 @@ public:
 	}
 
 };
+
+/* the sphere checkers of an object that can touch a given cube; oct tree
+ * creation narrows this at every level so that the small cubes near the
+ * surface are only tested against the handful of atoms around them
+ */
+class SphereCheckerSubset
+{
+	vector<const SphereChecker*> checkers;
+
+public:
+	SphereCheckerSubset()
+	{
+	}
+
+	SphereCheckerSubset(const vector<SphereChecker>& all, const Cube& cube)
+	{
+		for (unsigned i = 0, n = all.size(); i < n; i++)
+		{
+			if (all[i].intersectsCube(cube))
+				checkers.push_back(&all[i]);
+		}
+	}
+
+	//return the checkers of this subset that can touch cube
+	SphereCheckerSubset narrow(const Cube& cube) const
+	{
+		SphereCheckerSubset ret;
+		ret.checkers.reserve(checkers.size());
+		for (unsigned i = 0, n = checkers.size(); i < n; i++)
+		{
+			if (checkers[i]->intersectsCube(cube))
+				ret.checkers.push_back(checkers[i]);
+		}
+		return ret;
+	}
+
+	unsigned size() const
+	{
+		return checkers.size();
+	}
+
+	bool intersects(const Cube& cube) const
+	{
+		for (unsigned i = 0, n = checkers.size(); i < n; i++)
+		{
+			if (checkers[i]->intersectsCube(cube))
+				return true;
+		}
+		return false;
+	}
+
+	bool containsPoint(float x, float y, float z) const
+	{
+		for (unsigned i = 0, n = checkers.size(); i < n; i++)
+		{
+			if (checkers[i]->containsPoint(x, y, z))
+				return true;
+		}
+		return false;
+	}
+};
 #endif
@@ -170,6 +170,22 @@ static void clusterPoints(const vector<AtomPoint>& points,
 //computes a set of "interaction points" spatial location indicative of the ligand protein interface
 void OBAMolecule::computeInteractionPoints(OBMol& rmol, vector<Eigen::Vector3d>& respoints,
 		double interactionDist, double maxClusterDist, unsigned minClusterPoints)
+{
+	vector<Eigen::Vector3d> rcoords;
+	rcoords.reserve(rmol.NumAtoms());
+	for (OBAtomIterator aitr = rmol.BeginAtoms(); aitr != rmol.EndAtoms();
+			++aitr)
+	{
+		OBAtom* a = *aitr;
+		rcoords.push_back(Eigen::Vector3d(a->x(), a->y(), a->z()));
+	}
+	computeInteractionPoints(rcoords, respoints, interactionDist,
+			maxClusterDist, minClusterPoints);
+}
+
+void OBAMolecule::computeInteractionPoints(const vector<Eigen::Vector3d>& rcoords,
+		vector<Eigen::Vector3d>& respoints, double interactionDist,
+		double maxClusterDist, unsigned minClusterPoints)
 {
 	respoints.clear();
 	//first construct a bounding box for the ligand while assembling a
@@ -188,15 +204,14 @@ void OBAMolecule::computeInteractionPoints(OBMol& rmol, vector<Eigen::Vector3d>&
 	//then identify all coordinates that are interacting
 	double idistSq = interactionDist * interactionDist;
 
-	for (OBAtomIterator aitr = rmol.BeginAtoms(); aitr != rmol.EndAtoms();
-			++aitr)
+	for (unsigned r = 0, nr = rcoords.size(); r < nr; r++)
 	{
-		OBAtom* a = *aitr;
-		if (ligandBox.contains(a->x(), a->y(), a->z()))
+		const Eigen::Vector3d& a = rcoords[r];
+		if (ligandBox.contains(a.x(), a.y(), a.z()))
 		{
 			for (unsigned i = 0, n = points.size(); i < n; i++)
 			{
-				if (points[i].distSq(a->x(), a->y(), a->z()) <= idistSq)
+				if (points[i].distSq(a.x(), a.y(), a.z()) <= idistSq)
 				{
 					points[i].interactingCnt++;
 				}
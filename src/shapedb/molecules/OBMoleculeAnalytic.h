@@ -123,6 +123,13 @@ public:
 		return false;
 	}
 
+	//the part of the molecule that can touch cube, used by
+	//MappableOctTree::create to avoid retesting far away atoms
+	SphereCheckerSubset narrow(const Cube& cube) const
+	{
+		return SphereCheckerSubset(checkers, cube);
+	}
+
 	//return true if point is within object
 	bool containsPoint(float x, float y, float z) const
 	{
@@ -144,6 +151,10 @@ public:
 	void computeInteractionPoints(OBMol& rmol, vector<Eigen::Vector3d>& points,
 			double interactionDist=6.0, double maxClusterDist=4.0,
 			unsigned minClusterPoints=3.0);
+	//same, but the receptor is given by just its atom coordinates
+	void computeInteractionPoints(const vector<Eigen::Vector3d>& rcoords,
+			vector<Eigen::Vector3d>& points, double interactionDist=6.0,
+			double maxClusterDist=4.0, unsigned minClusterPoints=3.0);
 
 	//takes interaction points and puts them in a grid
 	void computeInteractionGridPoints(OBMol& rmol, MGrid& grid,
@@ -129,6 +129,13 @@ public:
 		return false;
 	}
 
+	//the part of the molecule that can touch cube, used by
+	//MappableOctTree::create to avoid retesting far away atoms
+	SphereCheckerSubset narrow(const Cube& cube) const
+	{
+		return SphereCheckerSubset(checkers, cube);
+	}
+
 	//return true if point is within object
 	bool containsPoint(float x, float y, float z) const
 	{
@@ -24,19 +24,12 @@ See the LICENSE file provided with the distribution for more information.
  */
 #include "tripletmatching.h"
 
-unsigned long const TripletMatchHash::prime_list[] =
-{ 53ul, 97ul, 193ul, 389ul, 769ul, 1543ul, 3079ul, 6151ul, 12289ul, 24593ul,
-		49157ul, 98317ul, 196613ul, 393241ul, 786433ul, 1572869ul, 3145739ul,
-		6291469ul, 12582917ul, 25165843ul, 50331653ul, 100663319ul,
-		201326611ul, 402653189ul, 805306457ul, 1610612741ul, 3221225473ul,
-		4294967291ul };
-const unsigned TripletMatchHash::endPrimeIndex =
-		sizeof(TripletMatchHash::prime_list) / sizeof(unsigned long);
-
-TripletMatchAllocator::TripletMatchAllocator(unsigned qsz) :
+TripletMatchAllocator::TripletMatchAllocator(unsigned qsz, MemoryAccountant *acct) :
 	qsize(qsz), PMsize(8 * (((sizeof(TripletMatch) + qsz
-			* sizeof(TripletMatchInfoArray)) - 1) / 8 + 1)) //align to 8 byte boudnary
+			* sizeof(TripletMatchInfoArray)) - 1) / 8 + 1)), //align to 8 byte boudnary
+			accountant(acct)
 {
+	allocator.setAccountant(acct);
 
 }
 
@@ -61,30 +54,355 @@ TripletMatchInfoArray* TripletMatchAllocator::newTripletMatchInfoArray(unsigned
 	return ptr;
 }
 
-//double the size of the table
-void TripletMatchHash::grow()
+//allocate an empty table of sz slots
+void TripletMatchHash::allocate(unsigned long sz)
 {
-	TripletMatch **oldtable = table;
+	table_size = sz;
+	alloc.charge(table_size*(1+sizeof(Slot)));
+	ctrl = (unsigned char*)malloc(table_size);
+	memset(ctrl, EMPTY, table_size);
+	slots = (Slot*)malloc(table_size*sizeof(Slot));
+	memset(slots, 0, table_size*sizeof(Slot));
+}
+
+//rehash into a table of newsize slots
+void TripletMatchHash::grow(unsigned long newsize)
+{
+	unsigned char *oldctrl = ctrl;
+	Slot *oldslots = slots;
 	unsigned long oldtable_size = table_size;
-	prime_index+=2;
-	if(prime_index >= endPrimeIndex)
-		table_size = table_size*2+1; //off the end
-	else
-		table_size = prime_list[prime_index];
 
-	table = (TripletMatch**)malloc(table_size*sizeof(TripletMatch*));
-	memset(table, 0, sizeof(TripletMatch*)*table_size);
+	allocate(newsize);
 
-	//rehash the old table
 	for(unsigned long i = 0; i < oldtable_size; i++)
 	{
-		if(oldtable[i] != NULL)
+		if(oldctrl[i] != EMPTY)
+		{
+			uint64_t h = hash(oldslots[i].id);
+			unsigned long pos = getPos(oldslots[i].id, h);
+			ctrl[pos] = oldctrl[i];
+			slots[pos] = oldslots[i];
+		}
+	}
+
+	alloc.release(oldtable_size*(1+sizeof(Slot)));
+	free(oldctrl);
+	free(oldslots);
+}
+
+void TripletMatchHash::reserve(unsigned long n)
+{
+	unsigned long sz = table_size;
+	while(7 * sz <= 8 * n)
+		sz *= 2;
+	if(sz > table_size)
+		grow(sz);
+}
+
+cl::opt<bool> LowMemoryMatching("low-memory-matching",
+		cl::desc("Match triplets by joining sorted runs instead of hashing every molecule"),
+		cl::init(false));
+cl::opt<unsigned> SemiJoinMemory("semijoin-memory",
+		cl::desc("MB of candidates to keep in memory before spilling to disk in low memory matching"),
+		cl::init(256));
+
+//stable LSD radix sort of candidates by molPos
+//the scratch buffer is charged to alloc while it is alive
+static void radixSortCandidates(vector<TripletCandidate>& cands, TripletMatchAllocator& alloc)
+{
+	unsigned long n = cands.size();
+	if (n < 2)
+		return;
+	alloc.charge(n * sizeof(TripletCandidate));
+	vector<TripletCandidate> tmp(n);
+	for (unsigned shift = 0; shift < TPD_MOLDATA_BITS; shift += 8)
+	{
+		unsigned long cnts[257];
+		memset(cnts, 0, sizeof(cnts));
+		for (unsigned long i = 0; i < n; i++)
+			cnts[((cands[i].molPos >> shift) & 0xff) + 1]++;
+		if (cnts[((cands[0].molPos >> shift) & 0xff) + 1] == n)
+			continue; //every key has the same digit
+		for (unsigned b = 0; b < 256; b++)
+			cnts[b + 1] += cnts[b];
+		for (unsigned long i = 0; i < n; i++)
+			tmp[cnts[(cands[i].molPos >> shift) & 0xff]++] = cands[i];
+		cands.swap(tmp);
+	}
+	alloc.release(n * sizeof(TripletCandidate));
+}
+
+//the candidates of a single query triplet as a sequence of sorted chunks,
+//chunks are kept in memory or in a temporary file; the memory they use
+//is charged to the query's accountant through alloc
+class CandidateRun
+{
+	struct Chunk
+	{
+		vector<TripletCandidate> mem;
+		off_t offset; //position in spill if mem is empty
+		unsigned long n;
+	};
+	vector<TripletCandidate> buffer; //unsorted candidates of the current chunk
+	vector<Chunk> chunks;
+	FILE *spill;
+	TripletMatchAllocator& alloc;
+	unsigned long chunkBytes; //in memory chunk data
+	unsigned long charged; //bytes currently charged to alloc
+
+	//bring the charge in line with the buffer and in memory chunks
+	void recharge()
+	{
+		unsigned long now = buffer.capacity() * sizeof(TripletCandidate) + chunkBytes;
+		if (now > charged)
+			alloc.charge(now - charged);
+		else
+			alloc.release(charged - now);
+		charged = now;
+	}
+
+public:
+	CandidateRun(TripletMatchAllocator& a): spill(NULL), alloc(a), chunkBytes(0), charged(0) {}
+	~CandidateRun()
+	{
+		if (spill)
+			fclose(spill);
+		alloc.release(charged);
+	}
+
+	void add(const TripletCandidate& c)
+	{
+		unsigned long cap = buffer.capacity();
+		buffer.push_back(c);
+		if (buffer.capacity() != cap)
+			recharge();
+	}
+
+	unsigned long bufferBytes() const
+	{
+		return buffer.size() * sizeof(TripletCandidate);
+	}
+
+	//sort the buffer into a new chunk, written to disk if toDisk
+	//return the number of bytes kept in memory
+	unsigned long finishChunk(bool toDisk)
+	{
+		if (buffer.size() == 0)
+			return 0;
+		radixSortCandidates(buffer, alloc);
+		chunks.push_back(Chunk());
+		Chunk& c = chunks.back();
+		c.n = buffer.size();
+		c.offset = 0;
+		if (toDisk)
 		{
-			TripletMatch *m = oldtable[i];
-			unsigned long pos = getPos(m->id);
-			table[pos] = m;
+			if (spill == NULL)
+				spill = tmpfile();
+			if (spill != NULL)
+			{
+				fseeko(spill, 0, SEEK_END);
+				c.offset = ftello(spill);
+				if (fwrite(&buffer[0], sizeof(TripletCandidate), c.n, spill) == c.n)
+				{
+					vector<TripletCandidate>().swap(buffer);
+					recharge();
+					return 0;
+				}
+			}
+			//could not spill, stay in memory
+		}
+		c.mem.swap(buffer);
+		buffer.clear();
+		chunkBytes += c.mem.capacity() * sizeof(TripletCandidate);
+		recharge();
+		return c.n * sizeof(TripletCandidate);
+	}
+
+	//merges the chunks of a run into a single sorted stream, candidates with
+	//the same molPos come out in the order they were added
+	class Reader
+	{
+		static const unsigned READSIZE = 4096;
+		struct Cursor
+		{
+			const CandidateRun::Chunk *chunk;
+			vector<TripletCandidate> buf; //for spilled chunks
+			unsigned long pos; //in chunk
+			unsigned long bufstart; //chunk position of buf[0]
+		};
+		const CandidateRun *run;
+		vector<Cursor> cursors;
+
+		const TripletCandidate& at(Cursor& c)
+		{
+			if (c.chunk->mem.size() > 0)
+				return c.chunk->mem[c.pos];
+			if (c.pos >= c.bufstart + c.buf.size())
+			{
+				//refill
+				c.bufstart = c.pos;
+				unsigned long num = min((unsigned long) READSIZE, c.chunk->n - c.pos);
+				c.buf.resize(num);
+				fseeko(run->spill, c.chunk->offset + c.pos * sizeof(TripletCandidate), SEEK_SET);
+				if (fread(&c.buf[0], sizeof(TripletCandidate), num, run->spill) != num)
+				{
+					cerr << "Error reading spilled triplet candidates\n";
+					abort();
+				}
+			}
+			return c.buf[c.pos - c.bufstart];
+		}
+
+		//cursor with smallest current molPos, earliest chunk on ties
+		Cursor* front()
+		{
+			Cursor *best = NULL;
+			unsigned long bestPos = 0;
+			for (unsigned i = 0, n = cursors.size(); i < n; i++)
+			{
+				Cursor& c = cursors[i];
+				if (c.pos >= c.chunk->n)
+					continue;
+				unsigned long mp = at(c).molPos;
+				if (best == NULL || mp < bestPos)
+				{
+					best = &c;
+					bestPos = mp;
+				}
+			}
+			return best;
+		}
+	public:
+		Reader(const CandidateRun *r): run(r)
+		{
+			cursors.resize(run->chunks.size());
+			for (unsigned i = 0, n = cursors.size(); i < n; i++)
+			{
+				cursors[i].chunk = &run->chunks[i];
+				cursors[i].pos = 0;
+				cursors[i].bufstart = 0;
+			}
+		}
+
+		//return false if the run is exhausted
+		bool peek(TripletCandidate& c)
+		{
+			Cursor *f = front();
+			if (f == NULL)
+				return false;
+			c = at(*f);
+			return true;
+		}
+
+		void next()
+		{
+			Cursor *f = front();
+			if (f)
+				f->pos++;
+		}
+	};
+};
+
+TripletMatches::~TripletMatches()
+{
+	for (unsigned i = 0, n = runs.size(); i < n; i++)
+		delete runs[i];
+	alloc.release(survivors.capacity() * sizeof(unsigned long)
+			+ expanded.size() * sizeof(ThreePointData));
+}
+
+void TripletMatches::addCandidate(unsigned mid, const ThreePointData& tdata,
+		const QueryTriplet& trip, unsigned which)
+{
+	while (runs.size() <= curIndex)
+		runs.push_back(new CandidateRun(alloc));
+
+	TripletCandidate c;
+	c.molPos = tdata.molPos;
+	c.tdata = &tdata;
+	c.trip = &trip;
+	c.mid = mid;
+	c.which = which;
+
+	CandidateRun *run = runs[curIndex];
+	run->add(c);
+	unsigned long budget = (unsigned long) SemiJoinMemory * 1024 * 1024;
+	if (run->bufferBytes() + runBytes > budget)
+		runBytes += run->finishChunk(true);
+}
+
+//finish the run of the current triplet and collect its molecules
+void TripletMatches::sealRun()
+{
+	survivors.clear();
+	if (runs.size() <= curIndex)
+		return;
+	unsigned long cap = survivors.capacity();
+
+	CandidateRun *run = runs[curIndex];
+	unsigned long budget = (unsigned long) SemiJoinMemory * 1024 * 1024;
+	runBytes += run->finishChunk(run->bufferBytes() + runBytes > budget);
+
+	CandidateRun::Reader reader(run);
+	TripletCandidate c;
+	for (; reader.peek(c); reader.next())
+	{
+		if (survivors.size() == 0 || survivors.back() != c.molPos)
+			survivors.push_back(c.molPos);
+	}
+	alloc.charge((survivors.capacity() - cap) * sizeof(unsigned long));
+}
+
+//merge-join the runs of every triplet on molPos and perform the full
+//matching only for the molecules present in all of them; each molecule
+//sees its candidates in the same order as the hash based matcher
+void TripletMatches::finish()
+{
+	if (!semijoin)
+		return;
+	if (runs.size() < qsize || curIndex < qsize)
+		return; //stopped before the last triplet, nothing can be valid
+
+	counts.assign(qsize, 0);
+	vector<CandidateRun::Reader> readers;
+	for (unsigned i = 0; i < qsize; i++)
+		readers.push_back(CandidateRun::Reader(runs[i]));
+
+	TripletCandidate c;
+	for (unsigned s = 0, ns = survivors.size(); s < ns; s++)
+	{
+		unsigned long molPos = survivors[s];
+		TripletMatch *match = NULL;
+		for (unsigned i = 0; i < qsize; i++)
+		{
+			CandidateRun::Reader& r = readers[i];
+			//skip molecules that dropped out
+			while (r.peek(c) && c.molPos < molPos)
+				r.next();
+			for (; r.peek(c) && c.molPos == molPos; r.next())
+			{
+				if (i == 0)
+				{
+					if (match == NULL)
+						match = alloc.newTripletMatch(c.mid, *c.tdata);
+					if (match == NULL)
+						continue;
+				}
+				else if (match == NULL || !match->hasValidConnections(*c.tdata, *c.trip, i))
+					continue;
+
+				TripletMatchInfo info(*c.tdata, c.which, c.trip->getNextUnconnected(),
+						c.trip->getPrevUnconnected());
+				if (match->add(info, *c.trip, i, alloc))
+					counts[i]++;
+			}
 		}
+		if (match != NULL && match->valid())
+			validMatches.push_back(match);
 	}
 
-	free(oldtable);
+	for (unsigned i = 0, n = runs.size(); i < n; i++)
+		delete runs[i];
+	runs.clear();
+	runBytes = 0;
 }
@@ -32,10 +32,14 @@ See the LICENSE file provided with the distribution for more information.
 #include "ThreePointData.h"
 #include <boost/thread.hpp>
 #include <vector>
+#include <deque>
 #include <boost/array.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/pool/object_pool.hpp>
 #include "params.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 using namespace std;
 
 
@@ -94,8 +98,9 @@ class TripletMatchAllocator
 	const unsigned qsize; //number of triplets
 	const unsigned PMsize; //size of a point match
 	BumpAllocator<1024*1024, false> allocator; //1MB chunks, NOT THREAD SAFE
+	MemoryAccountant *accountant; //also charged for match tables, may be null
 public:
-	TripletMatchAllocator(unsigned qsz);
+	TripletMatchAllocator(unsigned qsz, MemoryAccountant *acct = NULL);
 	TripletMatch* newTripletMatch(unsigned mid, const ThreePointData& tdata);
 	TripletMatchInfoArray* newTripletMatchInfoArray(unsigned numEl);
 
@@ -104,6 +109,10 @@ public:
 		allocator.clear();
 	}
 
+	//account for memory allocated outside the bump allocator
+	void charge(unsigned long bytes) { if(accountant) accountant->charge(bytes); }
+	void release(unsigned long bytes) { if(accountant) accountant->release(bytes); }
+
 	unsigned numChunks() const { return allocator.numChunks(); }
 };
 
@@ -360,22 +369,79 @@ struct TripletMatch
 };
 
 
-//an open address hash table
+//an open address hash table laid out like a swiss table: one control byte per
+//slot (empty or 7 bits of the hash) is probed a group of 16 at a time and the
+//ids are stored inline, so a lookup only touches the TripletMatch it returns
 //intentionally not thread-safe (parrallel matching doesn't work so well, so ditch the overhead)
 class TripletMatchHash
 {
-	TripletMatch **table;
-	unsigned prime_index;
-	unsigned long table_size;
+	static const unsigned GROUP = 16;
+	static const unsigned char EMPTY = 0x80;
+	static const unsigned long INITIAL_SIZE = 1UL << 8; //grow or reserve as needed
+
+	struct Slot
+	{
+		unsigned long id;
+		TripletMatch *match;
+	};
+
+	unsigned char *ctrl;
+	Slot *slots;
+	unsigned long table_size; //power of two
 	unsigned long num_elements;
 
 	TripletMatchAllocator& alloc;
 
-	const static unsigned long  prime_list[];
-	static unsigned const endPrimeIndex;
+	void allocate(unsigned long sz);
+	void grow(unsigned long newsize);
+
+	//first slot of the group h starts probing at
+	unsigned long groupStart(uint64_t h) const
+	{
+		return (h >> 7) & (table_size - 1) & ~(unsigned long) (GROUP - 1);
+	}
+
+	//bitmask of the slots in the group starting at g with control byte c
+	unsigned matchGroup(unsigned long g, unsigned char c) const
+	{
+#if defined(__SSE2__)
+		__m128i group = _mm_loadu_si128((const __m128i*) (ctrl + g));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+		unsigned mask = 0;
+		for (unsigned i = 0; i < GROUP; i++)
+		{
+			if (ctrl[g + i] == c)
+				mask |= 1 << i;
+		}
+		return mask;
+#endif
+	}
+
+	//return the slot holding id, or the empty slot it belongs in
+	unsigned long getPos(unsigned long id, uint64_t h) const
+	{
+		unsigned char tag = h & 0x7f;
+		unsigned long g = groupStart(h);
+		//triangular probing over groups visits every group
+		for (unsigned long step = GROUP;; step += GROUP)
+		{
+			for (unsigned m = matchGroup(g, tag); m; m &= m - 1)
+			{
+				unsigned long pos = g + __builtin_ctz(m);
+				if (slots[pos].id == id)
+					return pos;
+			}
+			unsigned empty = matchGroup(g, EMPTY);
+			if (empty)
+				return g + __builtin_ctz(empty);
+			g = (g + step) & (table_size - 1);
+		}
+		return 0;
+	}
 
-	void grow();
-	unsigned long hash(unsigned long id)
+public:
+	static uint64_t hash(unsigned long id)
 	{
 		//hash int using murmerhash2
 		const uint64_t m = 0xc6a4a7935bd1e995;
@@ -394,76 +460,83 @@ class TripletMatchHash
 		h *= m;
 		h ^= h >> r;
 
-		return h % table_size;
+		return h;
 	}
 
-	unsigned long getPos(unsigned long id)
+	TripletMatchHash(TripletMatchAllocator& a): ctrl(NULL), slots(NULL), table_size(0), num_elements(0), alloc(a)
 	{
-		unsigned long pos = hash(id);
-		while (table[pos] != NULL)
-		{
-			if (table[pos]->id == id)
-				return pos;
-			pos++;
-			if (pos >= table_size)
-				pos = 0;
-		}
-		return pos;
+		allocate(INITIAL_SIZE);
 	}
 
-public:
-	TripletMatchHash(TripletMatchAllocator& a): prime_index(12), table_size(prime_list[prime_index]), num_elements(0), alloc(a)
+	~TripletMatchHash()
 	{
-		table = (TripletMatch**)malloc(sizeof(TripletMatch*)*table_size);
-		memset(table, 0, sizeof(TripletMatch*)*table_size);
+		alloc.release(table_size*(1+sizeof(Slot)));
+		free(ctrl);
+		free(slots);
 	}
 
-	~TripletMatchHash()
+	//make room for n elements without growing
+	void reserve(unsigned long n);
+
+	//start loading the group id will be found in, return id's hash
+	uint64_t prefetch(unsigned long id) const
 	{
-		free(table);
+		uint64_t h = hash(id);
+		unsigned long g = groupStart(h);
+		__builtin_prefetch(ctrl + g);
+		__builtin_prefetch(slots + g);
+		return h;
 	}
 
-	//return non-null if pm already exists
-	TripletMatch* exists(unsigned long id)
+	//return non-null if pm already exists, h is hash(id)
+	TripletMatch* exists(unsigned long id, uint64_t h)
 	{
-		return table[getPos(id)];
+		return slots[getPos(id, h)].match;
 	}
 
 	//allocates a triplet match and returns it
 	//alternatively, if returns an already created triplet match
-	TripletMatch* create(unsigned mid, const ThreePointData& tdata)
+	//h is hash(tdata.molPos)
+	TripletMatch* create(unsigned mid, const ThreePointData& tdata, uint64_t h)
 	{
 		unsigned long id = tdata.molPos;
+		unsigned long pos = getPos(id, h);
+		if (ctrl[pos] != EMPTY)
+			return slots[pos].match;
 
-		unsigned long pos = hash(id);
-		while (table[pos] != NULL)
-		{
-			if (table[pos]->id == id)
-			{
-				return table[pos];
-			}
-			pos++;
-			if (pos >= table_size)
-				pos = 0;
-		}
 		TripletMatch *match = alloc.newTripletMatch(mid, tdata);
 		if(match == nullptr) return nullptr;
 
-		table[pos] = match;
+		ctrl[pos] = h & 0x7f;
+		slots[pos].id = id;
+		slots[pos].match = match;
 		num_elements++;
 
-		if(num_elements >= table_size/8)
+		//keep at most 7/8 full so there is always an empty slot
+		if(8 * num_elements >= 7 * table_size)
 		{
-			grow();
+			grow(table_size * 2);
 		}
 		return match;
 	}
 
 	unsigned long size() const { return table_size; };
 
-	TripletMatch* operator[](unsigned long pos) { return table[pos]; }
+	TripletMatch* operator[](unsigned long pos) { return slots[pos].match; }
 };
 
+//a triplet that passed the cheap checks, recorded by the semi-join matcher
+struct TripletCandidate
+{
+	unsigned long molPos;
+	const ThreePointData *tdata; //points into the mapped triplet data
+	const QueryTriplet *trip;
+	unsigned mid;
+	unsigned which;
+};
+
+class CandidateRun;
+
 //keep track of all our  matches in a thread safe manner; however
 // all threads must finish matching one query point before moving onto the next
 // one; also I find that splitting the database up and having separate threads
@@ -485,64 +558,156 @@ class TripletMatches
 	unsigned curIndex;
 	unsigned qsize;
 
+	//low memory semi-join mode: rather than keeping a TripletMatch for every
+	//molecule that hits the first triplet, the candidates of each query
+	//triplet are kept as a run sorted by molPos (spilled to disk when over
+	//budget) and only molecules present in every run get a TripletMatch
+	bool semijoin;
+	vector<CandidateRun*> runs;
+	vector<unsigned long> survivors; //sorted molPos of the last sealed run
+	unsigned long runBytes; //in memory candidate data
+	//runs, survivors and expanded are charged to alloc's accountant
+	vector<TripletMatch*> validMatches;
+	deque<ThreePointData> expanded; //candidates that don't live in the mapped data
+
+	void addCandidate(unsigned mid, const ThreePointData& tdata, const QueryTriplet& trip, unsigned which);
+	void sealRun();
+
 public:
-	TripletMatches(TripletMatchAllocator& a, const QueryParameters& p, unsigned sz, unsigned nthreads) : params(p), alloc(a), seenMatches(a),
-	 heads(nthreads), counts(sz, 0), curIndex(0), qsize(sz)
+	TripletMatches(TripletMatchAllocator& a, const QueryParameters& p, unsigned sz, unsigned nthreads, bool sj = false) : params(p), alloc(a), seenMatches(a),
+	 heads(nthreads), counts(sz, 0), curIndex(0), qsize(sz), semijoin(sj), runBytes(0)
 	{
 		for(unsigned i = 0; i < nthreads; i++)
 			heads[i].head = i;
 	}
 
-	virtual ~TripletMatches()
+	virtual ~TripletMatches();
+
+	//called once all triplets are processed, before popping
+	void finish();
+
+	//expect about n distinct matches
+	void reserve(unsigned long n)
+	{
+		if(semijoin) //the hash table isn't used
+			return;
+		seenMatches.reserve(n);
+	}
+
+	//start loading the table entry for tdata, which will be added soon;
+	//returns the key's hash to pass to add so it isn't computed twice
+	uint64_t prefetch(const ThreePointData& tdata) const
 	{
+		if(semijoin)
+			return 0;
+		return seenMatches.prefetch(tdata.molPos);
 	}
 
 	//register that we are now processing the next triplet in the query
 	//return true if there is still a possibility of matching something
 	bool nextIndex()
 	{
+		if(semijoin)
+			sealRun();
 		bool stillgood = counts[curIndex];
 		curIndex++;
 		assert(curIndex <= qsize); /* equal at end */
 		return stillgood;
 	}
 
-	//add point, return true if triplet is actual valid
+	//whether a record passed the checks that don't depend on its conformer,
+	//so the conformers collapsed into it can reuse the answer
+	enum FilterResult { FilterUnknown, FilterPass, FilterFail };
+
+	//trip.isMatch, unless filter already knows the answer
+	static bool isMatch(const ThreePointData& tdata, const QueryTriplet& trip, FilterResult& filter)
+	{
+		if(filter == FilterUnknown)
+			filter = trip.isMatch(tdata) ? FilterPass : FilterFail;
+		return filter == FilterPass;
+	}
+
+	//add a triplet that was expanded from a collapsed record, so isn't
+	//backed by the mapped triplet data; semi-join candidates keep a pointer
+	//to it so it is copied into storage that lives as long as we do and is
+	//charged to the query's accountant
+	bool addExpanded(unsigned mid, const ThreePointData& tdata, const QueryTriplet& trip, unsigned which, FilterResult& filter)
+	{
+		if(!semijoin)
+			return add(mid, tdata, trip, which, filter);
+		expanded.push_back(tdata);
+		if(add(mid, expanded.back(), trip, which, filter))
+		{
+			alloc.charge(sizeof(ThreePointData));
+			return true;
+		}
+		expanded.pop_back();
+		return false;
+	}
+
 	bool add(unsigned mid, const ThreePointData& tdata, const QueryTriplet& trip, unsigned which)
+	{
+		FilterResult filter = FilterUnknown;
+		return add(mid, tdata, trip, which, filter);
+	}
+
+	bool add(unsigned mid, const ThreePointData& tdata, const QueryTriplet& trip, unsigned which, FilterResult& filter)
+	{
+		uint64_t h = semijoin ? 0 : TripletMatchHash::hash(tdata.molPos);
+		return add(mid, tdata, trip, which, filter, h);
+	}
+
+	//add point, return true if triplet is actual valid
+	//filter records the result of the query checks once they are made
+	//h is the hash of tdata.molPos returned by prefetch
+	bool add(unsigned mid, const ThreePointData& tdata, const QueryTriplet& trip, unsigned which, FilterResult& filter, uint64_t h)
 	{
 		//see if we've seen this match already
 		unsigned long key = tdata.molPos;
 		TripletMatch *match = NULL;
 
-		//check against query params
-		if(tdata.nrot < params.minRot)
-			return false;
-		if(tdata.nrot > params.maxRot)
+		if(filter == FilterFail)
 			return false;
 
-		if(tdata.weight < params.reducedMinWeight)
-			return false;
-		if(tdata.weight > params.reducedMaxWeight)
+		//check against query params
+		if(tdata.nrot < params.minRot || tdata.nrot > params.maxRot
+				|| tdata.weight < params.reducedMinWeight
+				|| tdata.weight > params.reducedMaxWeight)
+		{
+			filter = FilterFail;
 			return false;
+		}
+
+		if(semijoin)
+		{
+			//must have hit the previous triplet
+			if(curIndex > 0 && !binary_search(survivors.begin(), survivors.end(), key))
+				return false;
+			if(!isMatch(tdata, trip, filter))
+				return false;
+			addCandidate(mid, tdata, trip, which);
+			counts[curIndex]++;
+			return true;
+		}
 
 		//do fast checks before calling isMatch
 		if(curIndex > 0)
 		{
 			//must already exist
-			match = seenMatches.exists(key);
+			match = seenMatches.exists(key, h);
 			if(match == NULL)
 				return false;
 			if(!match->hasValidConnections(tdata, trip, curIndex))
 				return false;
-			if(!trip.isMatch(tdata))
+			if(!isMatch(tdata, trip, filter))
 				return false;
 		}
 		else
 		{
-			if(!trip.isMatch(tdata))
+			if(!isMatch(tdata, trip, filter))
 				return false;
 			//create the match
-			match = seenMatches.create(mid, tdata);
+			match = seenMatches.create(mid, tdata, h);
 		}
 		//create match info
 		//it should be impossible for match to by NULL here, but somehow it is
@@ -563,6 +728,14 @@ public:
 	{
 		unsigned nthreads = heads.size();
 		assert(t < nthreads);
+		if(semijoin)
+		{
+			if(heads[t].head >= validMatches.size())
+				return false;
+			match = validMatches[heads[t].head];
+			heads[t].head += nthreads;
+			return true;
+		}
 		while(heads[t].head < seenMatches.size())
 		{
 			unsigned long pos = heads[t].head;
@@ -583,7 +756,12 @@ public:
 
 	//number of matches in all
 	size_t total() { return counts.back(); }
-	size_t empty(unsigned t) {return seenMatches.size() <= heads[t].head; }
+	size_t empty(unsigned t)
+	{
+		if(semijoin)
+			return validMatches.size() <= heads[t].head;
+		return seenMatches.size() <= heads[t].head;
+	}
 
 	void dumpCnts()
 	{
@@ -380,6 +380,37 @@ Pharmit.Query = (function() {
         //escape special characters to avoid injections
         var escHTML = function(str) { return $('<div/>').text(str).html(); };	
 
+        //decode a base64 string of little endian values into a typed array
+        var decodeTypedArray = function(str, ArrayType) {
+            var bin = atob(str);
+            var bytes = new Uint8Array(bin.length);
+            for(var i = 0, n = bin.length; i < n; i++) {
+                bytes[i] = bin.charCodeAt(i);
+            }
+            return new ArrayType(bytes.buffer);
+        };
+
+        //convert a typed array mesh into the arrays the viewer expects
+        var decodeMesh = function(ret) {
+            if(ret.encoding != "base64") return ret;
+            var coords = decodeTypedArray(ret.vertices, Float32Array);
+            var norms = decodeTypedArray(ret.normals, Float32Array);
+            var faces = decodeTypedArray(ret.faces, Uint32Array);
+            ret.vertexArr = [];
+            for(var i = 0, n = coords.length; i < n; i += 3) {
+                ret.vertexArr.push({x: coords[i], y: coords[i+1], z: coords[i+2]});
+            }
+            ret.normalArr = [];
+            for(i = 0, n = norms.length; i < n; i += 3) {
+                ret.normalArr.push({x: norms[i], y: norms[i+1], z: norms[i+2]});
+            }
+            ret.faceArr = Array.prototype.slice.call(faces);
+            delete ret.vertices;
+            delete ret.normals;
+            delete ret.faces;
+            return ret;
+        };
+
         var updateShapeMesh = function(sel) {
             //send query to server to get mesh
             var qobj = getQueryObj(true);
@@ -387,11 +418,13 @@ Pharmit.Query = (function() {
 
             var postData = {cmd: 'getmesh',
                     type: kind,
+                    encoding: 'base64',
                     json: JSON.stringify(qobj)
             };
 
             if(sel.mesh === null || sel.meshtolerance != sel.val()) {				
                 $.post(Pharmit.server, postData, null, 'json').done(function(ret) {
+                    ret = decodeMesh(ret);
 
                     if(ret.tolerance == sel.val() || sel.mesh === null) {
                         if(sel.mesh) viewer.removeMesh(sel.mesh);
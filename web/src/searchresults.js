@@ -32,26 +32,56 @@ Pharmit.SearchResults = (function() {
         var minimize = null;
         var save = null;
         var timeout = null;
+        var cursor = ""; //how much of the result set the table has seen
+        var rows = []; //[name, val, mass, rbnds, seq] of every current result
+        var sorted = false; //rows are in sortcol/sortdir order
+        var sortcol = -1;
+        var sortdir = "";
         var results = r;
         var receptor = null;
         var cancel = null;
         var queryStart = new Date();
 
-        //format that provided data (mangle the names appropriately)		
-        var processData = function(data) {
-
-            if(data.status === 0)
-                return {error: data.msg};
+        //datatables asks for pages as if from the server, but the rows
+        //are kept here and only what changed is fetched when polling
+        var servePage = function(data, callback) {
+            var col = data.order.length > 0 ? data.order[0].column : 1;
+            var dir = data.order.length > 0 ? data.order[0].dir : "asc";
+            if(!sorted || col != sortcol || dir != sortdir) {
+                var sign = dir == "desc" ? -1 : 1;
+                rows.sort(function(a, b) {
+                    if(a[col] != b[col]) return a[col] < b[col] ? -sign : sign;
+                    return a[4]-b[4]; //arrival order breaks ties
+                });
+                sorted = true;
+                sortcol = col;
+                sortdir = dir;
+            }
 
-                var ret = data.data;
+            var end = data.length < 0 ? rows.length : data.start+data.length;
+            var page = rows.slice(data.start, end).map(function(r) {
+                //mangle the names appropriately and round rmsd
+                return [results.mangleName(r[0]), numeral(r[1]).format('0.000'), r[2], r[3], r[4]];
+            });
+            callback({draw: data.draw, recordsTotal: rows.length, recordsFiltered: rows.length, data: page});
+        };
 
-                for(var i = 0; i < ret.length; i++) {
-                    //round rmsd
-                    ret[i][1] = numeral(ret[i][1]).format('0.000');
-                    ret[i][0] = results.mangleName(ret[i][0]);
+        //merge the results that arrived or were dropped since the cursor
+        var applyDelta = function(ret) {
+            if(ret.reset) rows = [];
+            if(ret.ids) {
+                for(var i = 0; i < ret.ids.length; i++) {
+                    rows.push([ret.names[i], ret.vals[i], ret.weights[i], ret.rbnds[i], ret.ids[i]]);
                 }
-
-                return ret;
+            }
+            if(ret.removed && ret.removed.length > 0) {
+                var gone = {};
+                for(var j = 0; j < ret.removed.length; j++) {
+                    gone[ret.removed[j]] = true;
+                }
+                rows = rows.filter(function(r) { return !gone[r[4]]; });
+            }
+            sorted = false;
         };
 
 
@@ -95,6 +125,9 @@ Pharmit.SearchResults = (function() {
 
                     //setup table
                     qid = ret.qid;
+                    cursor = "";
+                    rows = [];
+                    sorted = false;
                     var numrows = Math.floor((body.height()-120)/28); //magic numbers!
                     table.dataTable({
                         searching: false,
@@ -139,16 +172,10 @@ Pharmit.SearchResults = (function() {
                                              },
                                              serverSide: true,
                                              processing: false,
-                                             ajax: {
-                                                 url: Pharmit.server,
-                                                 data: {
-                                                     cmd: "getdata",
-                                                     qid: qid
-                                                 },
-                                                 dataSrc: processData
-                                             }
+                                             ajax: servePage
 
                     });												
+                    pollResults();
 
                 } else {
                     cancel();
@@ -170,7 +197,7 @@ Pharmit.SearchResults = (function() {
 
         this.show = function() {
             phdiv.show();
-            table.DataTable().ajax.reload();
+            table.DataTable().draw(false);
         };
 
         //cancel any query. clear out the table, and hide the div
@@ -188,6 +215,7 @@ Pharmit.SearchResults = (function() {
                 table.DataTable().clear();
             }
             qid = null;
+            rows = [];
             minimize.button( "option", "disabled", true );
             save.button( "option", "disabled", true );
 
@@ -208,13 +236,13 @@ Pharmit.SearchResults = (function() {
         var minimizeResults = function() {
             //hide us, show minresults
             phdiv.hide();
-            var cnt = table.DataTable().ajax.json().recordsTotal;
+            var cnt = rows.length;
 
             var qobj = $.extend({}, query);
             qobj.receptor = receptor;
             minresults.minimize(qid, qobj, cnt, function() {
                 phdiv.show();			
-                table.DataTable().ajax.reload();
+                table.DataTable().draw(false);
             });
         };
 
@@ -254,42 +282,60 @@ Pharmit.SearchResults = (function() {
         $('<tbody>').appendTo(table);
 
 
-        //setup event handlers for table - this should be done but once
-        table.on('xhr.dt', function(e, settings, json) {
-            if(json.finished) {
-                var lang = table.DataTable().settings()[0].oLanguage;
-                var queryTime = (new Date() - queryStart)/1000.0;
-                if(json.recordsTotal === 0) {
-                    lang.emptyTable = lang.sEmptyTable = "No results found";
-                } else {
-                    lang.sInfo = "<span title='Query took "+queryTime+" seconds'>Showing _START_ to _END_ of _TOTAL_ hits";
-                    if(json.benchmark) {
-                        lang.sInfo += ". EF: "+numeral(json.benchmark.EF).format('0.0');
-                        lang.sInfo += ", F1: "+numeral(json.benchmark.F1).format('0.00');
-                    }
-                    lang.sInfo +="</span>";								
-                    minimize.button( "option", "disabled", false );
-                    save.button( "option", "disabled", false );
-                    save.one('click', function() {
-                        ga('send','event','save','pharmacophore',query.subset,json.recordsTotal);
-                    });
+        //label the table once the query is done
+        var finishResults = function(ret) {
+            var lang = table.DataTable().settings()[0].oLanguage;
+            var queryTime = (new Date() - queryStart)/1000.0;
+            if(rows.length === 0) {
+                lang.emptyTable = lang.sEmptyTable = "No results found";
+            } else {
+                lang.sInfo = "<span title='Query took "+queryTime+" seconds'>Showing _START_ to _END_ of _TOTAL_ hits";
+                if(ret.benchmark) {
+                    lang.sInfo += ". EF: "+numeral(ret.benchmark.EF).format('0.0');
+                    lang.sInfo += ", F1: "+numeral(ret.benchmark.F1).format('0.00');
                 }
-
-            } 
-            else if(json.status === 0) {
-                //alert(json.msg);
+                lang.sInfo +="</span>";								
+                minimize.button( "option", "disabled", false );
+                save.button( "option", "disabled", false );
+                var total = rows.length;
+                save.one('click', function() {
+                    ga('send','event','save','pharmacophore',query.subset,total);
+                });
             }
-            else {
-                viewer.setResult(); //clear in case clicked on
-                //poll server
-                clearTimeout(timeout); //no more than one at once
-                timeout = setTimeout(function() {
-                    if(qid > 0) {
-                        table.DataTable().ajax.reload();
+        };
+
+        //fetch only the results that changed since the cursor and redraw
+        //the current page from the merged rows
+        var pollResults = function() {
+            if(qid > 0) {
+                var pollqid = qid;
+                $.post(Pharmit.server, {cmd: 'getdata', qid: qid, cursor: cursor}, null, 'json').done(function(ret) {
+                    if(pollqid != qid) return; //superceded
+                    if(ret.status === 0) {
+                        //alert(ret.msg);
+                        return;
                     }
-                }, 1000);	
-            }					 
-        });	
+                    cursor = ret.cursor;
+                    if(!ret.unchanged) {
+                        applyDelta(ret);
+                        viewer.setResult(); //clear in case clicked on
+                    }
+                    if(ret.finished) {
+                        finishResults(ret);
+                    } else {
+                        clearTimeout(timeout); //no more than one at once
+                        timeout = setTimeout(pollResults, 1000);
+                    }
+                    if(!ret.unchanged || ret.finished) {
+                        table.DataTable().draw(false); //stay on the current page
+                    }
+                }).fail(function() {
+                    if(pollqid != qid) return;
+                    clearTimeout(timeout);
+                    timeout = setTimeout(pollResults, 1000);
+                });
+            }
+        };
 
         table.on('draw.dt', function() {
             $('.pharmit_namecol span').powerTip({mouseOnToPopup:true,placement:'s',smartPlacement:true});
@@ -310,7 +356,7 @@ Pharmit.SearchResults = (function() {
                 $.post(Pharmit.server,
                         {cmd: 'getmol',
                     qid: qid,
-                    loc: mid
+                    seq: mid
                         }).done(function(ret) {
                             if( $(r).hasClass('selected')) { //still selected
                                 viewer.setResult(ret);